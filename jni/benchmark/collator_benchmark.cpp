@@ -0,0 +1,325 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  Native microbenchmark for the JSON and REVID collators. It calls the collation functions
+//  directly (no JNI, no SQLite) over generated corpora and prints, for each corpus and rule,
+//  the time and number of mallocs per comparison.
+//
+//  It then rebuilds a view index (CREATE INDEX over JSON keys) in a scratch database with 0, 1,
+//  2, 4 and 8 sorter worker threads, and prints the time each rebuild took.
+//
+//  Build:  cd sqlite-custom && ./gradlew -P spec=java cbljavacollatorbenchLinux_x86_64Executable
+//  Run:    cbljavacollatorbench [comparisons-per-case] [locale] [index-rows]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <unicode/uclean.h>
+
+#include "sqlite3.h"
+#include "sqlite_collators.h"
+#include "collator_benchmark.h"
+
+#define DEFAULT_COMPARISONS 1000000
+#define DEFAULT_INDEX_ROWS 500000
+#define CORPUS_SIZE 4096
+
+std::atomic<long> gBenchAllocations(0);
+
+// ICU allocates through these, so its mallocs are counted along with the collators' own.
+static void* U_CALLCONV benchICUAlloc(const void* context, size_t size) {
+    ++gBenchAllocations;
+    return malloc(size);
+}
+
+static void* U_CALLCONV benchICURealloc(const void* context, void* mem, size_t size) {
+    ++gBenchAllocations;
+    return realloc(mem, size);
+}
+
+static void U_CALLCONV benchICUFree(const void* context, void* mem) {
+    free(mem);
+}
+
+/**
+ * Corpora
+ */
+
+// Deterministic generator, so every build runs the same corpus.
+static unsigned int sSeed = 12345;
+
+static unsigned int nextRandom(unsigned int limit) {
+    sSeed = sSeed * 1103515245 + 12345;
+    return ((sSeed >> 8) & 0xFFFFFF) % limit;
+}
+
+static std::string randomASCIIWord() {
+    static const char* const kChars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-";
+    std::string word;
+    unsigned int len = 3 + nextRandom(12);
+    for (unsigned int i = 0; i < len; i++)
+        word += kChars[nextRandom((unsigned int)strlen(kChars))];
+    return word;
+}
+
+static std::string randomUnicodeWord() {
+    // Mix of Latin-1, Greek, Cyrillic and CJK, plus the odd \u escape:
+    static const char* const kPieces[] = {
+        "a", "e", "o", "Z", "\xC3\xA9", "\xC3\xBC", "\xC3\x85", "\xCE\xB1", "\xCE\xA9",
+        "\xD0\x96", "\xD0\xB4", "\xE6\x97\xA5", "\xE6\x9C\xAC", "\xE8\xAA\x9E", "\\u00e8", "\\n"
+    };
+    std::string word;
+    unsigned int len = 2 + nextRandom(10);
+    for (unsigned int i = 0; i < len; i++)
+        word += kPieces[nextRandom(sizeof(kPieces) / sizeof(kPieces[0]))];
+    return word;
+}
+
+static std::string randomNumber() {
+    char buf[64];
+    switch (nextRandom(4)) {
+        case 0: // Millisecond timestamp
+            sprintf(buf, "14%02u%03u%06u", nextRandom(100), nextRandom(1000), nextRandom(1000000));
+            break;
+        case 1: // Sequence
+            sprintf(buf, "%u", nextRandom(10000000));
+            break;
+        case 2: // Decimal
+            sprintf(buf, "%s%u.%u", nextRandom(4) ? "" : "-", nextRandom(10000), nextRandom(1000));
+            break;
+        default: // Exponent
+            sprintf(buf, "%u.%ue%s%u", 1 + nextRandom(9), nextRandom(100),
+                    nextRandom(2) ? "-" : "", nextRandom(30));
+            break;
+    }
+    return buf;
+}
+
+static std::string randomNested(int depth) {
+    std::string json = "[";
+    unsigned int count = 1 + nextRandom(4);
+    for (unsigned int i = 0; i < count; i++) {
+        if (i > 0)
+            json += ",";
+        switch (depth > 2 ? nextRandom(4) : nextRandom(6)) {
+            case 0:  json += "\"" + randomASCIIWord() + "\""; break;
+            case 1:  json += randomNumber(); break;
+            case 2:  json += nextRandom(2) ? "true" : "null"; break;
+            case 3:  json += "\"" + randomUnicodeWord() + "\""; break;
+            case 4:  json += "{\"" + randomASCIIWord() + "\":" + randomNested(depth + 1) + "}"; break;
+            default: json += randomNested(depth + 1); break;
+        }
+    }
+    return json + "]";
+}
+
+static std::string randomRevID() {
+    static const char* const kHex = "0123456789abcdef";
+    char gen[16];
+    // Mostly small generations, some large enough to need numeric comparison:
+    sprintf(gen, "%u-", nextRandom(4) ? 1 + nextRandom(9) : 10 + nextRandom(5000));
+    std::string revID = gen;
+    for (int i = 0; i < 32; i++)
+        revID += kHex[nextRandom(16)];
+    return revID;
+}
+
+typedef std::string (*Generator)();
+
+static std::string asciiKey()    { return "\"" + randomASCIIWord() + "\""; }
+static std::string unicodeKey()  { return "\"" + randomUnicodeWord() + "\""; }
+static std::string numericKey()  { return randomNumber(); }
+static std::string compoundKey() { return "[\"" + randomASCIIWord() + "\"," + randomNumber() + "]"; }
+static std::string nestedKey()   { return randomNested(0); }
+
+static std::vector<std::string> makeCorpus(Generator generator) {
+    std::vector<std::string> corpus;
+    for (int i = 0; i < CORPUS_SIZE; i++)
+        corpus.push_back(generator());
+    return corpus;
+}
+
+/**
+ * Measurement
+ */
+
+struct Result {
+    double nsPerCompare;
+    double allocsPerCompare;
+};
+
+template <typename Compare>
+static Result measure(const std::vector<std::string>& corpus, long comparisons, Compare compare) {
+    // Each key is compared against a pseudo-random partner, and sometimes against itself
+    // (equal keys are the worst case, since the whole key has to be scanned):
+    volatile int sink = 0;
+    long allocsBefore = gBenchAllocations;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t n = corpus.size();
+    for (long i = 0; i < comparisons; i++) {
+        const std::string& a = corpus[i % n];
+        const std::string& b = corpus[(i % 8 == 0) ? (i % n) : ((i * 7919 + 1) % n)];
+        sink += compare(a, b);
+    }
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    (void)sink;
+
+    Result result;
+    result.nsPerCompare = std::chrono::duration<double, std::nano>(end - start).count() / comparisons;
+    result.allocsPerCompare = (double)(gBenchAllocations - allocsBefore) / comparisons;
+    return result;
+}
+
+static void printResult(const char* corpus, const char* rule, Result result) {
+    printf("%-10s %-14s %12.1f %16.3f\n", corpus, rule, result.nsPerCompare, result.allocsPerCompare);
+}
+
+struct JsonCase {
+    const char* name;
+    int rule;
+    bool useICU;
+};
+
+static const JsonCase kJsonCases[] = {
+    { "Unicode+ICU", BENCH_RULE_UNICODE, true  },
+    { "Unicode",     BENCH_RULE_UNICODE, false },
+    { "Raw",         BENCH_RULE_RAW,     false },
+    { "ASCII",       BENCH_RULE_ASCII,   false },
+};
+
+struct JsonCorpus {
+    const char* name;
+    Generator generator;
+};
+
+static const JsonCorpus kJsonCorpora[] = {
+    { "ascii",    asciiKey    },
+    { "unicode",  unicodeKey  },
+    { "numeric",  numericKey  },
+    { "compound", compoundKey },
+    { "nested",   nestedKey   },
+};
+
+/**
+ * View index rebuild
+ */
+
+static bool exec(sqlite3* db, const char* sql) {
+    if (sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK)
+        return true;
+    fprintf(stderr, "%s: %s\n", sql, sqlite3_errmsg(db));
+    return false;
+}
+
+// Fills a map table shaped like a view's, with a mix of key types, in a private on-disk scratch
+// database (so the sorter can spill to temporary files and use its worker threads).
+static sqlite3* createViewDatabase(long rows, const char* locale) {
+    sqlite3* db;
+    if (sqlite3_open("", &db) != SQLITE_OK) {
+        fprintf(stderr, "Couldn't open a scratch database\n");
+        return NULL;
+    }
+    register_json_collators(db, locale, NULL);
+    if (!exec(db, "PRAGMA temp_store=FILE") ||
+        !exec(db, "CREATE TABLE maps (view_id INTEGER, sequence INTEGER, key TEXT, value TEXT)") ||
+        !exec(db, "BEGIN")) {
+        sqlite3_close(db);
+        return NULL;
+    }
+    static const Generator kKeyGenerators[] = { asciiKey, unicodeKey, numericKey, compoundKey, nestedKey };
+    sqlite3_stmt* insert;
+    sqlite3_prepare_v2(db, "INSERT INTO maps VALUES (1, ?, ?, NULL)", -1, &insert, NULL);
+    for (long i = 0; i < rows; i++) {
+        std::string key = kKeyGenerators[i % 5]();
+        sqlite3_bind_int64(insert, 1, i);
+        sqlite3_bind_text(insert, 2, key.data(), (int)key.size(), SQLITE_TRANSIENT);
+        sqlite3_step(insert);
+        sqlite3_reset(insert);
+    }
+    sqlite3_finalize(insert);
+    if (!exec(db, "COMMIT")) {
+        sqlite3_close(db);
+        return NULL;
+    }
+    return db;
+}
+
+static void benchIndexRebuild(long rows, const char* locale) {
+    sqlite3* db = createViewDatabase(rows, locale);
+    if (!db)
+        return;
+    sqlite3_limit(db, SQLITE_LIMIT_WORKER_THREADS, 0x7FFFFFFF);     // Capped at SQLITE_MAX_WORKER_THREADS
+    int maxThreads = sqlite3_limit(db, SQLITE_LIMIT_WORKER_THREADS, -1);
+    printf("\n%-10s %-14s %12s %16s\n", "rows", "worker threads", "ms/rebuild", "speedup");
+    double baseline = 0;
+    for (int threads = 0; threads <= 8 && threads <= maxThreads; threads = threads ? threads * 2 : 1) {
+        sqlite3_limit(db, SQLITE_LIMIT_WORKER_THREADS, threads);
+        if (!exec(db, "DROP INDEX IF EXISTS maps_keys"))
+            break;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!exec(db, "CREATE INDEX maps_keys ON maps(view_id, key COLLATE JSON)"))
+            break;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (threads == 0)
+            baseline = ms;
+        printf("%-10ld %-14d %12.1f %15.2fx\n", rows, threads, ms, baseline / ms);
+    }
+    sqlite3_close(db);
+}
+
+int main(int argc, const char** argv) {
+    long comparisons = argc > 1 ? atol(argv[1]) : DEFAULT_COMPARISONS;
+    const char* locale = argc > 2 ? argv[2] : NULL;
+    long indexRows = argc > 3 ? atol(argv[3]) : DEFAULT_INDEX_ROWS;
+    if (comparisons <= 0 || indexRows < 0) {
+        fprintf(stderr, "Usage: %s [comparisons-per-case] [locale] [index-rows]\n", argv[0]);
+        return 1;
+    }
+
+    UErrorCode status = U_ZERO_ERROR;
+    u_setMemoryFunctions(NULL, benchICUAlloc, benchICURealloc, benchICUFree, &status);
+    if (U_FAILURE(status)) {
+        fprintf(stderr, "Couldn't install ICU memory functions (status=%d)\n", status);
+        return 1;
+    }
+
+    printf("%-10s %-14s %12s %16s\n", "corpus", "rule", "ns/compare", "allocs/compare");
+
+    for (size_t c = 0; c < sizeof(kJsonCorpora) / sizeof(kJsonCorpora[0]); c++) {
+        std::vector<std::string> corpus = makeCorpus(kJsonCorpora[c].generator);
+        for (size_t r = 0; r < sizeof(kJsonCases) / sizeof(kJsonCases[0]); r++) {
+            void* context = benchCreateJsonCollator(kJsonCases[r].rule, kJsonCases[r].useICU, locale);
+            Result result = measure(corpus, comparisons,
+                [context](const std::string& a, const std::string& b) {
+                    return benchCollateJSON(context, (int)a.size(), a.data(), (int)b.size(), b.data());
+                });
+            benchFreeJsonCollator(context);
+            printResult(kJsonCorpora[c].name, kJsonCases[r].name, result);
+        }
+    }
+
+    std::vector<std::string> revIDs = makeCorpus(randomRevID);
+    Result result = measure(revIDs, comparisons, [](const std::string& a, const std::string& b) {
+        return benchCollateRevIDs((int)a.size(), a.data(), (int)b.size(), b.data());
+    });
+    printResult("revid", "REVID", result);
+
+    if (indexRows > 0)
+        benchIndexRebuild(indexRows, locale);
+
+    u_cleanup();
+    return 0;
+}
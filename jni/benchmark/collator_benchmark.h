@@ -0,0 +1,38 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_COLLATOR_BENCHMARK_H
+#define _CBL_COLLATOR_BENCHMARK_H
+
+#include <atomic>
+
+// Collation rules; same values as the 'rule' argument of SQLiteJsonCollator.nativeTestCollate.
+enum {
+    BENCH_RULE_UNICODE = 0,
+    BENCH_RULE_RAW     = 1,
+    BENCH_RULE_ASCII   = 2,
+};
+
+// Number of malloc calls made by the collators (and ICU) so far, from any thread: the index
+// rebuild collates on SQLite's sorter worker threads.
+extern std::atomic<long> gBenchAllocations;
+
+/* Creates a JSON collation context for the given rule. If useICU is false, the Unicode rule
+   has no ICU Collator and falls back to binary comparison of non-ASCII strings. */
+void* benchCreateJsonCollator(int rule, bool useICU, const char* locale);
+void benchFreeJsonCollator(void* context);
+
+/* Calls straight into the collation functions registered with SQLite. */
+int benchCollateJSON(void* context, int len1, const void* chars1, int len2, const void* chars2);
+int benchCollateRevIDs(int len1, const void* chars1, int len2, const void* chars2);
+
+#endif // _CBL_COLLATOR_BENCHMARK_H
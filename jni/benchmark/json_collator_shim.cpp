@@ -0,0 +1,52 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  Compiles the JSON collator source into the benchmark, so its static functions can be called
+//  directly, with malloc routed through a counter.
+//
+
+#include <stdlib.h>
+
+#include "collator_benchmark.h"
+
+#ifndef USE_ICU4C_UNICODE_COMPARE
+#error "The collator benchmark must be built with USE_ICU4C_UNICODE_COMPARE"
+#endif
+
+static void* countingMalloc(size_t size) {
+    ++gBenchAllocations;
+    return malloc(size);
+}
+
+#define malloc(size) countingMalloc(size)
+#include "../source/com_couchbase_lite_storage_SQLiteJsonCollator.cpp"
+#undef malloc
+#include "../source/sqlite_common.cpp"
+#include "../source/sqlite_json_canonical.cpp"
+
+void* benchCreateJsonCollator(int rule, bool useICU, const char* locale) {
+    void* r = sqlite_json_colator_Unicode;
+    if (rule == BENCH_RULE_RAW)
+        r = sqlite_json_colator_Raw;
+    else if (rule == BENCH_RULE_ASCII)
+        r = sqlite_json_colator_ASCII;
+
+    SharedCollator* collator = useICU ? acquireCollator(locale, -1, NULL) : NULL;
+    return new CollatorContext(r, collator);
+}
+
+void benchFreeJsonCollator(void* context) {
+    delete (CollatorContext*)context;
+}
+
+int benchCollateJSON(void* context, int len1, const void* chars1, int len2, const void* chars2) {
+    return collateJSON(context, len1, chars1, len2, chars2);
+}
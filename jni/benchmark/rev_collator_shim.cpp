@@ -0,0 +1,22 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  Compiles the revision ID collator source into the benchmark, so its static functions can be
+//  called directly. (It doesn't allocate, so there's no malloc counter here.)
+//
+
+#include "collator_benchmark.h"
+
+#include "../source/com_couchbase_lite_storage_SQLiteRevCollator.cpp"
+
+int benchCollateRevIDs(int len1, const void* chars1, int len2, const void* chars2) {
+    return collateRevIDs(NULL, len1, chars1, len2, chars2);
+}
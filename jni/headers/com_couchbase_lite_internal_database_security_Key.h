@@ -15,6 +15,62 @@ extern "C" {
 JNIEXPORT jbyteArray JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeDerivePBKDF2SHA256Key
   (JNIEnv *, jclass, jstring, jbyteArray, jint);
 
+/*
+ * Class:     com_couchbase_lite_internal_database_security_Key
+ * Method:    nativeDeriveKeyAsync
+ * Signature: (Ljava/lang/String;[BI)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeDeriveKeyAsync
+  (JNIEnv *, jclass, jstring, jbyteArray, jint);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_security_Key
+ * Method:    nativeIsDerivationDone
+ * Signature: (J)Z
+ */
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeIsDerivationDone
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_security_Key
+ * Method:    nativeAwaitDerivedKey
+ * Signature: (JJ)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeAwaitDerivedKey
+  (JNIEnv *, jclass, jlong, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_security_Key
+ * Method:    nativeCancelDerivation
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeCancelDerivation
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_security_Key
+ * Method:    nativeReleaseDerivation
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeReleaseDerivation
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_security_Key
+ * Method:    nativeDeriveKeys
+ * Signature: ([Ljava/lang/String;[[B[I)[[B
+ */
+JNIEXPORT jobjectArray JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeDeriveKeys
+  (JNIEnv *, jclass, jobjectArray, jobjectArray, jintArray);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_security_Key
+ * Method:    nativeClearKeyCache
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeClearKeyCache
+  (JNIEnv *, jclass);
+
 #ifdef __cplusplus
 }
 #endif
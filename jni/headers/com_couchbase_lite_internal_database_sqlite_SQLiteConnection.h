@@ -15,6 +15,14 @@ extern "C" {
 JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeOpen
   (JNIEnv *, jclass, jstring, jint, jstring, jboolean, jboolean);
 
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeOpenWithConfig
+ * Signature: (Ljava/lang/String;ILjava/lang/String;ZZ[JLjava/lang/String;Ljava/lang/String;Ljava/lang/String;[B[J)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeOpenWithConfig
+  (JNIEnv *, jclass, jstring, jint, jstring, jboolean, jboolean, jlongArray, jstring, jstring, jstring, jbyteArray, jlongArray);
+
 /*
  * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
  * Method:    nativeClose
@@ -183,6 +191,358 @@ JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteCo
 JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeResetCancel
   (JNIEnv *, jclass, jlong, jboolean);
 
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeBackupInit
+ * Signature: (JLjava/lang/String;JLjava/lang/String;)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBackupInit
+  (JNIEnv *, jclass, jlong, jstring, jlong, jstring);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeBackupStep
+ * Signature: (JII)Z
+ */
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBackupStep
+  (JNIEnv *, jclass, jlong, jint, jint);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeBackupRemaining
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBackupRemaining
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeBackupPageCount
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBackupPageCount
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeBackupFinish
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBackupFinish
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeEnableStatementTrace
+ * Signature: (JI)Z
+ */
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeEnableStatementTrace
+  (JNIEnv *, jclass, jlong, jint);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeDrainStatementTrace
+ * Signature: (J[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDrainStatementTrace
+  (JNIEnv *, jclass, jlong, jlongArray);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeGetStatementTraceDropped
+ * Signature: (J)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetStatementTraceDropped
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeGetStatementFingerprint
+ * Signature: (Ljava/lang/String;)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetStatementFingerprint
+  (JNIEnv *, jclass, jstring);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeEnableSlowQueryLog
+ * Signature: (JI)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeEnableSlowQueryLog
+  (JNIEnv *, jclass, jlong, jint);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeDrainSlowQueryLog
+ * Signature: (J)Ljava/lang/String;
+ */
+JNIEXPORT jstring JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDrainSlowQueryLog
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeReleaseMemory
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeReleaseMemory
+  (JNIEnv *, jclass);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeReleaseConnectionMemory
+ * Signature: (J)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeReleaseConnectionMemory
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeSetHeapLimits
+ * Signature: (JJ)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeSetHeapLimits
+  (JNIEnv *, jclass, jlong, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeSetCacheSize
+ * Signature: (JJ)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeSetCacheSize
+  (JNIEnv *, jclass, jlong, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeGetVacuumStats
+ * Signature: (J[J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetVacuumStats
+  (JNIEnv *, jclass, jlong, jlongArray);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeIncrementalVacuum
+ * Signature: (JIII)I
+ */
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeIncrementalVacuum
+  (JNIEnv *, jclass, jlong, jint, jint, jint);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeStartIncrementalVacuum
+ * Signature: (JIII)Z
+ */
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeStartIncrementalVacuum
+  (JNIEnv *, jclass, jlong, jint, jint, jint);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeStopIncrementalVacuum
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeStopIncrementalVacuum
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeEnableChangeCollector
+ * Signature: (JZ)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeEnableChangeCollector
+  (JNIEnv *, jclass, jlong, jboolean);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeDrainChanges
+ * Signature: (J[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDrainChanges
+  (JNIEnv *, jclass, jlong, jlongArray);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeGetChangedTableName
+ * Signature: (JI)Ljava/lang/String;
+ */
+JNIEXPORT jstring JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetChangedTableName
+  (JNIEnv *, jclass, jlong, jint);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeWaitForChanges
+ * Signature: (JJI)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeWaitForChanges
+  (JNIEnv *, jclass, jlong, jlong, jint);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeEnableResultCache
+ * Signature: (JJ)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeEnableResultCache
+  (JNIEnv *, jclass, jlong, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeExecuteForRows
+ * Signature: (JJ)[B
+ */
+JNIEXPORT jbyteArray JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeExecuteForRows
+  (JNIEnv *, jclass, jlong, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeGetResultCacheStats
+ * Signature: (J[J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetResultCacheStats
+  (JNIEnv *, jclass, jlong, jlongArray);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeBindByteBuffer
+ * Signature: (JJILjava/nio/ByteBuffer;IIZ)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBindByteBuffer
+  (JNIEnv *, jclass, jlong, jlong, jint, jobject, jint, jint, jboolean);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeBindPointer
+ * Signature: (JJIJIZ)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBindPointer
+  (JNIEnv *, jclass, jlong, jlong, jint, jlong, jint, jboolean);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeExecuteScript
+ * Signature: (JLjava/lang/String;Z)I
+ */
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeExecuteScript
+  (JNIEnv *, jclass, jlong, jstring, jboolean);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeSetTempStoreDirectory
+ * Signature: (Ljava/lang/String;)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeSetTempStoreDirectory
+  (JNIEnv *, jclass, jstring);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeGetTempStoreStats
+ * Signature: (J[J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetTempStoreStats
+  (JNIEnv *, jclass, jlong, jlongArray);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeOpenWithVfs
+ * Signature: (Ljava/lang/String;ILjava/lang/String;ZZLjava/lang/String;)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeOpenWithVfs
+  (JNIEnv *, jclass, jstring, jint, jstring, jboolean, jboolean, jstring);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeCreateIOStatsVfs
+ * Signature: (Ljava/lang/String;Ljava/lang/String;)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeCreateIOStatsVfs
+  (JNIEnv *, jclass, jstring, jstring);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeGetIOStats
+ * Signature: (J[JZ)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetIOStats
+  (JNIEnv *, jclass, jlong, jlongArray, jboolean);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeDestroyIOStatsVfs
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDestroyIOStatsVfs
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeCreateMemoryVfs
+ * Signature: (Ljava/lang/String;J)J
+ */
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeCreateMemoryVfs
+  (JNIEnv *, jclass, jstring, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeGetMemoryVfsStats
+ * Signature: (J[J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetMemoryVfsStats
+  (JNIEnv *, jclass, jlong, jlongArray);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeSaveMemoryDatabase
+ * Signature: (JLjava/lang/String;Ljava/lang/String;)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeSaveMemoryDatabase
+  (JNIEnv *, jclass, jlong, jstring, jstring);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeLoadMemoryDatabase
+ * Signature: (JLjava/lang/String;Ljava/lang/String;)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeLoadMemoryDatabase
+  (JNIEnv *, jclass, jlong, jstring, jstring);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeDeleteMemoryDatabase
+ * Signature: (JLjava/lang/String;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDeleteMemoryDatabase
+  (JNIEnv *, jclass, jlong, jstring);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeDestroyMemoryVfs
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDestroyMemoryVfs
+  (JNIEnv *, jclass, jlong);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeEnableGroupCommit
+ * Signature: (JJI)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeEnableGroupCommit
+  (JNIEnv *, jclass, jlong, jlong, jint);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeSubmitGroupCommit
+ * Signature: (JLjava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeSubmitGroupCommit
+  (JNIEnv *, jclass, jlong, jstring);
+
+/*
+ * Class:     com_couchbase_lite_internal_database_sqlite_SQLiteConnection
+ * Method:    nativeGetGroupCommitStats
+ * Signature: (J[J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetGroupCommitStats
+  (JNIEnv *, jclass, jlong, jlongArray);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,6 +15,22 @@ extern "C" {
 JNIEXPORT void JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_nativeRegister
   (JNIEnv *, jclass, jlong, jstring, jstring);
 
+/*
+ * Class:     com_couchbase_lite_storage_SQLiteJsonCollator
+ * Method:    nativeRegisterLocale
+ * Signature: (JLjava/lang/String;ILjava/lang/String;)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_nativeRegisterLocale
+  (JNIEnv *, jclass, jlong, jstring, jint, jstring);
+
+/*
+ * Class:     com_couchbase_lite_storage_SQLiteJsonCollator
+ * Method:    nativeSetICUData
+ * Signature: (Ljava/lang/String;)Z
+ */
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_nativeSetICUData
+  (JNIEnv *, jclass, jstring);
+
 /*
  * Class:     com_couchbase_lite_storage_SQLiteJsonCollator
  * Method:    nativeTestCollate
@@ -47,6 +63,14 @@ JNIEXPORT jint JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_native
 JNIEXPORT jchar JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_nativeTestEscape
   (JNIEnv *, jclass, jstring);
 
+/*
+ * Class:     com_couchbase_lite_storage_SQLiteJsonCollator
+ * Method:    nativeCanonicalize
+ * Signature: (Ljava/nio/ByteBuffer;IILjava/nio/ByteBuffer;II)I
+ */
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_nativeCanonicalize
+  (JNIEnv *, jclass, jobject, jint, jint, jobject, jint, jint);
+
 #ifdef __cplusplus
 }
 #endif
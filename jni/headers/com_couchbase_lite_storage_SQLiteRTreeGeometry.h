@@ -0,0 +1,21 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class com_couchbase_lite_storage_SQLiteRTreeGeometry */
+
+#ifndef _Included_com_couchbase_lite_storage_SQLiteRTreeGeometry
+#define _Included_com_couchbase_lite_storage_SQLiteRTreeGeometry
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     com_couchbase_lite_storage_SQLiteRTreeGeometry
+ * Method:    nativeRegister
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_storage_SQLiteRTreeGeometry_nativeRegister
+  (JNIEnv *, jclass, jlong);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,21 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class com_couchbase_lite_storage_SQLiteTokenizer */
+
+#ifndef _Included_com_couchbase_lite_storage_SQLiteTokenizer
+#define _Included_com_couchbase_lite_storage_SQLiteTokenizer
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     com_couchbase_lite_storage_SQLiteTokenizer
+ * Method:    nativeRegister
+ * Signature: (JLjava/lang/String;)V
+ */
+JNIEXPORT void JNICALL Java_com_couchbase_lite_storage_SQLiteTokenizer_nativeRegister
+  (JNIEnv *, jclass, jlong, jstring);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
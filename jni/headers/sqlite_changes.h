@@ -0,0 +1,113 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_CHANGES_H
+#define _CBL_DATABASE_SQLITE_CHANGES_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sqlite3.h"
+
+// The rows changed by each transaction committed on one connection, as reported by SQLite's update,
+// commit and rollback hooks. Changes are buffered until their transaction ends, then published
+// together as one batch, numbered by commit, or thrown away on rollback.
+struct ChangeCollector {
+    // Fields of each change copied out by drain(), in order.
+    // Must be kept in sync with the constants defined in SQLiteConnection.java.
+    enum {
+        FIELD_COMMIT            = 0,    // Number of the commit that made the change, from 1
+        FIELD_OPERATION         = 1,    // CHANGE_*
+        FIELD_TABLE             = 2,    // See tableName()
+        FIELD_ROWID             = 3,    // -1 for CHANGE_TABLE
+        FIELD_COUNT
+    };
+
+    // Operations. CHANGE_TABLE stands for any number of changes to a table: it replaces a
+    // transaction's changes when there are too many to list, and reports a DELETE without a
+    // WHERE clause, which SQLite runs without calling the update hook.
+    enum {
+        CHANGE_INSERT           = 1,
+        CHANGE_UPDATE           = 2,
+        CHANGE_DELETE           = 3,
+        CHANGE_TABLE            = 4,
+    };
+
+    enum {
+        MAX_TRANSACTION_CHANGES = 4096,     // Beyond this, a transaction's changes are per table
+        MAX_PENDING_CHANGES     = 65536,    // Beyond this, undrained changes are per table
+    };
+
+    struct Change {
+        uint64_t commit;
+        int32_t operation;
+        int32_t table;
+        int64_t rowid;
+    };
+
+    volatile bool enabled;                  // Cleared to pause collecting
+
+    // Only touched by the hooks, which SQLite calls with the database's mutex held.
+    std::vector<Change> transaction;
+    bool transactionCollapsed;
+    std::string lastDatabase;               // The update hook's last table, and its id
+    std::string lastTableName;
+    int lastTable;
+
+    std::mutex mutex;
+    std::condition_variable published;      // A commit was published, or the collector is closing
+    std::deque<Change> pending;
+    uint64_t commits;
+    bool closing;                           // Set by close(), which waiters return for
+    int waiters;                            // Threads in waitForCommit
+    std::map<std::string, int> tableIds;    // Lowercased name -> id
+    std::vector<std::string> tableNames;
+
+    ChangeCollector();
+
+    // Called from the connection's update, commit and rollback hooks.
+    void rowChanged(int sqliteOperation, const char* database, const char* table, sqlite3_int64 rowid);
+    void committed();
+    void rolledBack();
+
+    // Called after a statement emptied a table without calling the update hook.
+    void tableEmptied(sqlite3* db, const std::string& table);
+
+    // Copies out up to maxChanges published changes, returning how many.
+    int drain(int64_t* fields, int maxChanges);
+
+    // Blocks until a commit after afterCommit is published, or for timeoutMillis at most, or until
+    // the collector is closed; returns the number of the latest commit.
+    uint64_t waitForCommit(uint64_t afterCommit, int timeoutMillis);
+
+    // Wakes the threads in waitForCommit and returns once they have all left, so that the collector
+    // can be freed. No thread may start waiting after it is called.
+    void close();
+
+    std::string tableName(int table);
+
+private:
+    int tableId(const std::string& name);
+    void addToTransaction(int operation, int table, int64_t rowid);
+    void publish(std::vector<Change>& changes);
+};
+
+/* the table named by a "DELETE FROM [database.]table" statement, which SQLite runs without
+   calling the update hook when it has no WHERE clause; false if sql isn't a DELETE */
+bool parse_delete_table(const char* sql, std::string& table);
+
+#endif // _CBL_DATABASE_SQLITE_CHANGES_H
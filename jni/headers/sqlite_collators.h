@@ -0,0 +1,25 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_COLLATORS_H
+#define _CBL_DATABASE_SQLITE_COLLATORS_H
+
+#include "sqlite3.h"
+
+/* register the JSON, JSON_RAW and JSON_ASCII collations and the json_canonical and json_minify
+   SQL functions on db. locale and icuDataPath may be NULL; see SQLiteJsonCollator.nativeRegister */
+void register_json_collators(sqlite3* db, const char* locale, const char* icuDataPath);
+
+/* register the REVID collation and the revid_* SQL functions on db */
+void register_revid_collator(sqlite3* db);
+
+#endif // _CBL_DATABASE_SQLITE_COLLATORS_H
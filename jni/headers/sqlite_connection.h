@@ -18,8 +18,20 @@
 #ifndef _CBL_DATABASE_SQLITE_CONNECTION_H
 #define _CBL_DATABASE_SQLITE_CONNECTION_H
 
+#include <jni.h>
+#include <atomic>
+#include <utility>
+#include <vector>
+
 #include "sqlite3.h"
 
+struct ChangeCollector;
+struct GroupCommit;
+struct ResultCache;
+struct SlowQueryLog;
+struct TempStore;
+struct VacuumScheduler;
+
 struct SQLiteConnection {
     // Open flags.
     // Must be kept in sync with the constants defined in SQLiteDatabase.java.
@@ -30,6 +42,59 @@ struct SQLiteConnection {
         NO_LOCALIZED_COLLATORS  = 0x00000010,
         CREATE_IF_NECESSARY     = 0x10000000,
     };
+
+    // Indexes into the config array of nativeOpenWithConfig; -1 leaves a setting at its default.
+    // Must be kept in sync with the constants defined in SQLiteConnection.java.
+    enum {
+        CONFIG_SYNCHRONOUS      = 0,
+        CONFIG_CACHE_SIZE       = 1,
+        CONFIG_PAGE_SIZE        = 2,
+        CONFIG_MMAP_SIZE        = 3,
+        CONFIG_BUSY_TIMEOUT_MS  = 4,
+        CONFIG_COLLATORS        = 5,
+        CONFIG_WARM_UP          = 6,
+        CONFIG_AUTO_VACUUM      = 7,    // 0 (none), 1 (full) or 2 (incremental); new databases only
+        CONFIG_TEMP_STORE       = 8,    // One of TEMP_STORE_*
+        CONFIG_TEMP_STORE_BUDGET = 9,   // Bytes of temporary files kept in memory by TEMP_STORE_BOUNDED
+        CONFIG_COUNT
+    };
+
+    // Values of CONFIG_TEMP_STORE.
+    enum {
+        TEMP_STORE_MEMORY       = 0,    // Temporary files in memory, however large
+        TEMP_STORE_FILE         = 1,    // Temporary files on disk, in the temp store directory
+        TEMP_STORE_BOUNDED      = 2,    // In memory up to the budget, then on disk
+    };
+
+    // Flags of CONFIG_COLLATORS.
+    enum {
+        COLLATOR_JSON           = 0x01,
+        COLLATOR_REVID          = 0x02,
+    };
+
+    // Indexes into the timings array of nativeOpenWithConfig, in nanoseconds.
+    enum {
+        TIMING_OPEN             = 0,
+        TIMING_PRAGMAS          = 1,
+        TIMING_COLLATORS        = 2,
+        TIMING_WARM_UP          = 3,
+        TIMING_TOTAL            = 4,
+        TIMING_COUNT
+    };
+
+    // Indexes into the stats array of nativeGetVacuumStats.
+    // Must be kept in sync with the constants defined in SQLiteConnection.java.
+    enum {
+        VACUUM_STAT_PAGE_SIZE           = 0,
+        VACUUM_STAT_PAGE_COUNT          = 1,
+        VACUUM_STAT_FREELIST_COUNT      = 2,
+        VACUUM_STAT_AUTO_VACUUM         = 3,    // As for CONFIG_AUTO_VACUUM
+        VACUUM_STAT_RECLAIMABLE_BYTES   = 4,    // Size of the free pages
+        VACUUM_STAT_FREE_PER_MILLE      = 5,    // Share of the file that is free pages
+        VACUUM_STAT_PAGES_VACUUMED      = 6,    // By the scheduler, since it was started
+        VACUUM_STAT_VACUUM_STEPS        = 7,
+        VACUUM_STAT_COUNT
+    };
     
     sqlite3* const db;
     const int openFlags;
@@ -38,8 +103,34 @@ struct SQLiteConnection {
     
     volatile bool canceled;
     
+    bool logProfile;                // Log each statement's time, as requested by nativeOpen
+    SlowQueryLog* slowQueryLog;     // Created by nativeEnableSlowQueryLog, freed on close
+    
+    std::atomic<unsigned> activity; // Bumped by each statement, to tell when the connection is idle
+    VacuumScheduler* vacuumScheduler; // Created by nativeStartIncrementalVacuum, freed on close
+    ChangeCollector* changeCollector; // Created by nativeEnableChangeCollector, freed on close
+    ResultCache* resultCache;       // Created by nativeEnableResultCache
+    GroupCommit* groupCommit;       // Created by nativeEnableGroupCommit; the only writer while set
+    TempStore* tempStore;           // The connection's VFS, for TEMP_STORE_FILE and TEMP_STORE_BOUNDED
+    unsigned hookedRowChanges;      // Rows reported to the update hook, while it is installed
+    
+    // Direct ByteBuffers bound with SQLITE_STATIC, held by global references until their statement
+    // is reset or finalized.
+    std::vector<std::pair<sqlite3_stmt*, jobject> > boundBuffers;
+    
     SQLiteConnection(sqlite3* db, int openFlags, const char* path, const char* label) :
-    db(db), openFlags(openFlags), path(path), label(label), canceled(false) { }
+    db(db), openFlags(openFlags), path(path), label(label), canceled(false),
+    logProfile(false), slowQueryLog(NULL), activity(0), vacuumScheduler(NULL),
+    changeCollector(NULL), resultCache(NULL), groupCommit(NULL), tempStore(NULL), hookedRowChanges(0) { }
+};
+
+// An online backup from one connection's database into another's, copied a few pages at a time.
+struct SQLiteBackup {
+    sqlite3_backup* const backup;
+    SQLiteConnection* const destination;
+
+    SQLiteBackup(sqlite3_backup* backup, SQLiteConnection* destination) :
+    backup(backup), destination(destination) { }
 };
 
 #endif // _CBL_DATABASE_SQLITE_CONNECTION_H
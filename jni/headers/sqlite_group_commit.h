@@ -0,0 +1,80 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_GROUP_COMMIT_H
+#define _CBL_DATABASE_SQLITE_GROUP_COMMIT_H
+
+#include <jni.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+// The write queue of a writer connection, which runs the writes submitted by many threads
+// together in one transaction, so that they share its commit (and its fsync). There is no thread
+// of its own: a submitter that finds no batch running leads the next one, waiting up to the
+// latency window for more requests to join it, and runs it on the connection while the others
+// wait for their results. The batches run on the connection with no lock of their own, so while
+// group commit is enabled the connection must only be written through it.
+struct GroupCommit {
+    // Indexes into the stats array of nativeGetGroupCommitStats.
+    // Must be kept in sync with the constants defined in SQLiteConnection.java.
+    enum {
+        STAT_BATCHES            = 0,
+        STAT_REQUESTS           = 1,
+        STAT_LARGEST_BATCH      = 2,
+        STAT_FAILED_REQUESTS    = 3,    // Including those of failed commits
+        STAT_FAILED_COMMITS     = 4,    // Including batches that lost a transaction to a request
+        STAT_COUNT
+    };
+
+    // A script of writes, which the batch runs in a savepoint of its own.
+    struct Request {
+        const jchar* script;
+        jsize length;
+        bool done;
+        int changes;                    // Rows the script changed
+        int count;                      // Statements run before any error
+        int errcode;                    // SQLITE_OK, or the error that rolled the request back
+        std::string errmsg;
+        int errorOffset;                // Of the failed statement in the script, in UTF-16 units
+
+        Request(const jchar* script, jsize length) :
+        script(script), length(length), done(false), changes(0), count(0), errcode(0),
+        errorOffset(0) { }
+    };
+
+    // Runs the requests of a batch, setting the result of each; returns false if the commit failed.
+    typedef bool (*run_batch_function)(void* context, Request** requests, int count);
+
+    const int64_t windowMicros;
+    const int maxBatch;
+
+    std::mutex mutex;
+    std::condition_variable changed;    // A request was queued, or a batch finished
+    std::deque<Request*> queue;
+    bool running;                       // A batch is being gathered or run
+    int submitters;                     // Threads in submit, whose requests are queued or running
+    int64_t stats[STAT_COUNT];
+
+    GroupCommit(int64_t windowMicros, int maxBatch);
+
+    // Queues the request and returns once a batch has run it, which the calling thread may have
+    // led, running it with runBatch.
+    void submit(Request* request, run_batch_function runBatch, void* context);
+    // Whether no thread is in submit, so that the queue may be freed.
+    bool idle();
+    void getStats(int64_t* stats);
+};
+
+#endif // _CBL_DATABASE_SQLITE_GROUP_COMMIT_H
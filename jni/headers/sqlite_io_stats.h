@@ -0,0 +1,79 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_IO_STATS_H
+#define _CBL_DATABASE_SQLITE_IO_STATS_H
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+
+#include "sqlite3.h"
+
+#include "sqlite_vfs_shim.h"
+
+// A named VFS that wraps another one and counts the I/O of every file opened through it, by kind
+// of file: calls, bytes and time spent, with a histogram of the latencies. Connections use it by
+// naming it when they are opened. The shared memory of a WAL database counts as a file of its own:
+// mapping a region counts as an open, a barrier as a sync.
+struct IOStatsVfs {
+    // Layout of the stats array of nativeGetIOStats: FIELD_COUNT values for each operation of each
+    // kind of file, at ((fileType * OP_COUNT) + op) * FIELD_COUNT.
+    // Must be kept in sync with the constants defined in SQLiteConnection.java.
+    enum {
+        FILE_MAIN_DB            = 0,
+        FILE_JOURNAL            = 1,    // Rollback and master journals
+        FILE_WAL                = 2,
+        FILE_SHM                = 3,
+        FILE_TEMP               = 4,    // Temp databases, their journals, subjournals, sorter files
+        FILE_OTHER              = 5,
+        FILE_TYPE_COUNT
+    };
+    enum {
+        OP_OPEN                 = 0,
+        OP_READ                 = 1,
+        OP_WRITE                = 2,
+        OP_SYNC                 = 3,
+        OP_LOCK                 = 4,    // Locks, unlocks and checks for a reserved lock
+        OP_TRUNCATE             = 5,
+        OP_COUNT
+    };
+    enum {
+        FIELD_CALLS             = 0,
+        FIELD_BYTES             = 1,
+        FIELD_TOTAL_NANOS       = 2,
+        FIELD_MAX_NANOS         = 3,
+        FIELD_HISTOGRAM         = 4,    // Bucket i counts calls under 2^i microseconds; the last
+        HISTOGRAM_BUCKETS       = 20,   // bucket counts all the calls longer than that
+        FIELD_COUNT             = FIELD_HISTOGRAM + HISTOGRAM_BUCKETS
+    };
+    enum { STAT_COUNT = FILE_TYPE_COUNT * OP_COUNT * FIELD_COUNT };
+
+    VfsShim shim;
+    const std::string name;
+
+    std::mutex mutexes[FILE_TYPE_COUNT];    // Each guards the counters of one kind of file
+    int64_t stats[STAT_COUNT];
+
+    // Creates and registers a VFS wrapping the one named baseName, or the default VFS if it is
+    // NULL; returns NULL if there's no such VFS or a VFS named name already exists.
+    static IOStatsVfs* create(const char* name, const char* baseName);
+    ~IOStatsVfs();                          // Unregisters it; its connections must be closed first
+
+    void record(int fileType, int op, int64_t bytes, int64_t nanos);
+    void getStats(int64_t* stats, bool reset);
+
+private:
+    IOStatsVfs(sqlite3_vfs* base, const char* name);
+};
+
+#endif // _CBL_DATABASE_SQLITE_IO_STATS_H
@@ -0,0 +1,38 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_JSON_CANONICAL_H
+#define _CBL_DATABASE_SQLITE_JSON_CANONICAL_H
+
+#include <stddef.h>
+#include <string>
+
+#include "sqlite3.h"
+
+// Options of canonicalize_json.
+// Must be kept in sync with the constants defined in SQLiteJsonCollator.java.
+enum {
+    JSON_CANONICAL_SORT_KEYS    = 0x01,     // Sort the members of objects by key
+    JSON_CANONICAL_NFC          = 0x02,     // Normalize strings and keys to Unicode NFC
+};
+
+/* append the canonical form of the UTF-8 JSON text json to out, which collateJSON can compare:
+   no whitespace, strings with only the escapes collateJSON understands, and numbers in the
+   ECMAScript form but with every significant digit of the original. Returns NULL, or a message
+   if the text isn't valid JSON, with the byte offset of the error in errorOffset. */
+const char* canonicalize_json(const char* json, size_t length, int options, std::string* out,
+                              size_t* errorOffset);
+
+/* register the json_canonical(json [, options]) and json_minify(json) SQL functions on db */
+void register_json_canonical_functions(sqlite3* db);
+
+#endif // _CBL_DATABASE_SQLITE_JSON_CANONICAL_H
@@ -0,0 +1,40 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_MEMORY_H
+#define _CBL_DATABASE_SQLITE_MEMORY_H
+
+#include "sqlite3.h"
+
+#include "sqlite_connection.h"
+
+/* add or remove a connection from those whose memory release_all_memory() releases */
+void register_connection(SQLiteConnection* connection);
+void unregister_connection(SQLiteConnection* connection);
+
+/* release the page cache memory of one connection that isn't in use, returning the bytes freed */
+sqlite3_int64 release_connection_memory(SQLiteConnection* connection);
+
+/* release what memory every open connection, and SQLite as a whole, can spare, returning the
+   drop in SQLite's heap usage */
+sqlite3_int64 release_all_memory();
+
+/* set SQLite's soft heap limit and our hard heap limit, in bytes (0 for none, negative to leave
+   unchanged), shedding memory at once if usage is over either; returns the bytes freed */
+sqlite3_int64 set_heap_limits(sqlite3_int64 softLimit, sqlite3_int64 hardLimit);
+
+/* true if SQLite's heap usage is over the hard heap limit even after releasing what memory it
+   can (at most every 250 ms while it stays over); checked before preparing or starting a
+   statement, so that the statement can fail with SQLITE_NOMEM instead */
+bool hard_heap_limit_exceeded();
+
+#endif // _CBL_DATABASE_SQLITE_MEMORY_H
@@ -0,0 +1,79 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_MEMORY_VFS_H
+#define _CBL_DATABASE_SQLITE_MEMORY_VFS_H
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "sqlite3.h"
+
+#include "sqlite_vfs_shim.h"
+
+struct MemoryFile;
+
+// A named VFS that keeps every file in memory, where any number of connections opened with it can
+// share a database by its name, with the same locking as on disk, so that a WAL database has one
+// writer and concurrent readers. Files stay until they are deleted or the VFS is destroyed, even
+// when no connection has them open. Writes that would take the VFS over its byte cap fail with
+// SQLITE_FULL.
+struct MemoryVfs {
+    // Indexes into the stats array of nativeGetMemoryVfsStats.
+    // Must be kept in sync with the constants defined in SQLiteConnection.java.
+    enum {
+        STAT_FILES              = 0,    // Named files, such as databases and their WALs
+        STAT_MEMORY_USED        = 1,
+        STAT_MEMORY_HIGHWATER   = 2,
+        STAT_MAX_BYTES          = 3,    // 0 if there's no cap
+        STAT_COUNT
+    };
+
+    enum { CHUNK_SIZE = 32 * 1024 };    // Files grow by chunks of this size
+
+    VfsShim shim;
+    const std::string name;
+    const int64_t maxBytes;
+
+    std::mutex filesMutex;              // Guards files and the reference counts of the files
+    std::map<std::string, MemoryFile*> files;
+
+    std::mutex memoryMutex;
+    int64_t memoryUsed;
+    int64_t memoryHighwater;
+
+    // Creates and registers a VFS; returns NULL if a VFS named name already exists.
+    static MemoryVfs* create(const char* name, int64_t maxBytes);
+    ~MemoryVfs();                       // Unregisters it and frees its files; its connections
+                                        // must be closed first
+
+    bool reserve(int64_t bytes);        // False if the cap doesn't allow it
+    void release(int64_t bytes);
+    void getStats(int64_t* stats);
+
+    // Deletes the database named dbName with its journal and WAL, freeing their memory once the
+    // connections that have them open close them; returns false if there's no such database.
+    bool remove(const char* dbName);
+
+    // Copy the database named dbName to the database file at path, or back, through the SQLite
+    // backup API, so that the copy is consistent even while other connections write to the source.
+    // Return an SQLite result code.
+    int save(const char* dbName, const char* path);
+    int load(const char* path, const char* dbName);
+
+private:
+    MemoryVfs(sqlite3_vfs* base, const char* name, int64_t maxBytes);
+};
+
+#endif // _CBL_DATABASE_SQLITE_MEMORY_VFS_H
@@ -0,0 +1,122 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_RESULT_CACHE_H
+#define _CBL_DATABASE_SQLITE_RESULT_CACHE_H
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "sqlite3.h"
+
+// The serialized rows of one connection's recent queries, keyed by SQL and bound values, within a
+// byte budget. Each entry remembers the versions of the tables its query read; a table's version
+// goes up whenever the update hook reports a change to it, which invalidates the entries that
+// read it. Changes made through other connections invalidate every entry. SQLite doesn't call the
+// update hook for WITHOUT ROWID tables, so queries that read one are never cached.
+struct ResultCache {
+    // Indexes into the stats array of nativeGetResultCacheStats.
+    // Must be kept in sync with the constants defined in SQLiteConnection.java.
+    enum {
+        STAT_HITS               = 0,
+        STAT_MISSES             = 1,
+        STAT_UNCACHEABLE        = 2,    // Queries run without looking in the cache
+        STAT_EVICTIONS          = 3,
+        STAT_INVALIDATIONS      = 4,    // Entries found stale
+        STAT_ENTRIES            = 5,
+        STAT_BYTES              = 6,
+        STAT_COUNT
+    };
+
+    // What the authorizer and EXPLAIN tell us about a prepared statement.
+    struct StatementInfo {
+        bool cacheable;
+        bool changesSchema;
+        std::vector<int> tables;
+        std::vector<std::string> binds;     // Type and bytes of each bound value, by index - 1
+    };
+
+    struct Entry {
+        std::string key;
+        std::string rows;
+        std::vector<std::pair<int, uint32_t> > tableVersions;
+    };
+
+    const size_t budget;
+
+    // Every member below is guarded by mutex. It's never held while calling into SQLite, since the
+    // update hook takes it with the database's mutex held.
+    std::mutex mutex;
+    std::list<Entry> entries;               // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t bytes;
+    uint64_t stats[STAT_COUNT];
+
+    std::map<std::string, int> tableIds;    // Lowercased name -> id
+    std::vector<std::string> tableNames;
+    std::vector<uint32_t> tableVersions;
+    std::string lastChanged;                // The update hook's last table, and the ids it bumps
+    std::vector<int> lastChangedIds;
+
+    std::unordered_map<sqlite3_stmt*, StatementInfo> statements;
+
+    // State of the statement being prepared, filled in by the authorizer.
+    bool preparing;
+    StatementInfo prepared;
+    std::vector<std::string> authorizedTables;
+
+    sqlite3_stmt* dataVersionStatement;     // PRAGMA data_version, to notice other connections
+    sqlite3_int64 dataVersion;
+
+    ResultCache(size_t budget);
+    ~ResultCache();                         // Call finalize() first
+
+    // Installs or removes the authorizer, which classifies statements as they're prepared.
+    void attach(sqlite3* db);
+    void finalize(sqlite3* db);
+
+    void beginPrepare();
+    void endPrepare(sqlite3* db, sqlite3_stmt* statement);
+    int authorize(int action, const char* arg1, const char* arg2);
+    void statementFinalized(sqlite3_stmt* statement);
+    void statementExecuted(sqlite3_stmt* statement);    // Clears the cache after DDL
+
+    void noteBind(sqlite3_stmt* statement, int index, char type, const void* data, size_t size);
+    void clearBinds(sqlite3_stmt* statement);
+
+    // Called from the update hook, or when a table is emptied without calling it.
+    void tableChanged(const char* table);
+
+    // The serialized rows of statement, from the cache or by running it to completion. Returns
+    // an SQLite error code, leaving the statement to be reset by the caller on failure.
+    int execute(sqlite3* db, sqlite3_stmt* statement, std::string& rows);
+
+    void getStats(uint64_t* out);
+
+private:
+    int tableId(const std::string& name);
+    bool cacheKey(sqlite3_stmt* statement, std::string& key, std::vector<int>& tables);
+    void store(const std::string& key, const std::string& rows,
+               const std::vector<std::pair<int, uint32_t> >& versions);
+    void evict(std::list<Entry>::iterator entry);
+    void clear();
+};
+
+/* run statement to completion, serializing its rows into rows; returns SQLITE_DONE or an error */
+int serialize_rows(sqlite3_stmt* statement, std::string& rows);
+
+#endif // _CBL_DATABASE_SQLITE_RESULT_CACHE_H
@@ -0,0 +1,82 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_SLOW_QUERY_LOG_H
+#define _CBL_DATABASE_SQLITE_SLOW_QUERY_LOG_H
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sqlite3.h"
+
+// Statements of one connection that took longer than a threshold, with their SQL, the shapes of
+// their bound parameters, their sqlite3_stmt_status counters and their query plan. Statements
+// are caught by the connection's profile callback when they finish; plans are captured later, on
+// drain, once per distinct statement, and each distinct plan is kept only once.
+struct SlowQueryLog {
+    enum {
+        MAX_ENTRIES             = 256,  // Oldest entries are dropped beyond this
+        MAX_BIND_SHAPES         = 64,   // Statements whose bindings are remembered at once
+        MAX_SHAPE_PARAMS        = 16,   // Parameters described per statement
+    };
+
+    struct Entry {
+        std::string sql;
+        std::string binds;
+        uint64_t fingerprint;
+        int64_t elapsedNanos;
+        int fullscanSteps;
+        int sorts;
+        int autoindexes;
+        int vmSteps;
+    };
+
+    // Type ('N', 'I', 'F', 'T' or 'B') and size of each parameter bound to a statement.
+    struct BindShape {
+        sqlite3_stmt* statement;
+        char types[MAX_SHAPE_PARAMS];
+        int sizes[MAX_SHAPE_PARAMS];
+        int count;
+    };
+
+    volatile int thresholdMillis;                   // Negative when logging is off
+
+    std::mutex mutex;
+    std::deque<Entry> entries;
+    uint64_t dropped;
+    std::map<uint64_t, int> planOfFingerprint;      // Statement fingerprint -> plan id
+    std::map<std::string, int> planIds;             // Plan text -> plan id
+    std::vector<std::string> plans;                 // Plan id -> plan text
+
+    // Guarded by the connection's db mutex, which the profile callback holds already: besides the
+    // thread using the connection, the vacuum scheduler's thread runs statements on it.
+    BindShape shapes[MAX_BIND_SHAPES];
+
+    explicit SlowQueryLog(int thresholdMillis);
+
+    void noteBind(sqlite3_stmt* statement, int index, char type, int size);
+    void clearBinds(sqlite3_stmt* statement);
+    void statementReset(sqlite3_stmt* statement);
+
+    // Called from the profile callback with the statement's SQL and run time.
+    void statementFinished(sqlite3* db, const char* sql, int64_t elapsedNanos);
+
+    // Returns the entries logged since the last call as JSON, or an empty string if there are
+    // none. Plans not yet captured are captured now, on db.
+    std::string drain(sqlite3* db);
+};
+
+#endif // _CBL_DATABASE_SQLITE_SLOW_QUERY_LOG_H
@@ -0,0 +1,73 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_TEMP_STORE_H
+#define _CBL_DATABASE_SQLITE_TEMP_STORE_H
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+
+#include "sqlite3.h"
+
+#include "sqlite_vfs_shim.h"
+
+// The VFS of one connection, which keeps the connection's temporary files (temp tables and
+// indexes, sorter runs, statement journals) in memory until together they would exceed a byte
+// budget, then moves the file that is growing to a real file in the temp directory. Any other
+// file goes straight to the default VFS. Temporary files are only opened through a VFS when the
+// connection's temp_store is FILE.
+struct TempStore {
+    // Indexes into the stats array of nativeGetTempStoreStats.
+    // Must be kept in sync with the constants defined in SQLiteConnection.java.
+    enum {
+        STAT_FILES_OPENED       = 0,    // Temporary files opened
+        STAT_FILES_SPILLED      = 1,    // Of those, moved to disk
+        STAT_BYTES_SPILLED      = 2,    // Written to disk, including the memory moved there
+        STAT_MEMORY_USED        = 3,    // Held in memory now
+        STAT_MEMORY_HIGHWATER   = 4,
+        STAT_BUDGET             = 5,
+        STAT_COUNT
+    };
+
+    enum { CHUNK_SIZE = 64 * 1024 };    // Memory is used in chunks of this size
+
+    VfsShim shim;                       // Registered under a name of its own
+    sqlite3_vfs* const base;
+    const int64_t budget;
+    const std::string directory;        // Empty to let the default VFS choose
+    char name[32];
+
+    std::mutex mutex;                   // Guards the counters, which temp files on sorter threads update
+    int64_t filesOpened;
+    int64_t filesSpilled;
+    int64_t bytesSpilled;
+    int64_t memoryUsed;
+    int64_t memoryHighwater;
+
+    // Creates and registers a temp store; returns NULL if there's no default VFS.
+    static TempStore* create(int64_t budget);
+    ~TempStore();                       // Unregisters it; its connection must be closed first
+
+    bool reserve(int64_t bytes);        // False if the budget doesn't allow it
+    void release(int64_t bytes);
+    void spilled(int64_t files, int64_t bytes);
+    void getStats(int64_t* stats);
+
+private:
+    TempStore(sqlite3_vfs* base, int64_t budget, const std::string& directory);
+};
+
+/* set the directory that temp stores created from now on spill to, or NULL for the default */
+void set_temp_store_directory(const char* directory);
+
+#endif // _CBL_DATABASE_SQLITE_TEMP_STORE_H
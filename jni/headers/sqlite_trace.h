@@ -0,0 +1,97 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_TRACE_H
+#define _CBL_DATABASE_SQLITE_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+
+#include "sqlite3.h"
+
+// A flight recorder of the statements run on one connection: a ring of the last N statements,
+// with their start and end times, SQL fingerprint, row count and result code. Recording never
+// locks or allocates, so the trace can be left on; a reader drains it in batches, and records
+// it is too slow to read are overwritten (and counted as dropped).
+struct StatementTrace {
+    // Fields of each record copied out by drain(), in order.
+    // Must be kept in sync with the constants defined in SQLiteConnection.java.
+    enum {
+        FIELD_START_NANOS       = 0,    // CLOCK_MONOTONIC, the clock of System.nanoTime()
+        FIELD_END_NANOS         = 1,
+        FIELD_FINGERPRINT       = 2,    // See fingerprint()
+        FIELD_ROWS              = 3,    // Rows returned by a query, or changed by an update
+        FIELD_RESULT_CODE       = 4,    // SQLITE_DONE, an error, or SQLITE_ROW if abandoned
+        FIELD_COUNT
+    };
+
+    // Queries stepped through a cursor are timed from their first row to their last, and at most
+    // this many can be in progress at once on a connection.
+    enum { MAX_CURSORS = 16 };
+
+    struct Record {
+        std::atomic<uint32_t> sequence;   // Index + 1 once written, 0 while being written
+        int64_t start;
+        int64_t end;
+        uint64_t fingerprint;
+        int64_t rows;
+        int32_t resultCode;
+    };
+
+    struct Cursor {
+        std::atomic<sqlite3_stmt*> statement;
+        int64_t start;
+        int64_t rows;
+    };
+
+    Record* const records;
+    const uint32_t mask;                  // Capacity - 1; the capacity is a power of 2
+    std::atomic<uint32_t> head;           // Index of the next record to write
+    std::atomic<bool> enabled;
+    Cursor cursors[MAX_CURSORS];
+
+    std::mutex drainMutex;                // Serializes readers only
+    uint32_t tail;                        // Index of the next record to read
+    uint64_t dropped;
+
+    StatementTrace* const previous;       // Replaced by this one, and freed with it
+
+    StatementTrace(uint32_t capacity, StatementTrace* previous);
+    ~StatementTrace();
+
+    void record(sqlite3_stmt* statement, int64_t start, int64_t rows, int resultCode);
+    // start is when the first step began, so that its time (usually most of the query) counts.
+    void cursorStep(sqlite3_stmt* statement, bool first, int64_t start, int resultCode);
+    void cursorReset(sqlite3_stmt* statement);
+    int drain(int64_t* fields, int maxRecords);
+
+    static int64_t now();
+
+    // 64-bit FNV-1a hash of the SQL with whitespace collapsed and literals replaced by '?', so that
+    // "SELECT * FROM docs WHERE id = 12" and "select *  from docs where id=?" match.
+    static uint64_t fingerprint(const char* sql, size_t length);
+};
+
+/* the trace of db, or NULL if it is not tracing; cheap enough to call on every statement.
+   with enabledOnly false, also returns a trace that has been stopped but not yet drained */
+StatementTrace* find_statement_trace(sqlite3* db, bool enabledOnly = true);
+
+/* start tracing db into a ring of the given capacity (rounded up to a power of 2), or stop
+   tracing if capacity is 0. returns false if too many connections are tracing */
+bool enable_statement_trace(sqlite3* db, int capacity);
+
+/* free the trace of db, which must have no statements left; called once db is closed */
+void release_statement_trace(sqlite3* db);
+
+#endif // _CBL_DATABASE_SQLITE_TRACE_H
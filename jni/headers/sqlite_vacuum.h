@@ -0,0 +1,56 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_VACUUM_H
+#define _CBL_DATABASE_SQLITE_VACUUM_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "sqlite3.h"
+
+#include "sqlite_connection.h"
+
+// Reclaims the free pages of an auto_vacuum=INCREMENTAL database in the background, a batch of
+// pages at a time, whenever its connection has been idle for a while. A batch only runs while the
+// connection is in autocommit mode with no statement in progress, and the connection's own thread
+// waits for at most one batch.
+struct VacuumScheduler {
+    SQLiteConnection* const connection;
+    const int pagesPerStep;
+    const int idleMillis;                   // Idle time before vacuuming, and between checks
+    const int minFreePages;                 // Free pages below which there's nothing to do
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping;
+    int64_t pagesVacuumed;
+    int64_t steps;
+    std::thread thread;
+
+    VacuumScheduler(SQLiteConnection* connection, int pagesPerStep, int idleMillis, int minFreePages);
+    ~VacuumScheduler();                     // Stops the thread, waiting for a batch in progress
+
+    void run();
+};
+
+/* read an integer pragma, such as "freelist_count" */
+int read_int_pragma(sqlite3* db, const char* name, sqlite3_int64* value);
+
+/* run PRAGMA incremental_vacuum(pages) if the connection is idle, setting freed to the number of
+   pages it released; returns SQLITE_BUSY without doing anything if the connection isn't idle, or
+   without waiting if another connection has the database locked */
+int incremental_vacuum_step(sqlite3* db, int pages, int* freed);
+
+#endif // _CBL_DATABASE_SQLITE_VACUUM_H
@@ -0,0 +1,44 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#ifndef _CBL_DATABASE_SQLITE_VFS_SHIM_H
+#define _CBL_DATABASE_SQLITE_VFS_SHIM_H
+
+#include "sqlite3.h"
+
+// A VFS that wraps another one, passing everything but xOpen straight through to it.
+struct VfsShim {
+    sqlite3_vfs vfs;            // First, so that the sqlite3_vfs* SQLite passes back is the shim
+    sqlite3_vfs* base;
+    void* owner;                // The object the shim belongs to, for its xOpen
+};
+
+typedef int (*vfs_open_function)(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags,
+                                 int* outFlags);
+
+/* set up shim as a VFS named name (which must outlive it) wrapping base, opening files with
+   xOpen into at least szOsFile bytes; the shim still has to be registered */
+void init_vfs_shim(VfsShim* shim, sqlite3_vfs* base, const char* name, int szOsFile,
+                   vfs_open_function xOpen, void* owner);
+
+/* register the shim under its name, unless a VFS of that name already exists */
+bool register_vfs_shim(VfsShim* shim);
+
+/* unregister the shim, if it was registered */
+void unregister_vfs_shim(VfsShim* shim);
+
+/* the owner of the shim SQLite passes to a VFS method */
+inline void* vfs_shim_owner(sqlite3_vfs* vfs) {
+    return reinterpret_cast<VfsShim*>(vfs)->owner;
+}
+
+#endif // _CBL_DATABASE_SQLITE_VFS_SHIM_H
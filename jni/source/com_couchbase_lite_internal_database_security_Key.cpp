@@ -11,6 +11,18 @@
 //
 
 #include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "com_couchbase_lite_internal_database_security_Key.h"
 
@@ -19,93 +31,412 @@
 #define CBL_KEY_CRYPTO_OPENSSL
 #endif
 
+#define kKeySize 32            // PBKDF2-SHA256 output: 256 bit
+#define kPasswordDigestSize 32 // SHA-256
+#define kMaxCachedKeys 16
+
 #if defined (CBL_KEY_CRYPTO_CC)
 
 #import <CommonCrypto/CommonCrypto.h>
 
-JNIEXPORT jbyteArray JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeDerivePBKDF2SHA256Key
-  (JNIEnv *env, jclass clazz, jstring password, jbyteArray salt, jint rounds) {
+static bool deriveKey(const char* password, size_t passwordSize,
+                      const unsigned char* salt, size_t saltSize,
+                      int rounds, unsigned char* output) {
+    int status = CCKeyDerivationPBKDF(kCCPBKDF2,
+                                      password, passwordSize,
+                                      salt, saltSize,
+                                      kCCPRFHmacAlgSHA256, rounds,
+                                      output, kKeySize);
+    return status == 0;
+}
+
+static void digestPassword(const char* password, size_t passwordSize, unsigned char* digest) {
+    CC_SHA256(password, (CC_LONG)passwordSize, digest);
+}
+
+#elif defined (CBL_KEY_CRYPTO_OPENSSL)
+
+#include "openssl/evp.h"
+#include "openssl/sha.h"
+
+static bool deriveKey(const char* password, size_t passwordSize,
+                      const unsigned char* salt, size_t saltSize,
+                      int rounds, unsigned char* output) {
+    int status = PKCS5_PBKDF2_HMAC(password, (int)passwordSize, salt, (int)saltSize,
+                                   rounds, EVP_sha256(), kKeySize, output);
+    return status != 0;
+}
+
+static void digestPassword(const char* password, size_t passwordSize, unsigned char* digest) {
+    SHA256((const unsigned char*)password, passwordSize, digest);
+}
+
+#else
+#error "NO DEFAULT CRYPTO PROVIDER DEFINED"
+#endif
+
+static void wipe(void* buf, size_t size) {
+    volatile unsigned char* p = (volatile unsigned char*)buf;
+    while (size--)
+        *p++ = 0;
+}
+
+/**
+ * <KeyRequest>
+ */
+
+// The inputs of one key derivation, copied out of the Java objects.
+struct KeyRequest {
+    std::string password;
+    std::string salt;
+    int rounds;
+
+    KeyRequest() : rounds(0) { }
+    ~KeyRequest() { wipe(&password[0], password.size()); }
+};
+
+static bool readKeyRequest(JNIEnv* env, jstring password, jbyteArray salt, jint rounds,
+                           KeyRequest* request) {
     if (password == NULL || salt == NULL)
-      return NULL;
+        return false;
 
-    // Password:
+    // NOTE: The password length is the UTF-16 length, as it always has been; changing it would
+    // change the keys derived from non-ASCII passwords of existing databases.
     const char* passwordCStr = env->GetStringUTFChars(password, NULL);
-    int passwordSize = (int)env->GetStringLength (password);
+    if (!passwordCStr)
+        return false;
+    request->password.assign(passwordCStr, (size_t)env->GetStringLength(password));
+    env->ReleaseStringUTFChars(password, passwordCStr);
 
-    // Salt:
-    int saltSize = env->GetArrayLength (salt);
-    unsigned char* saltBytes = new unsigned char[saltSize];
-    env->GetByteArrayRegion (salt, 0, saltSize, reinterpret_cast<jbyte*>(saltBytes));
+    jsize saltSize = env->GetArrayLength(salt);
+    request->salt.resize(saltSize);
+    if (saltSize > 0)
+        env->GetByteArrayRegion(salt, 0, saltSize, reinterpret_cast<jbyte*>(&request->salt[0]));
+    request->rounds = (int)rounds;
+    return true;
+}
 
-    // PBKDF2-SHA256
-    int outputSize = 32; //256 bit
-    unsigned char* output = new unsigned char[outputSize * 2];
-    int status = CCKeyDerivationPBKDF(kCCPBKDF2,
-                                      passwordCStr, passwordSize,
-                                      saltBytes, saltSize,
-                                      kCCPRFHmacAlgSHA256, rounds,
-                                      output, outputSize);
+static jbyteArray newKeyArray(JNIEnv* env, const unsigned char* key) {
+    jbyteArray result = env->NewByteArray(kKeySize);
+    if (result)
+        env->SetByteArrayRegion(result, 0, kKeySize, (const jbyte*)key);
+    return result;
+}
 
-    // Release memory:
-    env->ReleaseStringUTFChars(password, passwordCStr);
-    delete[] saltBytes;
+/**
+ * </KeyRequest>
+ */
 
-    // Return null if not success:
-    if (status)
-      return NULL;
+/**
+ * <KeyCache>
+ */
 
-    // Result:
-    jbyteArray result = env->NewByteArray(outputSize);
-    env->SetByteArrayRegion(result, 0, outputSize, (jbyte*)output);
+// Bounded LRU cache of derived keys, so reopening a database doesn't pay for PBKDF2 again.
+// Entries are keyed by a digest of the password, never the password itself.
+struct CachedKey {
+    unsigned char passwordDigest[kPasswordDigestSize];
+    std::string salt;
+    int rounds;
+    unsigned char key[kKeySize];
+};
 
-    // Release memory:
-    delete[] output;
-    
-    return result;
+static std::mutex sCacheMutex;
+static std::list<CachedKey> sCache; // Most recently used first
+
+static bool findCachedKey(const unsigned char* passwordDigest, const KeyRequest& request,
+                          unsigned char* key) {
+    std::lock_guard<std::mutex> lock(sCacheMutex);
+    for (std::list<CachedKey>::iterator i = sCache.begin(); i != sCache.end(); ++i) {
+        if (i->rounds == request.rounds && i->salt == request.salt
+                && memcmp(i->passwordDigest, passwordDigest, kPasswordDigestSize) == 0) {
+            memcpy(key, i->key, kKeySize);
+            sCache.splice(sCache.begin(), sCache, i);
+            return true;
+        }
+    }
+    return false;
 }
 
-#elif defined (CBL_KEY_CRYPTO_OPENSSL)
+static void addCachedKey(const unsigned char* passwordDigest, const KeyRequest& request,
+                         const unsigned char* key) {
+    std::lock_guard<std::mutex> lock(sCacheMutex);
+    sCache.push_front(CachedKey());
+    CachedKey& entry = sCache.front();
+    memcpy(entry.passwordDigest, passwordDigest, kPasswordDigestSize);
+    entry.salt = request.salt;
+    entry.rounds = request.rounds;
+    memcpy(entry.key, key, kKeySize);
+    while (sCache.size() > kMaxCachedKeys) {
+        wipe(sCache.back().key, kKeySize);
+        sCache.pop_back();
+    }
+}
 
-#include "openssl/evp.h"
-#include "openssl/sha.h"
+static void clearCachedKeys() {
+    std::lock_guard<std::mutex> lock(sCacheMutex);
+    for (std::list<CachedKey>::iterator i = sCache.begin(); i != sCache.end(); ++i)
+        wipe(i->key, kKeySize);
+    sCache.clear();
+}
+
+// Derives the key for the request, using the cache when possible.
+static bool deriveCachedKey(const KeyRequest& request, unsigned char* key) {
+    unsigned char passwordDigest[kPasswordDigestSize];
+    digestPassword(request.password.data(), request.password.size(), passwordDigest);
+    bool ok = findCachedKey(passwordDigest, request, key);
+    if (!ok) {
+        ok = deriveKey(request.password.data(), request.password.size(),
+                       (const unsigned char*)request.salt.data(), request.salt.size(),
+                       request.rounds, key);
+        if (ok)
+            addCachedKey(passwordDigest, request, key);
+    }
+    wipe(passwordDigest, kPasswordDigestSize);
+    return ok;
+}
+
+/**
+ * </KeyCache>
+ */
+
+/**
+ * <KeyDerivationService>
+ */
+
+// A key derivation queued on the background thread. Shared between the queue and the Java
+// handle, so either side can let go of it first.
+struct DerivationTask {
+    enum State { PENDING, RUNNING, DONE, FAILED, CANCELED };
+
+    KeyRequest request;
+    std::mutex mutex;
+    std::condition_variable changed;
+    State state;
+    unsigned char key[kKeySize];
+
+    DerivationTask() : state(PENDING) { }
+    ~DerivationTask() { wipe(key, kKeySize); }
+};
+
+typedef std::shared_ptr<DerivationTask> DerivationTaskRef;
+
+// The queue outlives static destruction on purpose: the detached worker is blocked on its
+// condition variable when the process exits, and destroying it then would hang.
+struct DerivationQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<DerivationTaskRef> tasks;
+    bool workerStarted;
+
+    DerivationQueue() : workerStarted(false) { }
+};
+
+static DerivationQueue& derivationQueue() {
+    static DerivationQueue* queue = new DerivationQueue();
+    return *queue;
+}
+
+static void runDerivationTask(const DerivationTaskRef& task) {
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        if (task->state == DerivationTask::CANCELED)
+            return;
+        task->state = DerivationTask::RUNNING;
+    }
+
+    unsigned char key[kKeySize];
+    bool ok = deriveCachedKey(task->request, key);
+
+    std::lock_guard<std::mutex> lock(task->mutex);
+    // PBKDF2 itself can't be interrupted; if the task was canceled meanwhile, drop the result.
+    if (task->state == DerivationTask::RUNNING) {
+        if (ok)
+            memcpy(task->key, key, kKeySize);
+        task->state = ok ? DerivationTask::DONE : DerivationTask::FAILED;
+    }
+    wipe(key, kKeySize);
+    task->changed.notify_all();
+}
+
+static void derivationWorker() {
+    DerivationQueue& queue = derivationQueue();
+    for (;;) {
+        DerivationTaskRef task;
+        {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            while (queue.tasks.empty())
+                queue.changed.wait(lock);
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        runDerivationTask(task);
+    }
+}
+
+static void enqueueDerivationTask(const DerivationTaskRef& task) {
+    DerivationQueue& queue = derivationQueue();
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.workerStarted) {
+        // The worker lives as long as the process; it never touches the JVM.
+        std::thread(derivationWorker).detach();
+        queue.workerStarted = true;
+    }
+    queue.tasks.push_back(task);
+    queue.changed.notify_one();
+}
+
+static void cancelDerivationTask(const DerivationTaskRef& task) {
+    std::lock_guard<std::mutex> lock(task->mutex);
+    if (task->state == DerivationTask::PENDING || task->state == DerivationTask::RUNNING) {
+        task->state = DerivationTask::CANCELED;
+        task->changed.notify_all();
+    }
+}
+
+static DerivationTaskRef* taskFromHandle(jlong handle) {
+    return reinterpret_cast<DerivationTaskRef*>(handle);
+}
+
+/**
+ * </KeyDerivationService>
+ */
 
 JNIEXPORT jbyteArray JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeDerivePBKDF2SHA256Key
   (JNIEnv *env, jclass clazz, jstring password, jbyteArray salt, jint rounds) {
-    if (password == NULL || salt == NULL)
+    KeyRequest request;
+    if (!readKeyRequest(env, password, salt, rounds, &request))
       return NULL;
 
-    // Password:
-    const char* passwordCStr = env->GetStringUTFChars(password, NULL);
-    int passwordSize = (int)env->GetStringLength (password);
-
-    // Salt:
-    int saltSize = env->GetArrayLength (salt);
-    unsigned char* saltBytes = new unsigned char[saltSize];
-    env->GetByteArrayRegion (salt, 0, saltSize, reinterpret_cast<jbyte*>(saltBytes));
-
-    // PBKDF2-SHA256
-    int outputSize = 32; //256 bit
-    unsigned char* output = new unsigned char[outputSize * 2];
-    int status = PKCS5_PBKDF2_HMAC(passwordCStr, passwordSize, saltBytes, saltSize,
-                                   (int)rounds, EVP_sha256(), outputSize, output);
-    // Release memory:
-    env->ReleaseStringUTFChars(password, passwordCStr);
-    delete[] saltBytes;
+    unsigned char key[kKeySize];
+    if (!deriveCachedKey(request, key))
+      return NULL;
+
+    jbyteArray result = newKeyArray(env, key);
+    wipe(key, kKeySize);
+    return result;
+}
+
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeDeriveKeyAsync
+  (JNIEnv *env, jclass clazz, jstring password, jbyteArray salt, jint rounds) {
+    DerivationTaskRef task = std::make_shared<DerivationTask>();
+    if (!readKeyRequest(env, password, salt, rounds, &task->request))
+      return 0;
+    enqueueDerivationTask(task);
+    return reinterpret_cast<jlong>(new DerivationTaskRef(task));
+}
+
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeIsDerivationDone
+  (JNIEnv *env, jclass clazz, jlong handle) {
+    DerivationTaskRef& task = *taskFromHandle(handle);
+    std::lock_guard<std::mutex> lock(task->mutex);
+    return task->state != DerivationTask::PENDING && task->state != DerivationTask::RUNNING;
+}
+
+JNIEXPORT jbyteArray JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeAwaitDerivedKey
+  (JNIEnv *env, jclass clazz, jlong handle, jlong timeoutMillis) {
+    DerivationTaskRef& task = *taskFromHandle(handle);
+    unsigned char key[kKeySize];
+    {
+        std::unique_lock<std::mutex> lock(task->mutex);
+        // A negative timeout waits until the derivation finishes or is canceled:
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+        while (task->state == DerivationTask::PENDING || task->state == DerivationTask::RUNNING) {
+            if (timeoutMillis < 0)
+                task->changed.wait(lock);
+            else if (task->changed.wait_until(lock, deadline) == std::cv_status::timeout)
+                break;
+        }
+        if (task->state != DerivationTask::DONE)
+            return NULL; // Still running, canceled or failed
+        memcpy(key, task->key, kKeySize);
+    }
+    jbyteArray result = newKeyArray(env, key);
+    wipe(key, kKeySize);
+    return result;
+}
 
-    // Return null if not success:
-    if (status == 0)
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeCancelDerivation
+  (JNIEnv *env, jclass clazz, jlong handle) {
+    cancelDerivationTask(*taskFromHandle(handle));
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeReleaseDerivation
+  (JNIEnv *env, jclass clazz, jlong handle) {
+    DerivationTaskRef* task = taskFromHandle(handle);
+    if (task) {
+        cancelDerivationTask(*task); // No-op if already finished
+        delete task;
+    }
+}
+
+JNIEXPORT jobjectArray JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeDeriveKeys
+  (JNIEnv *env, jclass clazz, jobjectArray passwords, jobjectArray salts, jintArray rounds) {
+    if (passwords == NULL || salts == NULL || rounds == NULL)
+      return NULL;
+    jsize count = env->GetArrayLength(passwords);
+    if (env->GetArrayLength(salts) != count || env->GetArrayLength(rounds) != count)
       return NULL;
 
-    // Result:
-    jbyteArray result = env->NewByteArray(outputSize);
-    env->SetByteArrayRegion(result, 0, outputSize, (jbyte*)output);
+    std::vector<jint> roundsValues(count);
+    if (count > 0)
+        env->GetIntArrayRegion(rounds, 0, count, &roundsValues[0]);
+
+    std::vector<KeyRequest> requests(count);
+    std::vector<char> valid(count, 0);
+    for (jsize i = 0; i < count; i++) {
+        jstring password = (jstring)env->GetObjectArrayElement(passwords, i);
+        jbyteArray salt = (jbyteArray)env->GetObjectArrayElement(salts, i);
+        valid[i] = readKeyRequest(env, password, salt, roundsValues[i], &requests[i]);
+        env->DeleteLocalRef(password);
+        env->DeleteLocalRef(salt);
+    }
 
-    // Release memory:
-    delete[] output;
-    
+    // Derive the keys on as many threads as there are cores (the calling thread is one of them):
+    std::vector<unsigned char> keys(count * kKeySize);
+    std::vector<char> derived(count, 0);
+    std::mutex nextMutex;
+    jsize next = 0;
+    std::function<void()> work = [&]() {
+        for (;;) {
+            jsize i;
+            {
+                std::lock_guard<std::mutex> lock(nextMutex);
+                if (next >= count)
+                    return;
+                i = next++;
+            }
+            if (valid[i])
+                derived[i] = deriveCachedKey(requests[i], &keys[i * kKeySize]);
+        }
+    };
+    unsigned int threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 2;
+    if (threadCount > (unsigned int)count)
+        threadCount = (unsigned int)count;
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < threadCount; t++)
+        threads.push_back(std::thread(work));
+    work();
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+
+    // Result: one key per request, or null for the ones that failed:
+    jclass byteArrayClass = env->FindClass("[B");
+    jobjectArray result = byteArrayClass ? env->NewObjectArray(count, byteArrayClass, NULL) : NULL;
+    for (jsize i = 0; result && i < count; i++) {
+        if (derived[i]) {
+            jbyteArray key = newKeyArray(env, &keys[i * kKeySize]);
+            env->SetObjectArrayElement(result, i, key);
+            env->DeleteLocalRef(key);
+        }
+    }
+    wipe(keys.data(), keys.size());
     return result;
 }
-#else
-#error "NO DEFAULT CRYPTO PROVIDER DEFINED"
-#endif
 
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_security_Key_nativeClearKeyCache
+  (JNIEnv *env, jclass clazz) {
+    clearCachedKeys();
+}
@@ -14,12 +14,26 @@
 #include <stdlib.h>
 #include <string>
 #include <cstring>
+#include <ctype.h>
+#include <algorithm>
+#include <chrono>
 
 #include "sqlite3.h"
 
 #include "com_couchbase_lite_internal_database_sqlite_SQLiteConnection.h"
 #include "sqlite_connection.h"
+#include "sqlite_changes.h"
+#include "sqlite_collators.h"
 #include "sqlite_common.h"
+#include "sqlite_group_commit.h"
+#include "sqlite_io_stats.h"
+#include "sqlite_memory.h"
+#include "sqlite_memory_vfs.h"
+#include "sqlite_result_cache.h"
+#include "sqlite_slow_query_log.h"
+#include "sqlite_temp_store.h"
+#include "sqlite_trace.h"
+#include "sqlite_vacuum.h"
 
 /* Busy timeout in milliseconds.
  * If another connection (possibly in another process) has the database locked for
@@ -35,16 +49,78 @@
  */
 static const int BUSY_TIMEOUT_MS = 2500;
 
+// Memory for the temporary files of a TEMP_STORE_BOUNDED connection that doesn't set a budget.
+static const jlong TEMP_STORE_BUDGET = 16 * 1024 * 1024;
+
+// Size of the raw SQLCipher keys taken by nativeOpenWithConfig, as derived by Key.
+static const int ENCRYPTION_KEY_SIZE = 32;
+
 // Called each time a statement begins execution, when tracing is enabled.
 static void sqliteTraceCallback(void *data, const char *sql) {
     SQLiteConnection* connection = static_cast<SQLiteConnection*>(data);
     LOGV(SQLITE_TRACE_TAG, "%s: \"%s\"\n", connection->label, sql);
 }
 
-// Called each time a statement finishes execution, when profiling is enabled.
+// Called each time a statement finishes execution, when profiling or the slow query log is enabled.
 static void sqliteProfileCallback(void *data, const char *sql, sqlite3_uint64 tm) {
     SQLiteConnection* connection = static_cast<SQLiteConnection*>(data);
-    LOGV(SQLITE_PROFILE_TAG, "%s: \"%s\" took %0.3f ms\n", connection->label, sql, tm * 0.000001f);
+    if (connection->logProfile) {
+        LOGV(SQLITE_PROFILE_TAG, "%s: \"%s\" took %0.3f ms\n", connection->label, sql, tm * 0.000001f);
+    }
+    if (connection->slowQueryLog) {
+        connection->slowQueryLog->statementFinished(connection->db, sql, (int64_t)tm);
+    }
+}
+
+// Called for each row changed, while the change collector or the result cache is on.
+static void sqliteUpdateCallback(void* data, int operation, const char* database, const char* table,
+                                 sqlite3_int64 rowid) {
+    SQLiteConnection* connection = static_cast<SQLiteConnection*>(data);
+    connection->hookedRowChanges++;
+    if (connection->changeCollector && connection->changeCollector->enabled)
+        connection->changeCollector->rowChanged(operation, database, table, rowid);
+    if (connection->resultCache)
+        connection->resultCache->tableChanged(table);
+}
+
+// Called as each transaction commits, while the change collector is on.
+static int sqliteCommitCallback(void* data) {
+    SQLiteConnection* connection = static_cast<SQLiteConnection*>(data);
+    connection->changeCollector->committed();
+    return 0;   // Let the commit go ahead
+}
+
+// Called as each transaction rolls back, while the change collector is on.
+static void sqliteRollbackCallback(void* data) {
+    SQLiteConnection* connection = static_cast<SQLiteConnection*>(data);
+    connection->changeCollector->rolledBack();
+}
+
+// SQLite has a single update hook per connection, shared by the change collector and the result cache.
+static void installChangeHooks(SQLiteConnection* connection) {
+    bool collecting = connection->changeCollector && connection->changeCollector->enabled;
+    bool updates = collecting || connection->resultCache;
+    sqlite3_update_hook(connection->db, updates ? &sqliteUpdateCallback : NULL,
+                        updates ? connection : NULL);
+    sqlite3_commit_hook(connection->db, collecting ? &sqliteCommitCallback : NULL,
+                        collecting ? connection : NULL);
+    sqlite3_rollback_hook(connection->db, collecting ? &sqliteRollbackCallback : NULL,
+                          collecting ? connection : NULL);
+}
+
+// Called after a statement has run, with the update hook's row count from before it ran. SQLite
+// empties a table for a DELETE without a WHERE clause without calling the update hook.
+static void checkTableEmptied(SQLiteConnection* connection, sqlite3_stmt* statement,
+                              unsigned hookedRowChanges) {
+    if (connection->hookedRowChanges != hookedRowChanges || sqlite3_changes(connection->db) <= 0)
+        return;
+    std::string table;
+    if (!parse_delete_table(sqlite3_sql(statement), table))
+        return;
+    if (connection->changeCollector && connection->changeCollector->enabled)
+        connection->changeCollector->tableEmptied(connection->db, table);
+    if (connection->resultCache)
+        connection->resultCache->tableChanged(table.c_str());
 }
 
 // Called after each SQLite VM instruction when cancelation is enabled.
@@ -67,8 +143,9 @@ static char* lowercase(char* str) {
     return str;
 }
 
-JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeOpen
-(JNIEnv* env, jclass clazz, jstring pathStr, jint openFlags, jstring labelStr, jboolean enableTrace, jboolean enableProfile) {
+static SQLiteConnection* openConnection(JNIEnv* env, jstring pathStr, jint openFlags, jstring labelStr,
+                                        jboolean enableTrace, jboolean enableProfile, int busyTimeoutMs,
+                                        const char* vfsName = NULL) {
     int sqliteFlags;
     if (openFlags & SQLiteConnection::CREATE_IF_NECESSARY) {
         sqliteFlags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
@@ -91,44 +168,322 @@ JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteC
     env->ReleaseStringUTFChars(labelStr, labelCStr);
     
     sqlite3* db;
-    int err = sqlite3_open_v2(path.c_str(), &db, sqliteFlags, NULL);
+    int err = sqlite3_open_v2(path.c_str(), &db, sqliteFlags, vfsName);
     if (err != SQLITE_OK) {
         LOGE(SQLITE_LOG_TAG, "sqlite3_open_v2 failed PATH: %s", path.c_str());
         throw_sqlite3_exception_errcode(env, err, "Could not open database");
-        return 0;
+        sqlite3_close(db);      // Still allocated, and using the VFS
+        return NULL;
     }
 
     // Check that the database is really read/write when that is what we asked for.
     if ((sqliteFlags & SQLITE_OPEN_READWRITE) && sqlite3_db_readonly(db, NULL)) {
         throw_sqlite3_exception(env, db, "Could not open the database in read/write mode.");
         sqlite3_close(db);
-        return 0;
+        return NULL;
     }
     
     // Set the default busy handler to retry automatically before returning SQLITE_BUSY.
-    err = sqlite3_busy_timeout(db, BUSY_TIMEOUT_MS);
+    err = sqlite3_busy_timeout(db, busyTimeoutMs);
     if (err != SQLITE_OK) {
         throw_sqlite3_exception(env, db, "Could not set busy timeout");
         sqlite3_close(db);
-        return 0;
+        return NULL;
     }
 
     // Create wrapper object.
     SQLiteConnection* connection = new SQLiteConnection(db, openFlags, path.c_str(), label.c_str());
+    register_connection(connection);
     
     // Enable tracing and profiling if requested.
     if (enableTrace) {
         sqlite3_trace(db, &sqliteTraceCallback, connection);
     }
     if (enableProfile) {
+        connection->logProfile = true;
         sqlite3_profile(db, &sqliteProfileCallback, connection);
     }
 
     LOGV(SQLITE_LOG_TAG, "SQLITE VERSION %s", sqlite3_libversion());
     LOGV(SQLITE_LOG_TAG, "Opened connection %p with label '%s'", db, label.c_str());
+    return connection;
+}
+
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeOpen
+(JNIEnv* env, jclass clazz, jstring pathStr, jint openFlags, jstring labelStr, jboolean enableTrace, jboolean enableProfile) {
+    SQLiteConnection* connection = openConnection(env, pathStr, openFlags, labelStr,
+                                                  enableTrace, enableProfile, BUSY_TIMEOUT_MS);
+    return reinterpret_cast<jlong>(connection);
+}
+
+// Like nativeOpen, but with the database's files opened through the VFS of the given name, such as
+// one created by nativeCreateIOStatsVfs; NULL uses the default VFS.
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeOpenWithVfs
+(JNIEnv* env, jclass clazz, jstring pathStr, jint openFlags, jstring labelStr, jboolean enableTrace, jboolean enableProfile,
+ jstring vfsNameStr) {
+    const char* vfsName = vfsNameStr ? env->GetStringUTFChars(vfsNameStr, NULL) : NULL;
+    SQLiteConnection* connection = openConnection(env, pathStr, openFlags, labelStr,
+                                                  enableTrace, enableProfile, BUSY_TIMEOUT_MS, vfsName);
+    if (vfsNameStr)
+        env->ReleaseStringUTFChars(vfsNameStr, vfsName);
+    return reinterpret_cast<jlong>(connection);
+}
+
+// Runs a PRAGMA that was built from trusted values; the result rows, if any, are ignored.
+static bool executePragma(JNIEnv* env, SQLiteConnection* connection, const char* name, const char* value) {
+    char sql[128];
+    snprintf(sql, sizeof(sql), "PRAGMA %s=%s", name, value);
+    int err = sqlite3_exec(connection->db, sql, NULL, NULL, NULL);
+    if (err != SQLITE_OK) {
+        char message[160];
+        snprintf(message, sizeof(message), ", while executing: %s", sql);
+        throw_sqlite3_exception(env, connection->db, message);
+        return false;
+    }
+    return true;
+}
+
+static bool executePragma(JNIEnv* env, SQLiteConnection* connection, const char* name, jlong value) {
+    char valueStr[32];
+    snprintf(valueStr, sizeof(valueStr), "%lld", (long long)value);
+    return executePragma(env, connection, name, valueStr);
+}
+
+static bool isPragmaKeyword(const char* str) {
+    if (!*str)
+        return false;
+    for (; *str; str++) {
+        if (!isalpha((unsigned char)*str))
+            return false;
+    }
+    return true;
+}
+
+static jlong elapsedNanos(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Applies the configuration of nativeOpenWithConfig to a freshly opened connection, filling in
+// the time each phase took. Throws and returns false on the first failure.
+static bool configureConnection(JNIEnv* env, SQLiteConnection* connection, const jlong* config,
+                                const char* journalMode, const char* locale, const char* icuDataPath,
+                                jlong* timings) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // The page size only takes effect before the database is first written to (or on VACUUM),
+    // and must come before switching to WAL mode.
+    if (config[SQLiteConnection::CONFIG_PAGE_SIZE] >= 0
+            && !executePragma(env, connection, "page_size", config[SQLiteConnection::CONFIG_PAGE_SIZE]))
+        return false;
+    // Likewise auto_vacuum, which can only be changed in an existing database by a VACUUM.
+    if (config[SQLiteConnection::CONFIG_AUTO_VACUUM] >= 0
+            && !executePragma(env, connection, "auto_vacuum", config[SQLiteConnection::CONFIG_AUTO_VACUUM]))
+        return false;
+    if (journalMode) {
+        if (!isPragmaKeyword(journalMode)) {
+            throw_sqlite3_exception(env, "Invalid journal mode");
+            return false;
+        }
+        if (!executePragma(env, connection, "journal_mode", journalMode))
+            return false;
+    }
+    if (config[SQLiteConnection::CONFIG_SYNCHRONOUS] >= 0
+            && !executePragma(env, connection, "synchronous", config[SQLiteConnection::CONFIG_SYNCHRONOUS]))
+        return false;
+    // cache_size may legitimately be negative (a size in KiB), so only -1 means "default":
+    if (config[SQLiteConnection::CONFIG_CACHE_SIZE] != -1
+            && !executePragma(env, connection, "cache_size", config[SQLiteConnection::CONFIG_CACHE_SIZE]))
+        return false;
+    if (config[SQLiteConnection::CONFIG_MMAP_SIZE] >= 0
+            && !executePragma(env, connection, "mmap_size", config[SQLiteConnection::CONFIG_MMAP_SIZE]))
+        return false;
+    jlong tempStore = config[SQLiteConnection::CONFIG_TEMP_STORE];
+    if (tempStore >= 0 && !executePragma(env, connection, "temp_store",
+                                         tempStore == SQLiteConnection::TEMP_STORE_MEMORY ? "MEMORY" : "FILE"))
+        return false;
+    timings[SQLiteConnection::TIMING_PRAGMAS] = elapsedNanos(start);
+
+    start = std::chrono::steady_clock::now();
+    jlong collators = config[SQLiteConnection::CONFIG_COLLATORS];
+    if (collators < 0)
+        collators = SQLiteConnection::COLLATOR_JSON | SQLiteConnection::COLLATOR_REVID;
+    if (collators & SQLiteConnection::COLLATOR_JSON)
+        register_json_collators(connection->db, locale, icuDataPath);
+    if (collators & SQLiteConnection::COLLATOR_REVID)
+        register_revid_collator(connection->db);
+    timings[SQLiteConnection::TIMING_COLLATORS] = elapsedNanos(start);
+
+    start = std::chrono::steady_clock::now();
+    if (config[SQLiteConnection::CONFIG_WARM_UP] > 0) {
+        // Reading sqlite_master loads and parses the schema now rather than on the first query.
+        int err = sqlite3_exec(connection->db, "SELECT count(*) FROM sqlite_master", NULL, NULL, NULL);
+        if (err != SQLITE_OK) {
+            throw_sqlite3_exception(env, connection->db, "Could not load the database schema");
+            return false;
+        }
+    }
+    timings[SQLiteConnection::TIMING_WARM_UP] = elapsedNanos(start);
+    return true;
+}
+
+static bool supportsEncryption() {
+#ifdef __ANDROID__
+    // Same test as SQLiteDatabase.nativeSupportEncryption.
+#ifdef SQLITE_HAS_CODEC
+    return true;
+#else
+    return false;
+#endif
+#else
+    return sqlite3_compileoption_used("SQLITE_HAS_CODEC") != 0;
+#endif
+}
+
+static void wipe(void* buf, size_t size) {
+    volatile unsigned char* p = (volatile unsigned char*)buf;
+    while (size--)
+        *p++ = 0;
+}
+
+// Keys the connection to an SQLCipher database with a raw key. This must come before anything
+// reads the database: until then SQLCipher can't read an encrypted one (SQLITE_NOTADB), and it
+// would set up a new one in plaintext. Throws and returns false if the build has no codec.
+static bool applyKey(JNIEnv* env, SQLiteConnection* connection, jbyteArray keyArray) {
+    if (!supportsEncryption()) {
+        throw_sqlite3_exception_errcode(env, SQLITE_MISUSE, "This SQLite build can't open encrypted databases");
+        return false;
+    }
+    if (env->GetArrayLength(keyArray) != ENCRYPTION_KEY_SIZE) {
+        throw_sqlite3_exception_errcode(env, SQLITE_MISUSE, "Encryption keys must be 32 bytes");
+        return false;
+    }
+    unsigned char key[ENCRYPTION_KEY_SIZE];
+    env->GetByteArrayRegion(keyArray, 0, ENCRYPTION_KEY_SIZE, reinterpret_cast<jbyte*>(key));
+
+    // SQLCipher takes a raw key as a blob literal, which skips its own key derivation.
+    static const char hex[] = "0123456789abcdef";
+    char sql[sizeof("PRAGMA key = \"x''\"") + 2 * ENCRYPTION_KEY_SIZE];
+    char* p = sql + sprintf(sql, "PRAGMA key = \"x'");
+    for (int i = 0; i < ENCRYPTION_KEY_SIZE; i++) {
+        *p++ = hex[key[i] >> 4];
+        *p++ = hex[key[i] & 0xF];
+    }
+    strcpy(p, "'\"");
+    int err = sqlite3_exec(connection->db, sql, NULL, NULL, NULL);
+    wipe(key, sizeof(key));
+    wipe(sql, sizeof(sql));
+    if (err != SQLITE_OK) {
+        throw_sqlite3_exception(env, connection->db, "Could not set the encryption key");
+        return false;
+    }
+    return true;
+}
+
+static const char* getOptionalStringUTFChars(JNIEnv* env, jstring str) {
+    return str ? env->GetStringUTFChars(str, NULL) : NULL;
+}
+
+static void releaseOptionalStringUTFChars(JNIEnv* env, jstring str, const char* chars) {
+    if (chars)
+        env->ReleaseStringUTFChars(str, chars);
+}
+
+// Opens a connection and applies its configuration in one call. An encrypted database needs its
+// raw 32-byte key in keyArray (or null for a plaintext one), which is applied before any pragma.
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeOpenWithConfig
+(JNIEnv* env, jclass clazz, jstring pathStr, jint openFlags, jstring labelStr, jboolean enableTrace, jboolean enableProfile,
+ jlongArray configArray, jstring journalModeStr, jstring localeStr, jstring icuDataPathStr, jbyteArray keyArray,
+ jlongArray timingsArray) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Missing or short config arrays leave the remaining settings at their defaults:
+    jlong config[SQLiteConnection::CONFIG_COUNT];
+    for (int i = 0; i < SQLiteConnection::CONFIG_COUNT; i++)
+        config[i] = -1;
+    if (configArray) {
+        jsize count = env->GetArrayLength(configArray);
+        if (count > SQLiteConnection::CONFIG_COUNT)
+            count = SQLiteConnection::CONFIG_COUNT;
+        env->GetLongArrayRegion(configArray, 0, count, config);
+    }
+    jlong timings[SQLiteConnection::TIMING_COUNT] = { 0 };
+
+    int busyTimeoutMs = BUSY_TIMEOUT_MS;
+    if (config[SQLiteConnection::CONFIG_BUSY_TIMEOUT_MS] >= 0)
+        busyTimeoutMs = (int)config[SQLiteConnection::CONFIG_BUSY_TIMEOUT_MS];
+    // Temporary files on disk or bounded in memory go through a VFS of the connection's own, which
+    // must be chosen when it opens. (With no budget, each temporary file is spilled when first written.)
+    TempStore* tempStore = NULL;
+    jlong tempStorePolicy = config[SQLiteConnection::CONFIG_TEMP_STORE];
+    if (tempStorePolicy == SQLiteConnection::TEMP_STORE_FILE || tempStorePolicy == SQLiteConnection::TEMP_STORE_BOUNDED) {
+        jlong budget = config[SQLiteConnection::CONFIG_TEMP_STORE_BUDGET];
+        if (budget < 0)
+            budget = TEMP_STORE_BUDGET;
+        tempStore = TempStore::create(tempStorePolicy == SQLiteConnection::TEMP_STORE_BOUNDED ? budget : 0);
+        if (!tempStore) {
+            throw_sqlite3_exception(env, "Could not create the temp store");
+            return 0;
+        }
+    }
+    SQLiteConnection* connection = openConnection(env, pathStr, openFlags, labelStr,
+                                                  enableTrace, enableProfile, busyTimeoutMs,
+                                                  tempStore ? tempStore->name : NULL);
+    if (!connection) {
+        delete tempStore;
+        return 0;
+    }
+    connection->tempStore = tempStore;
+    // The key goes first, since every pragma of the configuration may read the database.
+    bool ok = !keyArray || applyKey(env, connection, keyArray);
+    timings[SQLiteConnection::TIMING_OPEN] = elapsedNanos(start);
+
+    const char* journalMode = getOptionalStringUTFChars(env, journalModeStr);
+    const char* locale = getOptionalStringUTFChars(env, localeStr);
+    const char* icuDataPath = getOptionalStringUTFChars(env, icuDataPathStr);
+    if (ok)
+        ok = configureConnection(env, connection, config, journalMode, locale, icuDataPath, timings);
+    releaseOptionalStringUTFChars(env, journalModeStr, journalMode);
+    releaseOptionalStringUTFChars(env, localeStr, locale);
+    releaseOptionalStringUTFChars(env, icuDataPathStr, icuDataPath);
+    if (!ok) {
+        unregister_connection(connection);
+        sqlite3_close(connection->db);
+        delete connection->tempStore;
+        delete connection;
+        return 0;
+    }
+    timings[SQLiteConnection::TIMING_TOTAL] = elapsedNanos(start);
+
+    if (timingsArray) {
+        jsize count = env->GetArrayLength(timingsArray);
+        if (count > SQLiteConnection::TIMING_COUNT)
+            count = SQLiteConnection::TIMING_COUNT;
+        env->SetLongArrayRegion(timingsArray, 0, count, timings);
+    }
     return reinterpret_cast<jlong>(connection);
 }
 
+// Lets go of the buffers bound to a statement once it can no longer read them: after it has been
+// finalized, or reset with its bindings cleared (clearBindings clears them, in case the reset
+// failed before getting to it). With no statement, lets go of every buffer.
+static void releaseBoundBuffers(JNIEnv* env, SQLiteConnection* connection, sqlite3_stmt* statement,
+                                bool clearBindings) {
+    std::vector<std::pair<sqlite3_stmt*, jobject> >& buffers = connection->boundBuffers;
+    for (size_t i = 0; i < buffers.size(); ) {
+        if (statement && buffers[i].first != statement) {
+            i++;
+            continue;
+        }
+        if (clearBindings) {
+            sqlite3_clear_bindings(statement);
+            clearBindings = false;
+        }
+        env->DeleteGlobalRef(buffers[i].second);
+        buffers[i] = buffers.back();
+        buffers.pop_back();
+    }
+}
+
 JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeClose
 (JNIEnv* env, jclass clazz, jlong connectionPtr) {
     SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
@@ -137,14 +492,31 @@ JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteCo
         LOGV(SQLITE_LOG_TAG, "Closing connection %p", connection->db);
 
         // Close database:
+        delete connection->vacuumScheduler;
+        connection->vacuumScheduler = NULL;
+        if (connection->resultCache) {
+            // Its statement would keep the database from closing.
+            connection->resultCache->finalize(connection->db);
+        }
+        unregister_connection(connection);
         int err = sqlite3_close(connection->db);
         if (err != SQLITE_OK) {
             // This can happen if sub-objects aren't closed first.  Make sure the caller knows.
             LOGE(SQLITE_LOG_TAG, "sqlite3_close(%p) failed: %d", connection->db, err);
+            register_connection(connection);
             throw_sqlite3_exception(env, connection->db, "Count not close db.");
             return;
         }
         
+        release_statement_trace(connection->db);
+        releaseBoundBuffers(env, connection, NULL, false);
+        delete connection->slowQueryLog;
+        if (connection->changeCollector)
+            connection->changeCollector->close();
+        delete connection->changeCollector;
+        delete connection->resultCache;
+        delete connection->groupCommit;
+        delete connection->tempStore;
         delete connection;
     }
 }
@@ -153,12 +525,22 @@ JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteC
 (JNIEnv* env, jclass clazz, jlong connectionPtr, jstring sqlString) {
     SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
     
+    if (hard_heap_limit_exceeded()) {
+        throw_sqlite3_exception_errcode(env, SQLITE_NOMEM, "SQLite heap limit exceeded");
+        return 0;
+    }
+    connection->activity++;
+
     jsize sqlLength = env->GetStringLength(sqlString);
     const jchar* sql = env->GetStringCritical(sqlString, NULL);
     sqlite3_stmt* statement;
+    if (connection->resultCache)
+        connection->resultCache->beginPrepare();
     int err = sqlite3_prepare16_v2(connection->db,
                                    sql, sqlLength * sizeof(jchar), &statement, NULL);
     env->ReleaseStringCritical(sqlString, sql);
+    if (connection->resultCache)
+        connection->resultCache->endPrepare(connection->db, err == SQLITE_OK ? statement : NULL);
     
     if (err != SQLITE_OK) {
         // Error messages like 'near ")": syntax error' are not
@@ -189,7 +571,15 @@ JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteCo
     // whether any errors occurred while executing the statement.  The statement itself
     // is always finalized regardless.
     //LOGV(SQLITE_LOG_TAG, "Finalized statement %p on connection %p", statement, connection->db);
+    StatementTrace* trace = find_statement_trace(connection->db);
+    if (trace)
+        trace->cursorReset(statement);
+    if (connection->slowQueryLog)
+        connection->slowQueryLog->clearBinds(statement);
+    if (connection->resultCache)
+        connection->resultCache->statementFinalized(statement);
     sqlite3_finalize(statement);
+    releaseBoundBuffers(env, connection, statement, false);
 }
 
 JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetParameterCount
@@ -234,6 +624,10 @@ JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteCo
     sqlite3_stmt* statement = reinterpret_cast<sqlite3_stmt*>(statementPtr);
     
     int err = sqlite3_bind_null(statement, index);
+    if (connection->slowQueryLog)
+        connection->slowQueryLog->noteBind(statement, index, 'N', 0);
+    if (connection->resultCache)
+        connection->resultCache->noteBind(statement, index, 'N', NULL, 0);
     if (err != SQLITE_OK) {
         throw_sqlite3_exception(env, connection->db, NULL);
     }
@@ -245,6 +639,10 @@ JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteCo
     sqlite3_stmt* statement = reinterpret_cast<sqlite3_stmt*>(statementPtr);
     
     int err = sqlite3_bind_int64(statement, index, value);
+    if (connection->slowQueryLog)
+        connection->slowQueryLog->noteBind(statement, index, 'I', 0);
+    if (connection->resultCache)
+        connection->resultCache->noteBind(statement, index, 'I', &value, sizeof(value));
     if (err != SQLITE_OK) {
         throw_sqlite3_exception(env, connection->db, NULL);
     }
@@ -256,6 +654,10 @@ JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteCo
     sqlite3_stmt* statement = reinterpret_cast<sqlite3_stmt*>(statementPtr);
     
     int err = sqlite3_bind_double(statement, index, value);
+    if (connection->slowQueryLog)
+        connection->slowQueryLog->noteBind(statement, index, 'F', 0);
+    if (connection->resultCache)
+        connection->resultCache->noteBind(statement, index, 'F', &value, sizeof(value));
     if (err != SQLITE_OK) {
         throw_sqlite3_exception(env, connection->db, NULL);
     }
@@ -270,7 +672,11 @@ JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteCo
     const jchar* value = env->GetStringCritical(valueString, NULL);
     int err = sqlite3_bind_text16(statement, index, value, valueLength * sizeof(jchar),
                                   SQLITE_TRANSIENT);
+    if (connection->resultCache)
+        connection->resultCache->noteBind(statement, index, 'T', value, valueLength * sizeof(jchar));
     env->ReleaseStringCritical(valueString, value);
+    if (connection->slowQueryLog)
+        connection->slowQueryLog->noteBind(statement, index, 'T', valueLength);
     if (err != SQLITE_OK) {
         throw_sqlite3_exception(env, connection->db, NULL);
     }
@@ -284,27 +690,133 @@ JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteCo
     jsize valueLength = env->GetArrayLength(valueArray);
     jbyte* value = static_cast<jbyte*>(env->GetPrimitiveArrayCritical(valueArray, NULL));
     int err = sqlite3_bind_blob(statement, index, value, valueLength, SQLITE_TRANSIENT);
+    if (connection->resultCache)
+        connection->resultCache->noteBind(statement, index, 'B', value, valueLength);
     env->ReleasePrimitiveArrayCritical(valueArray, value, JNI_ABORT);
+    if (connection->slowQueryLog)
+        connection->slowQueryLog->noteBind(statement, index, 'B', valueLength);
     if (err != SQLITE_OK) {
         throw_sqlite3_exception(env, connection->db, NULL);
     }}
 
+// Binds length bytes at address without copying them, as UTF-8 text or as a blob.
+static void bindStatic(JNIEnv* env, SQLiteConnection* connection, sqlite3_stmt* statement, jint index,
+                       const char* address, jint length, jboolean text) {
+    int err = text ? sqlite3_bind_text(statement, index, address, length, SQLITE_STATIC)
+                   : sqlite3_bind_blob(statement, index, address, length, SQLITE_STATIC);
+    if (connection->resultCache)
+        connection->resultCache->noteBind(statement, index, text ? 'U' : 'B', address, length);
+    if (connection->slowQueryLog)
+        connection->slowQueryLog->noteBind(statement, index, text ? 'T' : 'B', length);
+    if (err != SQLITE_OK) {
+        throw_sqlite3_exception(env, connection->db, NULL);
+    }
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBindByteBuffer
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlong statementPtr, jint index, jobject buffer,
+ jint offset, jint length, jboolean text) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    sqlite3_stmt* statement = reinterpret_cast<sqlite3_stmt*>(statementPtr);
+    
+    char* address = static_cast<char*>(env->GetDirectBufferAddress(buffer));
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (!address || capacity < 0) {
+        throw_sqlite3_exception(env, "ByteBuffer is not direct");
+        return;
+    }
+    if (offset < 0 || length < 0 || offset > capacity - length) {
+        throw_sqlite3_exception(env, "Offset and length are outside the ByteBuffer");
+        return;
+    }
+    // The buffer has to stay alive until SQLite is done with it, when the statement is reset.
+    jobject ref = env->NewGlobalRef(buffer);
+    if (!ref) {
+        env->ExceptionClear();
+        throw_sqlite3_exception_errcode(env, SQLITE_NOMEM, "Could not reference the ByteBuffer");
+        return;
+    }
+    connection->boundBuffers.push_back(std::make_pair(statement, ref));
+    bindStatic(env, connection, statement, index, address + offset, length, text);
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBindPointer
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlong statementPtr, jint index, jlong address,
+ jint length, jboolean text) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    sqlite3_stmt* statement = reinterpret_cast<sqlite3_stmt*>(statementPtr);
+    
+    // The caller keeps the memory alive until the statement is reset.
+    if (!address || length < 0) {
+        throw_sqlite3_exception(env, "Invalid address or length");
+        return;
+    }
+    bindStatic(env, connection, statement, index, reinterpret_cast<const char*>(address), length, text);
+}
+
 JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeResetStatementAndClearBindings
 (JNIEnv* env, jclass clazz, jlong connectionPtr, jlong statementPtr) {
     SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
     sqlite3_stmt* statement = reinterpret_cast<sqlite3_stmt*>(statementPtr);
     
+    StatementTrace* trace = find_statement_trace(connection->db);
+    if (trace)
+        trace->cursorReset(statement);
     int err = sqlite3_reset(statement);
     if (err == SQLITE_OK) {
         err = sqlite3_clear_bindings(statement);
+        if (connection->slowQueryLog)
+            connection->slowQueryLog->statementReset(statement);
+        if (connection->resultCache)
+            connection->resultCache->clearBinds(statement);
     }
+    releaseBoundBuffers(env, connection, statement, true);
     if (err != SQLITE_OK) {
         throw_sqlite3_exception(env, connection->db, NULL);
     }
 }
 
+// Statements that end a transaction free memory, so they may run even over the heap limit.
+static bool endsTransaction(sqlite3_stmt* statement) {
+    static const char* const keywords[] = {"COMMIT", "END", "ROLLBACK", "RELEASE"};
+    const char* sql = sqlite3_sql(statement);
+    if (!sql)
+        return false;
+    while (isspace((unsigned char)*sql))
+        sql++;
+    for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+        size_t length = strlen(keywords[i]);
+        size_t j = 0;
+        while (j < length && toupper((unsigned char)sql[j]) == keywords[i][j])
+            j++;
+        if (j == length && !isalnum((unsigned char)sql[j]) && sql[j] != '_')
+            return true;
+    }
+    return false;
+}
+
+static bool checkHeapLimit(JNIEnv* env, sqlite3_stmt* statement) {
+    if (hard_heap_limit_exceeded() && !endsTransaction(statement)) {
+        throw_sqlite3_exception_errcode(env, SQLITE_NOMEM, "SQLite heap limit exceeded");
+        return false;
+    }
+    return true;
+}
+
 static int executeNonQuery(JNIEnv* env, SQLiteConnection* connection, sqlite3_stmt* statement) {
+    if (!checkHeapLimit(env, statement))
+        return SQLITE_NOMEM;
+    connection->activity++;
+    unsigned hookedRowChanges = connection->hookedRowChanges;
+    StatementTrace* trace = find_statement_trace(connection->db);
+    int64_t start = trace ? StatementTrace::now() : 0;
     int err = sqlite3_step(statement);
+    if (trace)
+        trace->record(statement, start, err == SQLITE_DONE ? sqlite3_changes(connection->db) : 0, err);
+    if (err == SQLITE_DONE && (connection->changeCollector || connection->resultCache))
+        checkTableEmptied(connection, statement, hookedRowChanges);
+    if (connection->resultCache)
+        connection->resultCache->statementExecuted(statement);
     if (err == SQLITE_ROW) {
         const char *sql = sqlite3_sql(statement);
         if (sql) {
@@ -325,7 +837,14 @@ static int executeNonQuery(JNIEnv* env, SQLiteConnection* connection, sqlite3_st
 }
 
 static int executeOneRowQuery(JNIEnv* env, SQLiteConnection* connection, sqlite3_stmt* statement) {
+    if (!checkHeapLimit(env, statement))
+        return SQLITE_NOMEM;
+    connection->activity++;
+    StatementTrace* trace = find_statement_trace(connection->db);
+    int64_t start = trace ? StatementTrace::now() : 0;
     int err = sqlite3_step(statement);
+    if (trace)
+        trace->record(statement, start, err == SQLITE_ROW ? 1 : 0, err);
     if (err != SQLITE_ROW) {
         throw_sqlite3_exception(env, connection->db);
     }
@@ -387,6 +906,395 @@ JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteC
     ? sqlite3_last_insert_rowid(connection->db) : -1;
 }
 
+// Runs each statement of a script in turn, ignoring any rows. On error, returns it with its message
+// left in the connection and the offset of the failed statement, in UTF-16 units, in errorOffset.
+// Unless endTransaction is set, a statement that would end a transaction (or roll back to a
+// savepoint) is not run, and fails the script with SQLITE_MISUSE.
+static int runScript(SQLiteConnection* connection, const jchar* script, jsize length, bool endTransaction,
+                     int* count, int* errorOffset) {
+    const jchar* end = script + length;
+    const jchar* sql = script;
+    int err = SQLITE_OK;
+    *count = 0;
+    while (sql < end) {
+        sqlite3_stmt* statement = NULL;
+        const void* tail = NULL;
+        if (connection->resultCache)
+            connection->resultCache->beginPrepare();
+        err = sqlite3_prepare16_v2(connection->db, sql, (int)((end - sql) * sizeof(jchar)), &statement, &tail);
+        if (connection->resultCache)
+            connection->resultCache->endPrepare(connection->db, err == SQLITE_OK ? statement : NULL);
+        if (err != SQLITE_OK)
+            break;
+        if (!statement)
+            return SQLITE_OK;       // Nothing left but whitespace and comments
+        if (!endTransaction && endsTransaction(statement)) {
+            if (connection->resultCache)
+                connection->resultCache->statementFinalized(statement);
+            sqlite3_finalize(statement);
+            err = SQLITE_MISUSE;
+            break;
+        }
+        
+        // Rows returned by the script, as by PRAGMAs, are ignored.
+        connection->activity++;
+        unsigned hookedRowChanges = connection->hookedRowChanges;
+        StatementTrace* trace = find_statement_trace(connection->db);
+        int64_t start = trace ? StatementTrace::now() : 0;
+        while ((err = sqlite3_step(statement)) == SQLITE_ROW)
+            ;
+        if (trace)
+            trace->record(statement, start, err == SQLITE_DONE ? sqlite3_changes(connection->db) : 0, err);
+        if (err == SQLITE_DONE && (connection->changeCollector || connection->resultCache))
+            checkTableEmptied(connection, statement, hookedRowChanges);
+        if (connection->resultCache) {
+            connection->resultCache->statementExecuted(statement);
+            connection->resultCache->statementFinalized(statement);
+        }
+        sqlite3_finalize(statement);
+        if (err != SQLITE_DONE)
+            break;
+        (*count)++;
+        err = SQLITE_OK;
+        sql = static_cast<const jchar*>(tail);
+    }
+    *errorOffset = (int)(sql - script);
+    return err;
+}
+
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeExecuteScript
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jstring scriptString, jboolean inTransaction) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    if (hard_heap_limit_exceeded()) {
+        throw_sqlite3_exception_errcode(env, SQLITE_NOMEM, "SQLite heap limit exceeded");
+        return 0;
+    }
+    // Not a critical section, since the script may take a while and SQLite may call back into Java.
+    jsize scriptLength = env->GetStringLength(scriptString);
+    const jchar* script = env->GetStringChars(scriptString, NULL);
+    if (!script)
+        return 0;
+    
+    // A savepoint rather than BEGIN, so that the script can also run inside a transaction.
+    int err = SQLITE_OK;
+    if (inTransaction)
+        err = sqlite3_exec(connection->db, "SAVEPOINT nativeExecuteScript", NULL, NULL, NULL);
+    if (err != SQLITE_OK) {
+        env->ReleaseStringChars(scriptString, script);
+        throw_sqlite3_exception(env, connection->db, ", while starting the script's transaction");
+        return 0;
+    }
+    
+    // A script run in the savepoint can't end it, or the transaction around it.
+    int count = 0;
+    int errorOffset = 0;
+    err = runScript(connection, script, scriptLength, !inTransaction, &count, &errorOffset);
+    if (err != SQLITE_OK) {
+        // Keep the error before rolling back, which would replace it.
+        int errcode = sqlite3_extended_errcode(connection->db);
+        std::string errmsg = sqlite3_errmsg(connection->db);
+        if (err == SQLITE_MISUSE) {
+            errcode = err;
+            errmsg = "A script run in a transaction can't end it";
+        }
+        if (inTransaction)
+            sqlite3_exec(connection->db, "ROLLBACK TO nativeExecuteScript; RELEASE nativeExecuteScript",
+                         NULL, NULL, NULL);
+        char message[96];
+        snprintf(message, sizeof(message), ", in statement %d of the script, at offset %d",
+                 count + 1, errorOffset);
+        env->ReleaseStringChars(scriptString, script);
+        throw_sqlite3_exception(env, errcode, errmsg.c_str(), message);
+        return count;
+    }
+    env->ReleaseStringChars(scriptString, script);
+    if (inTransaction && sqlite3_exec(connection->db, "RELEASE nativeExecuteScript", NULL, NULL, NULL) != SQLITE_OK) {
+        throw_sqlite3_exception(env, connection->db, ", while committing the script's transaction");
+        sqlite3_exec(connection->db, "ROLLBACK TO nativeExecuteScript; RELEASE nativeExecuteScript",
+                     NULL, NULL, NULL);
+    }
+    return count;
+}
+
+static void failGroupCommitRequest(GroupCommit::Request* request, int errcode, const char* errmsg) {
+    request->errcode = errcode;
+    request->errmsg = errmsg;
+    request->changes = 0;
+}
+
+// Begins the transaction of the given group commit requests, or fails them all.
+static bool beginGroupCommitTransaction(sqlite3* db, GroupCommit::Request** requests, int count) {
+    if (sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL) == SQLITE_OK)
+        return true;
+    int errcode = sqlite3_extended_errcode(db);
+    std::string errmsg = sqlite3_errmsg(db);
+    for (int i = 0; i < count; i++)
+        failGroupCommitRequest(requests[i], errcode, errmsg.c_str());
+    return false;
+}
+
+// Runs a batch of group commit requests in one transaction, each in a savepoint so that a failed
+// request is rolled back without the others. If the commit itself fails, every request fails.
+// An error that rolls back the whole transaction (as INSERT OR ROLLBACK, or IOERR, FULL, NOMEM or
+// INTERRUPT may) takes the requests released into it along, and the rest of the batch runs in a
+// new one; returns false if any of the batch's transactions was lost.
+static bool runGroupCommitBatch(void* context, GroupCommit::Request** requests, int count) {
+    SQLiteConnection* connection = static_cast<SQLiteConnection*>(context);
+    sqlite3* db = connection->db;
+    
+    if (!beginGroupCommitTransaction(db, requests, count))
+        return false;
+    bool committed = true;
+    int first = 0;                  // The first request of the current transaction
+    for (int i = 0; i < count; i++) {
+        GroupCommit::Request* request = requests[i];
+        if (hard_heap_limit_exceeded()) {
+            failGroupCommitRequest(request, SQLITE_NOMEM, "SQLite heap limit exceeded");
+            continue;
+        }
+        if (sqlite3_get_autocommit(db) && !beginGroupCommitTransaction(db, requests + i, count - i))
+            return false;
+        int err = sqlite3_exec(db, "SAVEPOINT groupCommit", NULL, NULL, NULL);
+        int totalChanges = sqlite3_total_changes(db);
+        if (err == SQLITE_OK)
+            err = runScript(connection, request->script, request->length, false, &request->count,
+                            &request->errorOffset);
+        if (err != SQLITE_OK) {
+            int errcode = sqlite3_extended_errcode(db);
+            std::string errmsg = sqlite3_errmsg(db);
+            if (err == SQLITE_MISUSE) {
+                errcode = err;
+                errmsg = "Group commit requests can't end the transaction";
+            }
+            failGroupCommitRequest(request, errcode, errmsg.c_str());
+            if (sqlite3_get_autocommit(db)) {
+                for (int j = first; j < i; j++) {
+                    if (requests[j]->errcode == SQLITE_OK)
+                        failGroupCommitRequest(requests[j], errcode,
+                                               (errmsg + ", in another request of the batch").c_str());
+                }
+                committed = false;
+                first = i + 1;
+                continue;
+            }
+            sqlite3_exec(db, "ROLLBACK TO groupCommit; RELEASE groupCommit", NULL, NULL, NULL);
+            continue;
+        }
+        request->changes = sqlite3_total_changes(db) - totalChanges;
+        sqlite3_exec(db, "RELEASE groupCommit", NULL, NULL, NULL);
+    }
+    if (sqlite3_get_autocommit(db))
+        return committed;           // The last transaction was lost along with its requests
+    if (sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+        int errcode = sqlite3_extended_errcode(db);
+        std::string errmsg = sqlite3_errmsg(db);
+        if (!sqlite3_get_autocommit(db))
+            sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        for (int i = first; i < count; i++) {
+            if (requests[i]->errcode == SQLITE_OK)
+                failGroupCommitRequest(requests[i], errcode, (errmsg + ", while committing").c_str());
+        }
+        return false;
+    }
+    return committed;
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeSetTempStoreDirectory
+(JNIEnv* env, jclass clazz, jstring directoryStr) {
+    const char* directory = getOptionalStringUTFChars(env, directoryStr);
+    set_temp_store_directory(directory);
+    releaseOptionalStringUTFChars(env, directoryStr, directory);
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetTempStoreStats
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlongArray statsArray) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    int64_t stats[TempStore::STAT_COUNT] = { 0 };
+    if (connection->tempStore)
+        connection->tempStore->getStats(stats);
+    jsize count = env->GetArrayLength(statsArray);
+    if (count > TempStore::STAT_COUNT)
+        count = TempStore::STAT_COUNT;
+    jlong values[TempStore::STAT_COUNT];
+    for (int i = 0; i < count; i++)
+        values[i] = stats[i];
+    env->SetLongArrayRegion(statsArray, 0, count, values);
+}
+
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeCreateIOStatsVfs
+(JNIEnv* env, jclass clazz, jstring nameStr, jstring baseNameStr) {
+    const char* name = env->GetStringUTFChars(nameStr, NULL);
+    const char* baseName = getOptionalStringUTFChars(env, baseNameStr);
+    IOStatsVfs* vfs = IOStatsVfs::create(name, baseName);
+    releaseOptionalStringUTFChars(env, baseNameStr, baseName);
+    env->ReleaseStringUTFChars(nameStr, name);
+    if (!vfs)
+        throw_sqlite3_exception(env, "Could not create the I/O stats VFS: its name is taken or its base VFS doesn't exist");
+    return reinterpret_cast<jlong>(vfs);
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetIOStats
+(JNIEnv* env, jclass clazz, jlong vfsPtr, jlongArray statsArray, jboolean reset) {
+    IOStatsVfs* vfs = reinterpret_cast<IOStatsVfs*>(vfsPtr);
+
+    int64_t stats[IOStatsVfs::STAT_COUNT];
+    vfs->getStats(stats, reset);
+    jsize count = env->GetArrayLength(statsArray);
+    if (count > IOStatsVfs::STAT_COUNT)
+        count = IOStatsVfs::STAT_COUNT;
+    jlong values[IOStatsVfs::STAT_COUNT];
+    for (int i = 0; i < count; i++)
+        values[i] = stats[i];
+    env->SetLongArrayRegion(statsArray, 0, count, values);
+}
+
+// Every connection opened with the VFS must have been closed.
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDestroyIOStatsVfs
+(JNIEnv* env, jclass clazz, jlong vfsPtr) {
+    delete reinterpret_cast<IOStatsVfs*>(vfsPtr);
+}
+
+// Connections open databases of the VFS with nativeOpenWithVfs, naming them by any string; a
+// maxBytes of 0 or less sets no cap.
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeCreateMemoryVfs
+(JNIEnv* env, jclass clazz, jstring nameStr, jlong maxBytes) {
+    const char* name = env->GetStringUTFChars(nameStr, NULL);
+    MemoryVfs* vfs = MemoryVfs::create(name, maxBytes);
+    env->ReleaseStringUTFChars(nameStr, name);
+    if (!vfs)
+        throw_sqlite3_exception(env, "Could not create the in-memory VFS: its name is taken");
+    return reinterpret_cast<jlong>(vfs);
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetMemoryVfsStats
+(JNIEnv* env, jclass clazz, jlong vfsPtr, jlongArray statsArray) {
+    MemoryVfs* vfs = reinterpret_cast<MemoryVfs*>(vfsPtr);
+
+    int64_t stats[MemoryVfs::STAT_COUNT];
+    vfs->getStats(stats);
+    jsize count = env->GetArrayLength(statsArray);
+    if (count > MemoryVfs::STAT_COUNT)
+        count = MemoryVfs::STAT_COUNT;
+    jlong values[MemoryVfs::STAT_COUNT];
+    for (int i = 0; i < count; i++)
+        values[i] = stats[i];
+    env->SetLongArrayRegion(statsArray, 0, count, values);
+}
+
+// Writes the database to a file on disk, replacing the file's content.
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeSaveMemoryDatabase
+(JNIEnv* env, jclass clazz, jlong vfsPtr, jstring dbNameStr, jstring pathStr) {
+    MemoryVfs* vfs = reinterpret_cast<MemoryVfs*>(vfsPtr);
+
+    const char* dbName = env->GetStringUTFChars(dbNameStr, NULL);
+    const char* path = env->GetStringUTFChars(pathStr, NULL);
+    int err = vfs->save(dbName, path);
+    env->ReleaseStringUTFChars(pathStr, path);
+    env->ReleaseStringUTFChars(dbNameStr, dbName);
+    if (err != SQLITE_OK)
+        throw_sqlite3_exception_errcode(env, err, "Could not save the in-memory database");
+}
+
+// Replaces the database, creating it if necessary, with the content of a database file on disk.
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeLoadMemoryDatabase
+(JNIEnv* env, jclass clazz, jlong vfsPtr, jstring pathStr, jstring dbNameStr) {
+    MemoryVfs* vfs = reinterpret_cast<MemoryVfs*>(vfsPtr);
+
+    const char* path = env->GetStringUTFChars(pathStr, NULL);
+    const char* dbName = env->GetStringUTFChars(dbNameStr, NULL);
+    int err = vfs->load(path, dbName);
+    env->ReleaseStringUTFChars(dbNameStr, dbName);
+    env->ReleaseStringUTFChars(pathStr, path);
+    if (err != SQLITE_OK)
+        throw_sqlite3_exception_errcode(env, err, "Could not load the in-memory database");
+}
+
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDeleteMemoryDatabase
+(JNIEnv* env, jclass clazz, jlong vfsPtr, jstring dbNameStr) {
+    MemoryVfs* vfs = reinterpret_cast<MemoryVfs*>(vfsPtr);
+
+    const char* dbName = env->GetStringUTFChars(dbNameStr, NULL);
+    bool found = vfs->remove(dbName);
+    env->ReleaseStringUTFChars(dbNameStr, dbName);
+    return found;
+}
+
+// Frees every database of the VFS. Every connection opened with it must have been closed.
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDestroyMemoryVfs
+(JNIEnv* env, jclass clazz, jlong vfsPtr) {
+    delete reinterpret_cast<MemoryVfs*>(vfsPtr);
+}
+
+// Batches of at most maxBatch requests wait up to windowMicros for more to join them; a maxBatch of
+// 0 or less stops grouping writes. Only call it while no thread may submit: it fails if requests
+// are still queued or running, or if the connection is in a transaction. While group commit is
+// enabled, the connection must only be written through nativeSubmitGroupCommit.
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeEnableGroupCommit
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlong windowMicros, jint maxBatch) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    if (connection->groupCommit && !connection->groupCommit->idle()) {
+        throw_sqlite3_exception_errcode(env, SQLITE_MISUSE,
+                                        "Group commit can't change while requests are queued or running");
+        return;
+    }
+    if (maxBatch > 0 && !sqlite3_get_autocommit(connection->db)) {
+        throw_sqlite3_exception_errcode(env, SQLITE_MISUSE,
+                                        "Group commit can't be enabled in a transaction");
+        return;
+    }
+    delete connection->groupCommit;
+    connection->groupCommit = maxBatch > 0 ? new GroupCommit(windowMicros, maxBatch) : NULL;
+}
+
+// Runs the script in the next group commit batch of the connection, which must be a writer that is
+// not in a transaction, and returns the rows it changed once the batch has committed. Any number of
+// threads may submit at once; the connection must not be used otherwise meanwhile.
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeSubmitGroupCommit
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jstring scriptString) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    if (!connection->groupCommit) {
+        throw_sqlite3_exception(env, "Group commit is not enabled on this connection");
+        return 0;
+    }
+    // The batch may run on another submitter's thread, which reads the script while this one waits.
+    jsize scriptLength = env->GetStringLength(scriptString);
+    const jchar* script = env->GetStringChars(scriptString, NULL);
+    if (!script)
+        return 0;
+    GroupCommit::Request request(script, scriptLength);
+    connection->groupCommit->submit(&request, runGroupCommitBatch, connection);
+    env->ReleaseStringChars(scriptString, script);
+    
+    if (request.errcode != SQLITE_OK) {
+        char message[96];
+        snprintf(message, sizeof(message), ", in statement %d of the request, at offset %d",
+                 request.count + 1, request.errorOffset);
+        throw_sqlite3_exception(env, request.errcode, request.errmsg.c_str(), message);
+        return 0;
+    }
+    return request.changes;
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetGroupCommitStats
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlongArray statsArray) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    int64_t stats[GroupCommit::STAT_COUNT] = { 0 };
+    if (connection->groupCommit)
+        connection->groupCommit->getStats(stats);
+    jsize count = env->GetArrayLength(statsArray);
+    if (count > GroupCommit::STAT_COUNT)
+        count = GroupCommit::STAT_COUNT;
+    jlong values[GroupCommit::STAT_COUNT];
+    for (int i = 0; i < count; i++)
+        values[i] = stats[i];
+    env->SetLongArrayRegion(statsArray, 0, count, values);
+}
+
 JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetDbLookaside
 (JNIEnv* env, jclass clazz, jlong connectionPtr) {
     SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
@@ -415,3 +1323,400 @@ JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteCo
         sqlite3_progress_handler(connection->db, 0, NULL, NULL);
     }
 }
+
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBackupInit
+(JNIEnv* env, jclass clazz, jlong destConnectionPtr, jstring destNameStr, jlong srcConnectionPtr, jstring srcNameStr) {
+    SQLiteConnection* destConnection = reinterpret_cast<SQLiteConnection*>(destConnectionPtr);
+    SQLiteConnection* srcConnection = reinterpret_cast<SQLiteConnection*>(srcConnectionPtr);
+
+    // Database names default to "main"; "temp" or an attached database's name also work.
+    std::string destName("main");
+    if (destNameStr) {
+        const char* destNameCStr = env->GetStringUTFChars(destNameStr, NULL);
+        destName = destNameCStr;
+        env->ReleaseStringUTFChars(destNameStr, destNameCStr);
+    }
+    std::string srcName("main");
+    if (srcNameStr) {
+        const char* srcNameCStr = env->GetStringUTFChars(srcNameStr, NULL);
+        srcName = srcNameCStr;
+        env->ReleaseStringUTFChars(srcNameStr, srcNameCStr);
+    }
+
+    // On failure the error is left in the destination connection.
+    sqlite3_backup* backup = sqlite3_backup_init(destConnection->db, destName.c_str(),
+                                                 srcConnection->db, srcName.c_str());
+    if (!backup) {
+        throw_sqlite3_exception(env, destConnection->db, "Could not start backup");
+        return 0;
+    }
+
+    LOGV(SQLITE_LOG_TAG, "Started backup from connection %p to %p", srcConnection->db, destConnection->db);
+    return reinterpret_cast<jlong>(new SQLiteBackup(backup, destConnection));
+}
+
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBackupStep
+(JNIEnv* env, jclass clazz, jlong backupPtr, jint pagesPerStep, jint sleepMillis) {
+    SQLiteBackup* backup = reinterpret_cast<SQLiteBackup*>(backupPtr);
+
+    // A negative page count copies everything that is left in one step.
+    // The source is only locked while a step runs, so writers get in between steps; if the
+    // source was written to meanwhile, SQLite restarts the copy on the next step by itself.
+    int err = sqlite3_backup_step(backup->backup, pagesPerStep);
+    if (err == SQLITE_DONE) {
+        return true;
+    }
+    if (err != SQLITE_OK && err != SQLITE_BUSY && err != SQLITE_LOCKED) {
+        throw_sqlite3_exception_errcode(env, err, "Backup step failed");
+        return false;
+    }
+
+    // Busy or locked: one of the databases is in use; just try again on the next step.
+    // Either way, give other connections some room before then if we were asked to.
+    if (sleepMillis > 0) {
+        sqlite3_sleep(sleepMillis);
+    }
+    return false;
+}
+
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBackupRemaining
+(JNIEnv* env, jclass clazz, jlong backupPtr) {
+    SQLiteBackup* backup = reinterpret_cast<SQLiteBackup*>(backupPtr);
+
+    return sqlite3_backup_remaining(backup->backup);
+}
+
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBackupPageCount
+(JNIEnv* env, jclass clazz, jlong backupPtr) {
+    SQLiteBackup* backup = reinterpret_cast<SQLiteBackup*>(backupPtr);
+
+    return sqlite3_backup_pagecount(backup->backup);
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeBackupFinish
+(JNIEnv* env, jclass clazz, jlong backupPtr) {
+    SQLiteBackup* backup = reinterpret_cast<SQLiteBackup*>(backupPtr);
+
+    if (backup) {
+        // Finishing before the last step abandons the backup, leaving the destination unchanged.
+        // The result reports the first error of any step, and is also set on the destination.
+        SQLiteConnection* destConnection = backup->destination;
+        int err = sqlite3_backup_finish(backup->backup);
+        delete backup;
+        if (err != SQLITE_OK) {
+            throw_sqlite3_exception(env, destConnection->db, "Backup failed");
+        }
+    }
+}
+
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeEnableStatementTrace
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jint capacity) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    return enable_statement_trace(connection->db, capacity);
+}
+
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDrainStatementTrace
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlongArray recordsArray) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    StatementTrace* trace = find_statement_trace(connection->db, false);
+    if (!trace)
+        return 0;
+
+    // Copies as many records as fit, StatementTrace::FIELD_COUNT longs each, oldest first.
+    jsize maxRecords = env->GetArrayLength(recordsArray) / StatementTrace::FIELD_COUNT;
+    if (maxRecords == 0)
+        return 0;
+    jlong* records = env->GetLongArrayElements(recordsArray, NULL);
+    if (!records)
+        return 0;
+    int count = trace->drain(reinterpret_cast<int64_t*>(records), maxRecords);
+    env->ReleaseLongArrayElements(recordsArray, records, 0);
+    return count;
+}
+
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetStatementTraceDropped
+(JNIEnv* env, jclass clazz, jlong connectionPtr) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    StatementTrace* trace = find_statement_trace(connection->db, false);
+    if (!trace)
+        return 0;
+    std::lock_guard<std::mutex> lock(trace->drainMutex);
+    return trace->dropped;
+}
+
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetStatementFingerprint
+(JNIEnv* env, jclass clazz, jstring sqlString) {
+    const char* sql = env->GetStringUTFChars(sqlString, NULL);
+    if (!sql)
+        return 0;
+    jlong fingerprint = (jlong)StatementTrace::fingerprint(sql, strlen(sql));
+    env->ReleaseStringUTFChars(sqlString, sql);
+    return fingerprint;
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeEnableSlowQueryLog
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jint thresholdMillis) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    // The log is kept until the connection closes, since the profile callback may be using it
+    // on another thread; a negative threshold just turns it off.
+    if (connection->slowQueryLog) {
+        connection->slowQueryLog->thresholdMillis = thresholdMillis;
+    } else if (thresholdMillis >= 0) {
+        connection->slowQueryLog = new SlowQueryLog(thresholdMillis);
+        sqlite3_profile(connection->db, &sqliteProfileCallback, connection);
+    }
+}
+
+JNIEXPORT jstring JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDrainSlowQueryLog
+(JNIEnv* env, jclass clazz, jlong connectionPtr) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    if (!connection->slowQueryLog)
+        return NULL;
+    
+    std::string json = connection->slowQueryLog->drain(connection->db);
+    if (json.empty())
+        return NULL;
+    return env->NewStringUTF(json.c_str());
+}
+
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeReleaseMemory
+(JNIEnv* env, jclass clazz) {
+    return release_all_memory();
+}
+
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeReleaseConnectionMemory
+(JNIEnv* env, jclass clazz, jlong connectionPtr) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    return release_connection_memory(connection);
+}
+
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeSetHeapLimits
+(JNIEnv* env, jclass clazz, jlong softLimit, jlong hardLimit) {
+    return set_heap_limits(softLimit, hardLimit);
+}
+
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeSetCacheSize
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlong maxKiB) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    // Shrinking the cache frees the unused pages beyond the new size at once.
+    int before = 0, after = 0, highwater;
+    sqlite3_db_status(connection->db, SQLITE_DBSTATUS_CACHE_USED, &before, &highwater, 0);
+    if (!executePragma(env, connection, "cache_size", -maxKiB))
+        return 0;
+    sqlite3_db_status(connection->db, SQLITE_DBSTATUS_CACHE_USED, &after, &highwater, 0);
+    return before > after ? before - after : 0;
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetVacuumStats
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlongArray statsArray) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    sqlite3_int64 pageSize = 0, pageCount = 0, freelistCount = 0, autoVacuum = 0;
+    int err = read_int_pragma(connection->db, "page_size", &pageSize);
+    if (err == SQLITE_OK)
+        err = read_int_pragma(connection->db, "page_count", &pageCount);
+    if (err == SQLITE_OK)
+        err = read_int_pragma(connection->db, "freelist_count", &freelistCount);
+    if (err == SQLITE_OK)
+        err = read_int_pragma(connection->db, "auto_vacuum", &autoVacuum);
+    if (err != SQLITE_OK) {
+        throw_sqlite3_exception(env, connection->db, "Could not read the free page count");
+        return;
+    }
+    
+    jlong stats[SQLiteConnection::VACUUM_STAT_COUNT] = { 0 };
+    stats[SQLiteConnection::VACUUM_STAT_PAGE_SIZE] = pageSize;
+    stats[SQLiteConnection::VACUUM_STAT_PAGE_COUNT] = pageCount;
+    stats[SQLiteConnection::VACUUM_STAT_FREELIST_COUNT] = freelistCount;
+    stats[SQLiteConnection::VACUUM_STAT_AUTO_VACUUM] = autoVacuum;
+    stats[SQLiteConnection::VACUUM_STAT_RECLAIMABLE_BYTES] = freelistCount * pageSize;
+    stats[SQLiteConnection::VACUUM_STAT_FREE_PER_MILLE] = pageCount > 0 ? freelistCount * 1000 / pageCount : 0;
+    VacuumScheduler* scheduler = connection->vacuumScheduler;
+    if (scheduler) {
+        std::lock_guard<std::mutex> lock(scheduler->mutex);
+        stats[SQLiteConnection::VACUUM_STAT_PAGES_VACUUMED] = scheduler->pagesVacuumed;
+        stats[SQLiteConnection::VACUUM_STAT_VACUUM_STEPS] = scheduler->steps;
+    }
+    
+    jsize count = env->GetArrayLength(statsArray);
+    if (count > SQLiteConnection::VACUUM_STAT_COUNT)
+        count = SQLiteConnection::VACUUM_STAT_COUNT;
+    env->SetLongArrayRegion(statsArray, 0, count, stats);
+}
+
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeIncrementalVacuum
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jint maxPages, jint pagesPerStep, jint budgetMillis) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    // Stops early once the budget is spent, so at most one batch runs past it.
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(budgetMillis);
+    int total = 0;
+    if (pagesPerStep <= 0)
+        return 0;
+    while (total < maxPages) {
+        int freed;
+        int err = incremental_vacuum_step(connection->db, std::min(pagesPerStep, maxPages - total), &freed);
+        if (err == SQLITE_BUSY || err == SQLITE_LOCKED)
+            break;      // In a transaction, or another connection is writing
+        if (err != SQLITE_OK) {
+            throw_sqlite3_exception(env, connection->db, "Incremental vacuum failed");
+            break;
+        }
+        total += freed;
+        if (freed < pagesPerStep || std::chrono::steady_clock::now() >= deadline)
+            break;
+    }
+    return total;
+}
+
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeStartIncrementalVacuum
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jint pagesPerStep, jint idleMillis, jint minFreePages) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    delete connection->vacuumScheduler;
+    connection->vacuumScheduler = NULL;
+    
+    // Only an incremental database keeps the pointer maps incremental_vacuum needs.
+    sqlite3_int64 autoVacuum = 0;
+    if (read_int_pragma(connection->db, "auto_vacuum", &autoVacuum) != SQLITE_OK) {
+        throw_sqlite3_exception(env, connection->db, "Could not read the auto_vacuum mode");
+        return false;
+    }
+    if (autoVacuum != 2 || pagesPerStep <= 0 || idleMillis <= 0)
+        return false;
+    connection->vacuumScheduler = new VacuumScheduler(connection, pagesPerStep, idleMillis, minFreePages);
+    return true;
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeStopIncrementalVacuum
+(JNIEnv* env, jclass clazz, jlong connectionPtr) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    delete connection->vacuumScheduler;
+    connection->vacuumScheduler = NULL;
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeEnableChangeCollector
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jboolean enable) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    // The collector stays around until the connection closes, since another thread may be waiting
+    // on it; closing wakes that thread.
+    if (enable) {
+        if (!connection->changeCollector)
+            connection->changeCollector = new ChangeCollector();
+        connection->changeCollector->enabled = true;
+    } else if (connection->changeCollector) {
+        connection->changeCollector->enabled = false;
+        connection->changeCollector->rolledBack();  // Forget a transaction in progress
+    }
+    installChangeHooks(connection);
+}
+
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeDrainChanges
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlongArray fieldsArray) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    if (!connection->changeCollector)
+        return 0;
+    
+    // Copies as many changes as fit, ChangeCollector::FIELD_COUNT longs each, oldest first.
+    jsize maxChanges = env->GetArrayLength(fieldsArray) / ChangeCollector::FIELD_COUNT;
+    if (maxChanges == 0)
+        return 0;
+    jlong* fields = env->GetLongArrayElements(fieldsArray, NULL);
+    if (!fields)
+        return 0;
+    int count = connection->changeCollector->drain(reinterpret_cast<int64_t*>(fields), maxChanges);
+    env->ReleaseLongArrayElements(fieldsArray, fields, 0);
+    return count;
+}
+
+JNIEXPORT jstring JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetChangedTableName
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jint table) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    if (!connection->changeCollector)
+        return NULL;
+    
+    std::string name = connection->changeCollector->tableName(table);
+    return name.empty() ? NULL : env->NewStringUTF(name.c_str());
+}
+
+// Returns early, with the latest commit, if the connection is closed meanwhile; nativeClose waits for
+// it to return. It must not be called once nativeClose has started.
+JNIEXPORT jlong JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeWaitForChanges
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlong afterCommit, jint timeoutMillis) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    if (!connection->changeCollector)
+        return 0;
+    return (jlong)connection->changeCollector->waitForCommit((uint64_t)afterCommit, timeoutMillis);
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeEnableResultCache
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlong budgetBytes) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    // Only statements prepared from now on can be cached, since the authorizer has to see them.
+    if (connection->resultCache) {
+        connection->resultCache->finalize(connection->db);
+        delete connection->resultCache;
+        connection->resultCache = NULL;
+    }
+    if (budgetBytes > 0) {
+        connection->resultCache = new ResultCache((size_t)budgetBytes);
+        connection->resultCache->attach(connection->db);
+    }
+    installChangeHooks(connection);
+}
+
+JNIEXPORT jbyteArray JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeExecuteForRows
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlong statementPtr) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    sqlite3_stmt* statement = reinterpret_cast<sqlite3_stmt*>(statementPtr);
+    
+    if (!checkHeapLimit(env, statement))
+        return NULL;
+    connection->activity++;
+    StatementTrace* trace = find_statement_trace(connection->db);
+    int64_t start = trace ? StatementTrace::now() : 0;
+    std::string rows;
+    int err = connection->resultCache ? connection->resultCache->execute(connection->db, statement, rows)
+                                      : serialize_rows(statement, rows);
+    if (trace) {
+        // The row count follows the column count, both big-endian.
+        const unsigned char* header = reinterpret_cast<const unsigned char*>(rows.data());
+        int64_t rowCount = err == SQLITE_DONE && rows.size() >= 8
+            ? (header[4] << 24 | header[5] << 16 | header[6] << 8 | header[7]) : 0;
+        trace->record(statement, start, rowCount, err);
+    }
+    if (err != SQLITE_DONE) {
+        throw_sqlite3_exception(env, connection->db);
+        return NULL;
+    }
+    
+    jbyteArray rowsArray = env->NewByteArray((jsize)rows.size());
+    if (!rowsArray) {
+        env->ExceptionClear();
+        throw_sqlite3_exception(env, "Native could not create new byte[]");
+        return NULL;
+    }
+    env->SetByteArrayRegion(rowsArray, 0, (jsize)rows.size(), reinterpret_cast<const jbyte*>(rows.data()));
+    return rowsArray;
+}
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteConnection_nativeGetResultCacheStats
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jlongArray statsArray) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    
+    uint64_t stats[ResultCache::STAT_COUNT] = { 0 };
+    if (connection->resultCache)
+        connection->resultCache->getStats(stats);
+    jlong values[ResultCache::STAT_COUNT];
+    for (int i = 0; i < ResultCache::STAT_COUNT; i++)
+        values[i] = (jlong)stats[i];
+    jsize count = env->GetArrayLength(statsArray);
+    if (count > ResultCache::STAT_COUNT)
+        count = ResultCache::STAT_COUNT;
+    env->SetLongArrayRegion(statsArray, 0, count, values);
+}
@@ -17,11 +17,22 @@
 #include "com_couchbase_lite_internal_database_sqlite_SQLiteQueryCursor.h"
 
 #include "sqlite_common.h"
+#include "sqlite_memory.h"
+#include "sqlite_trace.h"
 
 JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_internal_database_sqlite_SQLiteQueryCursor_nativeMoveToNext
 (JNIEnv* env, jclass clazz, jlong statementPtr) {
     sqlite3_stmt* statement = reinterpret_cast<sqlite3_stmt*>(statementPtr);
+    if (!sqlite3_stmt_busy(statement) && hard_heap_limit_exceeded()) {
+        throw_sqlite3_exception_errcode(env, SQLITE_NOMEM, "SQLite heap limit exceeded");
+        return false;
+    }
+    StatementTrace* trace = find_statement_trace(sqlite3_db_handle(statement));
+    bool first = trace && !sqlite3_stmt_busy(statement);
+    int64_t start = first ? StatementTrace::now() : 0;
     int err = sqlite3_step(statement);
+    if (trace)
+        trace->cursorStep(statement, first, start, err);
     if (err == SQLITE_ROW) {
         return true;
     } else if (err == SQLITE_DONE) {
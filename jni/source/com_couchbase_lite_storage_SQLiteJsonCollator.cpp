@@ -19,11 +19,26 @@
 #include <string.h>
 
 #include "sqlite_connection.h"
+#include "sqlite_collators.h"
+#include "sqlite_common.h"
+#include "sqlite_json_canonical.h"
 #include "sqlite_log.h"
 #include "com_couchbase_lite_storage_SQLiteJsonCollator.h"
 
 #ifdef USE_ICU4C_UNICODE_COMPARE
+#include <mutex>
+#include <string>
+#include <vector>
 #include <unicode/coll.h>
+#include <unicode/udata.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #endif
 
 // Default collation rules, including Unicode collation for strings
@@ -37,6 +52,184 @@
 #define DEFAULT_COLLATOR_LOCALE "en_US"
 #endif
 
+#ifdef USE_ICU4C_UNICODE_COMPARE
+/**
+ * <SharedCollator>
+ */
+
+// An ICU Collator shared by every connection that collates with the same locale and strength.
+// Connections on different threads may compare at the same time, so comparisons borrow clones
+// of the collator from a small pool rather than using one instance concurrently.
+struct SharedCollator {
+    std::string locale;
+    int strength;                  // Collator::ECollationStrength, or -1 for the locale's default
+    Collator* collator;            // Never compared with; only cloned
+    int refCount;                  // Guarded by sSharedCollatorsMutex
+    std::mutex poolMutex;
+    std::vector<Collator*> pool;   // Idle clones, guarded by poolMutex
+};
+
+static std::mutex sSharedCollatorsMutex;
+static std::vector<SharedCollator*> sSharedCollators;
+#ifdef ANDROID
+static std::string sICUDataPath;
+#endif
+
+static Collator* createCollator(const char* locale) {
+    const char* localeStr = locale;
+    if (localeStr == NULL)
+        localeStr = DEFAULT_COLLATOR_LOCALE;
+    
+    UErrorCode status = U_ZERO_ERROR;
+    Collator* collator = Collator::createInstance(localeStr, status);
+    if (!U_SUCCESS(status)) {
+        LOGE(SQLITE_COLLATOR_TAG, "Failed to create ICU Collator (locale=%s, status=%d)",
+             localeStr, status);
+        localeStr = DEFAULT_COLLATOR_LOCALE;
+        LOGV(SQLITE_COLLATOR_TAG, "Create ICU Collator with locale= %s instead", localeStr);
+        collator = Collator::createInstance(localeStr, status);
+        if(!U_SUCCESS(status)) {
+            LOGE(SQLITE_COLLATOR_TAG, "Failed to create ICU Collator (locale=%s, status=%d)",
+                 localeStr, status);
+        }
+    }
+    return collator;
+}
+
+// Returns the shared collator for the locale and strength, creating it on first use, or NULL if
+// ICU couldn't create one. Each call must be balanced by releaseCollator().
+static SharedCollator* acquireCollator(const char* locale, int strength, const char* icuDataPath) {
+    if (locale == NULL)
+        locale = DEFAULT_COLLATOR_LOCALE;
+
+    std::lock_guard<std::mutex> lock(sSharedCollatorsMutex);
+    for (size_t i = 0; i < sSharedCollators.size(); i++) {
+        SharedCollator* shared = sSharedCollators[i];
+        if (shared->strength == strength && shared->locale == locale) {
+            ++shared->refCount;
+            return shared;
+        }
+    }
+
+#ifdef ANDROID
+    // NOTE: Dictionary file is NOT bundled with library, unless set by nativeSetICUData.
+    if (icuDataPath != NULL && sICUDataPath != icuDataPath) {
+        // ICU looks the data up when it first loads it; changing the path only matters until then.
+        setenv("CBL_ICU_PREFIX", icuDataPath, 1);
+        sICUDataPath = icuDataPath;
+    }
+#endif
+    Collator* collator = createCollator(locale);
+    if (collator == NULL)
+        return NULL;
+    if (strength >= 0) {
+        UErrorCode status = U_ZERO_ERROR;
+        collator->setAttribute(UCOL_STRENGTH, (UColAttributeValue)strength, status);
+        if (!U_SUCCESS(status))
+            LOGE(SQLITE_COLLATOR_TAG, "Failed to set ICU Collator strength %d (locale=%s, status=%d)",
+                 strength, locale, status);
+    }
+
+    SharedCollator* shared = new SharedCollator();
+    shared->locale = locale;
+    shared->strength = strength;
+    shared->collator = collator;
+    shared->refCount = 1;
+    sSharedCollators.push_back(shared);
+    return shared;
+}
+
+static void releaseCollator(SharedCollator* shared) {
+    std::lock_guard<std::mutex> lock(sSharedCollatorsMutex);
+    if (--shared->refCount > 0)
+        return;
+    for (size_t i = 0; i < sSharedCollators.size(); i++) {
+        if (sSharedCollators[i] == shared) {
+            sSharedCollators.erase(sSharedCollators.begin() + i);
+            break;
+        }
+    }
+    for (size_t i = 0; i < shared->pool.size(); i++)
+        delete shared->pool[i];
+    delete shared->collator;
+    delete shared;
+}
+
+static Collator* borrowCollator(SharedCollator* shared) {
+    std::lock_guard<std::mutex> lock(shared->poolMutex);
+    if (shared->pool.empty())
+        return shared->collator->clone();
+    Collator* collator = shared->pool.back();
+    shared->pool.pop_back();
+    return collator;
+}
+
+static void returnCollator(SharedCollator* shared, Collator* collator) {
+    std::lock_guard<std::mutex> lock(shared->poolMutex);
+    shared->pool.push_back(collator);
+}
+
+/**
+ * </SharedCollator>
+ */
+
+/**
+ * <ICUData>
+ */
+
+// Maps an ICU common data file (such as the collation-only package made by
+// vendor/icu4c-android/build-collation-data.sh) into memory, so its pages are only read when
+// ICU touches them. The mapping is never undone: ICU keeps pointing into it.
+static const void* mapICUDataFile(const char* path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL)
+        return NULL;
+    const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return data != MAP_FAILED ? data : NULL;
+#endif
+}
+
+// Makes the ICU data file at path the first place ICU looks for data. Must be called before the
+// first collator is created; returns false if the file can't be used.
+static bool setICUDataFile(const char* path) {
+    std::lock_guard<std::mutex> lock(sSharedCollatorsMutex);
+    const void* data = mapICUDataFile(path);
+    if (data == NULL) {
+        LOGE(SQLITE_COLLATOR_TAG, "Failed to map ICU data file %s", path);
+        return false;
+    }
+    UErrorCode status = U_ZERO_ERROR;
+    udata_setCommonData(data, &status);
+    if (U_FAILURE(status)) {
+        LOGE(SQLITE_COLLATOR_TAG, "Failed to set ICU data from %s (status=%d)", path, status);
+        return false;
+    }
+    LOGV(SQLITE_COLLATOR_TAG, "Using ICU data from %s", path);
+    return true;
+}
+
+/**
+ * </ICUData>
+ */
+#endif
+
 /**
  * <CollatorContext>
  */
@@ -60,10 +253,8 @@ CollatorContext::CollatorContext(void* r, void* c) {
 
 CollatorContext::~CollatorContext() {
 #ifdef USE_ICU4C_UNICODE_COMPARE
-    if (collator) {
-        Collator *c = (Collator*)collator;
-        delete c;
-    }
+    if (collator)
+        releaseCollator((SharedCollator*)collator);
 #endif
 }
 
@@ -115,6 +306,10 @@ static void initializeCharPriorityMap(void) {
         kCharPriorityCaseInsensitive[c] = kCharPriority[toupper(c)];
 }
 
+// Filled in when the library is loaded, since SQLite's sorter worker threads (PRAGMA threads)
+// may collate on several threads at once, before any connection's first comparison returns.
+static const bool kCharPriorityMapInitialized = (initializeCharPriorityMap(), true);
+
 // Types of values, ordered according to Couch collation order.
 typedef enum {
     kEndArray,
@@ -359,10 +554,11 @@ static int compareStringsUnicode(const void *context, const char **in1, const ch
 
 #ifdef USE_ICU4C_UNICODE_COMPARE
     CollatorContext* cc = (CollatorContext*)context;
-    void* c = cc->getCollator();
-    if (c) {
-        Collator* collator = (Collator*)c;
+    SharedCollator* shared = (SharedCollator*)cc->getCollator();
+    if (shared) {
+        Collator* collator = borrowCollator(shared);
         result = (int)(collator->compare(str1, str2));
+        returnCollator(shared, collator);
     } else {
         result = compareBinary(str1, str2);
     }
@@ -404,17 +600,164 @@ static double readNumber(const char* start, const char* end, char** endOfNumber)
     return result;
 }
 
+// Numbers with at most this many significant digits map to distinct doubles in the same order
+// as their exact decimal values, so comparing the decimal text gives the same answer as strtod.
+#define kMaxExactNumberDigits 15
+// Decimal magnitudes within this range can't overflow or underflow a double.
+#define kMaxExactNumberMagnitude 290
+
+// A JSON number scanned in place: the digits are never copied out of the JSON text.
+typedef struct {
+    bool negative;
+    const char* intDigits;      // Digits before the decimal point
+    int intLen;
+    const char* fracDigits;     // Digits after the decimal point (may be empty)
+    int fracLen;
+    bool hasExponent;
+    long exponent;
+    int sigStart;               // Index of first significant digit in (intDigits + fracDigits)
+    int sigCount;               // Number of significant digits (0 if the number is zero)
+    long magnitude;             // Value is 0.<significant digits> x 10^magnitude
+    const char* end;            // First character after the number
+} JSONNumber;
+
+static char numberDigitAt(const JSONNumber* num, int i) {
+    return i < num->intLen ? num->intDigits[i] : num->fracDigits[i - num->intLen];
+}
+
+// Scans a JSON number (-?digits(.digits)?([eE][+-]?digits)?) starting at str, without reading
+// past end. Returns false if the text isn't a well-formed number, or if its exponent is too
+// large to be handled exactly.
+static bool scanNumber(const char* str, const char* end, JSONNumber* num) {
+    num->negative = (str < end && *str == '-');
+    if (num->negative)
+        ++str;
+
+    num->intDigits = str;
+    while (str < end && *str >= '0' && *str <= '9')
+        ++str;
+    num->intLen = (int)(str - num->intDigits);
+    if (num->intLen == 0)
+        return false;
+
+    num->fracDigits = str;
+    num->fracLen = 0;
+    if (str < end && *str == '.') {
+        num->fracDigits = ++str;
+        while (str < end && *str >= '0' && *str <= '9')
+            ++str;
+        num->fracLen = (int)(str - num->fracDigits);
+        if (num->fracLen == 0)
+            return false;
+    }
+
+    num->hasExponent = false;
+    num->exponent = 0;
+    if (str < end && (*str == 'e' || *str == 'E')) {
+        num->hasExponent = true;
+        ++str;
+        bool negativeExponent = false;
+        if (str < end && (*str == '+' || *str == '-'))
+            negativeExponent = (*str++ == '-');
+        const char* expDigits = str;
+        while (str < end && *str >= '0' && *str <= '9') {
+            if (str - expDigits >= 6)
+                return false; // Absurd exponent; let strtod deal with it
+            num->exponent = 10 * num->exponent + (*str++ - '0');
+        }
+        if (str == expDigits)
+            return false;
+        if (negativeExponent)
+            num->exponent = -num->exponent;
+    }
+    num->end = str;
+
+    // Trim leading and trailing zeros to find the significant digits:
+    int total = num->intLen + num->fracLen;
+    int first = 0, last = total;
+    while (first < total && numberDigitAt(num, first) == '0')
+        ++first;
+    while (last > first && numberDigitAt(num, last - 1) == '0')
+        --last;
+    num->sigStart = first;
+    num->sigCount = last - first;
+    num->magnitude = num->intLen - first + num->exponent;
+    return true;
+}
+
+// Compares the absolute values of two non-zero scanned numbers.
+static int compareMagnitudes(const JSONNumber* n1, const JSONNumber* n2) {
+    if (n1->magnitude != n2->magnitude)
+        return n1->magnitude > n2->magnitude ? 1 : -1;
+    int count = n1->sigCount < n2->sigCount ? n1->sigCount : n2->sigCount;
+    for (int i = 0; i < count; ++i) {
+        int s = cmp(numberDigitAt(n1, n1->sigStart + i), numberDigitAt(n2, n2->sigStart + i));
+        if (s)
+            return s;
+    }
+    // Trailing zeros were trimmed, so the number with more significant digits is larger:
+    return cmp(n1->sigCount, n2->sigCount);
+}
+
+static bool isExactNumber(const JSONNumber* num) {
+    return num->sigCount <= kMaxExactNumberDigits
+        && num->magnitude <= kMaxExactNumberMagnitude
+        && num->magnitude >= -kMaxExactNumberMagnitude;
+}
+
+// Compares the JSON numbers at *in1 and *in2 directly on the JSON text, and advances both past
+// their numbers. Gives the same result as comparing the strtod values, but only calls strtod
+// when the numbers have too many digits to compare exactly, or are malformed.
+static int compareNumbers(const char** in1, const char* end1, const char** in2, const char* end2) {
+    JSONNumber n1, n2;
+    if (scanNumber(*in1, end1, &n1) && scanNumber(*in2, end2, &n2)) {
+        // Fast path for integers, which is what sequence and timestamp keys look like:
+        if (!n1.fracLen && !n2.fracLen && !n1.hasExponent && !n2.hasExponent
+                && n1.intLen <= kMaxExactNumberDigits && n2.intLen <= kMaxExactNumberDigits
+                && (n1.intLen == 1 || n1.intDigits[0] != '0')
+                && (n2.intLen == 1 || n2.intDigits[0] != '0')) {
+            *in1 = n1.end;
+            *in2 = n2.end;
+            bool zero1 = (n1.sigCount == 0), zero2 = (n2.sigCount == 0);
+            bool neg1 = n1.negative && !zero1, neg2 = n2.negative && !zero2;
+            if (neg1 != neg2)
+                return neg1 ? -1 : 1;
+            int result = cmp(n1.intLen, n2.intLen);
+            if (!result)
+                result = memcmp(n1.intDigits, n2.intDigits, n1.intLen);
+            result = result > 0 ? 1 : (result < 0 ? -1 : 0);
+            return neg1 ? -result : result;
+        }
+
+        if (isExactNumber(&n1) && isExactNumber(&n2)) {
+            *in1 = n1.end;
+            *in2 = n2.end;
+            // Zero is neither positive nor negative (so -0 == 0):
+            int sign1 = n1.sigCount == 0 ? 0 : (n1.negative ? -1 : 1);
+            int sign2 = n2.sigCount == 0 ? 0 : (n2.negative ? -1 : 1);
+            if (sign1 != sign2 || sign1 == 0)
+                return cmp(sign1, sign2);
+            int result = compareMagnitudes(&n1, &n2);
+            return sign1 < 0 ? -result : result;
+        }
+
+        // Too many digits to compare exactly; only strtod knows how these round:
+        end1 = n1.end;
+        end2 = n2.end;
+    }
+
+    char* next1, *next2;
+    int diff = dcmp(readNumber(*in1, end1, &next1), readNumber(*in2, end2, &next2));
+    *in1 = next1;
+    *in2 = next2;
+    return diff;
+}
+
 // SQLite collation function for JSON-formatted strings.
 // The "context" parameter should be one of the three collation mode constants below.
 // WARNING: This function *only* works on valid JSON with no whitespace.
 // If called on non-JSON strings it is quite likely to crash!
 static int collateJSON(void *context, int len1, const void * chars1, int len2, const void * chars2) {
-    static bool charPriorityMapInitialized = false;
-    if(!charPriorityMapInitialized){
-        initializeCharPriorityMap();
-        charPriorityMapInitialized = true;
-    }
-    
     CollatorContext *cc = (CollatorContext*)context;
     if (cc == NULL) {
         return 0;
@@ -425,6 +768,8 @@ static int collateJSON(void *context, int len1, const void * chars1, int len2, c
     
     const char* str1 = (const char*) chars1;
     const char* str2 = (const char*) chars2;
+    const char* end1 = str1 + len1;
+    const char* end2 = str2 + len2;
     do {
         // Get the types of the next token in each string:
         ValueType type1 = valueTypeOf(*str1);
@@ -450,19 +795,10 @@ static int collateJSON(void *context, int len1, const void * chars1, int len2, c
                     str2 += 5;
                     break;
                 case kNumber: {
-                    char* next1, *next2;
-                    int diff;
-                    if (depth == 0) {
-                        diff = dcmp( readNumber(str1, str1 + len1, &next1),
-                                    readNumber(str2, str2 + len2, &next2) );
-                    } else {
-                        diff = dcmp(strtod(str1, &next1), strtod(str2, &next2));
-                    }
+                    int diff = compareNumbers(&str1, end1, &str2, end2);
                     if (diff) {
                         return diff; // Numbers don't match
                     }
-                    str1 = next1;
-                    str2 = next2;
                     break;
                 }
                 case kString: {
@@ -514,29 +850,6 @@ static void collator_dtor(void* context) {
 #endif
 }
 
-#ifdef USE_ICU4C_UNICODE_COMPARE
-static Collator* createCollator(const char* locale) {
-    const char* localeStr = locale;
-    if (localeStr == NULL)
-        localeStr = DEFAULT_COLLATOR_LOCALE;
-    
-    UErrorCode status = U_ZERO_ERROR;
-    Collator* collator = Collator::createInstance(localeStr, status);
-    if (!U_SUCCESS(status)) {
-        LOGE(SQLITE_COLLATOR_TAG, "Failed to create ICU Collator (locale=%s, status=%d)",
-             localeStr, status);
-        localeStr = DEFAULT_COLLATOR_LOCALE;
-        LOGV(SQLITE_COLLATOR_TAG, "Create ICU Collator with locale= %s instead", localeStr);
-        collator = Collator::createInstance(localeStr, status);
-        if(!U_SUCCESS(status)) {
-            LOGE(SQLITE_COLLATOR_TAG, "Failed to create ICU Collator (locale=%s, status=%d)",
-                 localeStr, status);
-        }
-    }
-    return collator;
-}
-#endif
-
 static void registerCollator(sqlite3* db, const char* locale, const char* icuDataPath) {
 #ifdef USE_ICU4C_UNICODE_COMPARE
     const char* localeStr = locale;
@@ -544,20 +857,18 @@ static void registerCollator(sqlite3* db, const char* locale, const char* icuDat
         localeStr = DEFAULT_COLLATOR_LOCALE;
 
 #ifdef ANDROID
-    Collator* collator = NULL;
+    SharedCollator* collator = NULL;
     if (icuDataPath != NULL) {
         // NOTE: Dictionary file is NOT bundled with library. It is separated dictionary file.
-        // Set data path:
-        setenv("CBL_ICU_PREFIX", icuDataPath, 1);
-        // Create ICU Collator:
-        collator = createCollator(locale);
+        // Get ICU Collator, setting the data path if it's the first one:
+        collator = acquireCollator(localeStr, -1, icuDataPath);
     } else {
         LOGE(SQLITE_COLLATOR_TAG, "Failed to create ICU Collator, No ICU Data Path specified\n");
     }
 #else // Java
     // NOTE: Dictionary file is bundled with library
-    // Create ICU Collator:
-    Collator* collator = createCollator(locale);
+    // Get ICU Collator:
+    SharedCollator* collator = acquireCollator(localeStr, -1, NULL);
 #endif
 
     CollatorContext* context = NULL;
@@ -580,6 +891,29 @@ static void registerCollator(sqlite3* db, const char* locale, const char* icuDat
     context = new CollatorContext(sqlite_json_colator_ASCII, NULL);
     sqlite3_create_collation_v2(db, "JSON_ASCII", SQLITE_UTF8, context, collateJSON, (void(*)(void*))collator_dtor);
 #endif
+    register_json_canonical_functions(db);
+}
+
+// Registers "JSON_<locale>", a Unicode JSON collation for one specific locale and (optionally)
+// strength, so that a connection can collate in several languages at once.
+static int registerLocaleCollator(sqlite3* db, const char* locale, int strength, const char* icuDataPath) {
+#ifdef USE_ICU4C_UNICODE_COMPARE
+    SharedCollator* collator = acquireCollator(locale, strength, icuDataPath);
+    CollatorContext* context = new CollatorContext(sqlite_json_colator_Unicode, collator);
+#else
+    // Without ICU, strings are compared by java.text.Collator whatever the locale.
+    CollatorContext* context = new CollatorContext(sqlite_json_colator_Unicode, NULL);
+#endif
+    char* name = sqlite3_mprintf("JSON_%s", locale);
+    int err = sqlite3_create_collation_v2(db, name, SQLITE_UTF8, context, collateJSON, (void(*)(void*))collator_dtor);
+    sqlite3_free(name);
+    if (err != SQLITE_OK)
+        delete context; // Not released by SQLite on failure
+    return err;
+}
+
+void register_json_collators(sqlite3* db, const char* locale, const char* icuDataPath) {
+    registerCollator(db, locale, icuDataPath);
 }
 
 #ifndef USE_ICU4C_UNICODE_COMPARE
@@ -589,7 +923,18 @@ static jmethodID javaUnicodeCompareMethod;
 
 static int java_unicode_string_compare(const char *str1, const char *str2) {
     JNIEnv* env;
-    if (cachedJvm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK) {
+    bool attached = false;
+    jint status = cachedJvm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6);
+    if (status == JNI_EDETACHED) {
+        // A sorter worker thread, which SQLite starts and joins itself; attach it just for the call.
+#ifdef ANDROID
+        status = cachedJvm->AttachCurrentThread(&env, NULL);
+#else
+        status = cachedJvm->AttachCurrentThread(reinterpret_cast<void**>(&env), NULL);
+#endif
+        attached = status == JNI_OK;
+    }
+    if (status != JNI_OK) {
         LOGE(SQLITE_COLLATOR_TAG, "Cannot get JNI Environment from the cache JVM.");
         return 0;
     }
@@ -601,6 +946,8 @@ static int java_unicode_string_compare(const char *str1, const char *str2) {
     
     env->DeleteLocalRef(jstr1);
     env->DeleteLocalRef(jstr2);
+    if (attached)
+        cachedJvm->DetachCurrentThread();
     
     return result;
 }
@@ -663,6 +1010,42 @@ JNIEXPORT void JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_native
         env->ReleaseStringUTFChars(icuDataPath, icuDataPathStr);
 }
 
+JNIEXPORT void JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_nativeRegisterLocale
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jstring locale, jint strength, jstring icuDataPath) {
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    if (locale == NULL) {
+        throw_sqlite3_exception(env, "A locale is required");
+        return;
+    }
+    const char* localeStr = env->GetStringUTFChars(locale, NULL);
+
+    const char* icuDataPathStr = NULL;
+    if (icuDataPath != NULL)
+        icuDataPathStr = env->GetStringUTFChars(icuDataPath, NULL);
+
+    int err = registerLocaleCollator(connection->db, localeStr, strength, icuDataPathStr);
+
+    env->ReleaseStringUTFChars(locale, localeStr);
+    if (icuDataPath != NULL)
+        env->ReleaseStringUTFChars(icuDataPath, icuDataPathStr);
+    if (err != SQLITE_OK)
+        throw_sqlite3_exception(env, connection->db, "Could not register collation");
+}
+
+JNIEXPORT jboolean JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_nativeSetICUData
+(JNIEnv* env, jclass clazz, jstring path) {
+#ifdef USE_ICU4C_UNICODE_COMPARE
+    if (path == NULL)
+        return false;
+    const char* pathStr = env->GetStringUTFChars(path, NULL);
+    bool result = setICUDataFile(pathStr);
+    env->ReleaseStringUTFChars(path, pathStr);
+    return result;
+#else
+    return false;
+#endif
+}
+
 JNIEXPORT jint JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_nativeTestCollate
 (JNIEnv* env, jclass clazz, jint rule, jint len1, jstring string1, jint len2, jstring string2) {
     const char* cstring1 = env->GetStringUTFChars(string1, NULL);
@@ -679,7 +1062,7 @@ JNIEXPORT jint JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_native
         r = sqlite_json_colator_Unicode;
     
 #ifdef USE_ICU4C_UNICODE_COMPARE
-    Collator* c = createCollator(NULL);
+    SharedCollator* c = acquireCollator(NULL, -1, NULL);
     CollatorContext* cc = new CollatorContext(r, c);
 #else
     CollatorContext* cc = new CollatorContext(r, NULL);
@@ -711,7 +1094,7 @@ JNIEXPORT jint JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_native
         r = sqlite_json_colator_Unicode;
 
 #ifdef USE_ICU4C_UNICODE_COMPARE
-    Collator* c = createCollator(clocale);
+    SharedCollator* c = acquireCollator(clocale, -1, NULL);
     CollatorContext* cc = new CollatorContext(r, c);
 #else
     CollatorContext* cc = new CollatorContext(r, NULL);
@@ -741,3 +1124,42 @@ JNIEXPORT jchar JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_nativ
     env->ReleaseStringUTFChars(string, cstring);
     return result;
 }
+
+JNIEXPORT jint JNICALL Java_com_couchbase_lite_storage_SQLiteJsonCollator_nativeCanonicalize
+(JNIEnv* env, jclass clazz, jobject input, jint offset, jint length, jobject output, jint outputOffset,
+ jint options) {
+    const char* in = static_cast<const char*>(env->GetDirectBufferAddress(input));
+    jlong inCapacity = env->GetDirectBufferCapacity(input);
+    char* out = static_cast<char*>(env->GetDirectBufferAddress(output));
+    jlong outCapacity = env->GetDirectBufferCapacity(output);
+    if (!in || inCapacity < 0 || !out || outCapacity < 0) {
+        throw_sqlite3_exception(env, "ByteBuffer is not direct");
+        return 0;
+    }
+    if (offset < 0 || length < 0 || offset > inCapacity - length
+            || outputOffset < 0 || outputOffset > outCapacity) {
+        throw_sqlite3_exception(env, "Offset and length are outside the ByteBuffer");
+        return 0;
+    }
+
+    std::string canonical;
+    size_t errorOffset = 0;
+    const char* error = canonicalize_json(in + offset, length, options, &canonical, &errorOffset);
+    if (error) {
+        char* message = sqlite3_mprintf("Invalid JSON: %s at offset %lld", error,
+                                        (sqlite3_int64)errorOffset);
+        throw_sqlite3_exception(env, message);
+        sqlite3_free(message);
+        return 0;
+    }
+    if (canonical.size() > 0x7FFFFFFF) {
+        throw_sqlite3_exception_errcode(env, SQLITE_TOOBIG, "Canonical JSON is too large");
+        return 0;
+    }
+    // Nothing is written if it doesn't fit; the caller retries with a buffer of the size returned.
+    jint size = (jint)canonical.size();
+    if (size > outCapacity - outputOffset)
+        return -size;
+    memcpy(out + outputOffset, canonical.data(), size);
+    return size;
+}
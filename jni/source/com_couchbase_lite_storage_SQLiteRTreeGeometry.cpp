@@ -0,0 +1,255 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  R*Tree query functions for geo queries, on a 2-dimensional R*Tree with longitude as the
+//  first dimension and latitude as the second:
+//
+//    CREATE VIRTUAL TABLE bboxes USING rtree(id, x0, x1, y0, y1)
+//
+//    SELECT id FROM bboxes WHERE id MATCH within_radius(lon, lat, meters)
+//    SELECT id FROM bboxes WHERE id MATCH within_polygon(lon1, lat1, lon2, lat2, lon3, lat3, ...)
+//
+//  Both prune whole index nodes that cannot contain a match, so SQLite never visits their
+//  entries. within_radius measures great-circle distance and handles circles that cross the
+//  antimeridian or contain a pole; an entry with an area matches if the point of its box nearest
+//  to the center (per axis) is within the radius. within_polygon treats coordinates as planar
+//  and the polygon must not cross the antimeridian; an entry matches if its box overlaps the
+//  polygon.
+//
+
+#include <math.h>
+
+#include "sqlite3.h"
+
+#include "sqlite_connection.h"
+#include "sqlite_common.h"
+#include "com_couchbase_lite_storage_SQLiteRTreeGeometry.h"
+
+#ifdef SQLITE_ENABLE_RTREE
+
+static const double kEarthRadiusMeters = 6371008.8;
+static const double kDegreesToRadians = 3.14159265358979323846 / 180.0;
+
+// Entry or node coordinates, in the column order of the R*Tree.
+enum {
+    MIN_LON = 0,
+    MAX_LON,
+    MIN_LAT,
+    MAX_LAT
+};
+
+static bool lonRangesOverlap(double min1, double max1, double min2, double max2) {
+    // The second range may extend past +/-180 when it crosses the antimeridian.
+    for (int shift = -360; shift <= 360; shift += 360) {
+        if (min1 + shift <= max2 && max1 + shift >= min2)
+            return true;
+    }
+    return false;
+}
+
+static double lonDistance(double lon1, double lon2) {
+    return fabs(remainder(lon1 - lon2, 360.0));
+}
+
+static double haversineMeters(double lat1, double lon1, double lat2, double lon2) {
+    double sinDLat = sin((lat2 - lat1) * kDegreesToRadians / 2);
+    double sinDLon = sin((lon2 - lon1) * kDegreesToRadians / 2);
+    double a = sinDLat * sinDLat +
+               cos(lat1 * kDegreesToRadians) * cos(lat2 * kDegreesToRadians) * sinDLon * sinDLon;
+    return 2 * kEarthRadiusMeters * asin(fmin(1.0, sqrt(a)));
+}
+
+/**
+ * <within_radius>
+ */
+
+struct RadiusQuery {
+    double lon, lat, meters;
+    double minLon, maxLon, minLat, maxLat; // Bounding box of the circle
+};
+
+static RadiusQuery* newRadiusQuery(const sqlite3_rtree_dbl* param) {
+    RadiusQuery* query = (RadiusQuery*)sqlite3_malloc(sizeof(RadiusQuery));
+    if (!query)
+        return NULL;
+    query->lon = param[0];
+    query->lat = param[1];
+    query->meters = param[2];
+
+    double angle = query->meters / kEarthRadiusMeters;
+    double dLat = angle / kDegreesToRadians;
+    query->minLat = query->lat - dLat;
+    query->maxLat = query->lat + dLat;
+    query->minLon = -180;
+    query->maxLon = 180;
+    if (query->minLat > -90 && query->maxLat < 90) {
+        // Neither pole is in the circle, so its longitude extent is where the meridians are
+        // tangent to it.
+        double sinDLon = sin(angle) / cos(query->lat * kDegreesToRadians);
+        if (sinDLon < 1) {
+            double dLon = asin(sinDLon) / kDegreesToRadians;
+            query->minLon = query->lon - dLon;
+            query->maxLon = query->lon + dLon;
+        }
+    }
+    return query;
+}
+
+static int withinRadius(sqlite3_rtree_query_info* info) {
+    if (info->nParam != 3 || info->nCoord != 4)
+        return SQLITE_ERROR;
+    RadiusQuery* query = (RadiusQuery*)info->pUser;
+    if (!query) {
+        query = newRadiusQuery(info->aParam);
+        if (!query)
+            return SQLITE_NOMEM;
+        info->pUser = query;
+        info->xDelUser = sqlite3_free;
+    }
+
+    const sqlite3_rtree_dbl* box = info->aCoord;
+    info->rScore = info->iLevel;
+    if (box[MIN_LAT] > query->maxLat || box[MAX_LAT] < query->minLat ||
+        !lonRangesOverlap(box[MIN_LON], box[MAX_LON], query->minLon, query->maxLon)) {
+        info->eWithin = NOT_WITHIN;
+        return SQLITE_OK;
+    }
+    if (info->iLevel > 0) {
+        // An index node overlapping the circle's bounding box; its entries are checked later.
+        info->eWithin = PARTLY_WITHIN;
+        return SQLITE_OK;
+    }
+
+    double lat = fmax(box[MIN_LAT], fmin(box[MAX_LAT], query->lat));
+    double lon = query->lon;
+    if (!lonRangesOverlap(box[MIN_LON], box[MAX_LON], lon, lon)) {
+        lon = lonDistance(box[MIN_LON], lon) < lonDistance(box[MAX_LON], lon)
+                  ? box[MIN_LON] : box[MAX_LON];
+    }
+    bool inside = haversineMeters(query->lat, query->lon, lat, lon) <= query->meters;
+    info->eWithin = inside ? FULLY_WITHIN : NOT_WITHIN;
+    return SQLITE_OK;
+}
+
+/**
+ * </within_radius>
+ */
+
+/**
+ * <within_polygon>
+ */
+
+struct PolygonQuery {
+    double minLon, maxLon, minLat, maxLat; // Bounding box of the polygon
+};
+
+static bool pointInPolygon(const sqlite3_rtree_dbl* vertex, int count, double x, double y) {
+    bool inside = false;
+    for (int i = 0, j = count - 1; i < count; j = i++) {
+        double xi = vertex[2 * i], yi = vertex[2 * i + 1];
+        double xj = vertex[2 * j], yj = vertex[2 * j + 1];
+        if ((yi > y) != (yj > y) && x < (xj - xi) * (y - yi) / (yj - yi) + xi)
+            inside = !inside;
+    }
+    return inside;
+}
+
+// Liang-Barsky clipping: does the segment from (x0,y0) to (x1,y1) touch the box?
+static bool segmentHitsBox(double x0, double y0, double x1, double y1,
+                           const sqlite3_rtree_dbl* box) {
+    double dx = x1 - x0, dy = y1 - y0;
+    double p[4] = {-dx, dx, -dy, dy};
+    double q[4] = {x0 - box[MIN_LON], box[MAX_LON] - x0, y0 - box[MIN_LAT], box[MAX_LAT] - y0};
+    double t0 = 0, t1 = 1;
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0) {
+            if (q[i] < 0)
+                return false;
+        } else {
+            double t = q[i] / p[i];
+            if (p[i] < 0)
+                t0 = fmax(t0, t);
+            else
+                t1 = fmin(t1, t);
+            if (t0 > t1)
+                return false;
+        }
+    }
+    return true;
+}
+
+static int withinPolygon(sqlite3_rtree_query_info* info) {
+    if (info->nParam < 6 || info->nParam % 2 != 0 || info->nCoord != 4)
+        return SQLITE_ERROR;
+    if (info->eParentWithin == FULLY_WITHIN) {
+        info->eWithin = FULLY_WITHIN;
+        return SQLITE_OK;
+    }
+    const sqlite3_rtree_dbl* vertex = info->aParam;
+    int count = info->nParam / 2;
+    PolygonQuery* query = (PolygonQuery*)info->pUser;
+    if (!query) {
+        query = (PolygonQuery*)sqlite3_malloc(sizeof(PolygonQuery));
+        if (!query)
+            return SQLITE_NOMEM;
+        query->minLon = query->maxLon = vertex[0];
+        query->minLat = query->maxLat = vertex[1];
+        for (int i = 1; i < count; i++) {
+            query->minLon = fmin(query->minLon, vertex[2 * i]);
+            query->maxLon = fmax(query->maxLon, vertex[2 * i]);
+            query->minLat = fmin(query->minLat, vertex[2 * i + 1]);
+            query->maxLat = fmax(query->maxLat, vertex[2 * i + 1]);
+        }
+        info->pUser = query;
+        info->xDelUser = sqlite3_free;
+    }
+
+    const sqlite3_rtree_dbl* box = info->aCoord;
+    info->rScore = info->iLevel;
+    if (box[MIN_LON] > query->maxLon || box[MAX_LON] < query->minLon ||
+        box[MIN_LAT] > query->maxLat || box[MAX_LAT] < query->minLat) {
+        info->eWithin = NOT_WITHIN;
+        return SQLITE_OK;
+    }
+    for (int i = 0, j = count - 1; i < count; j = i++) {
+        if (segmentHitsBox(vertex[2 * j], vertex[2 * j + 1], vertex[2 * i], vertex[2 * i + 1],
+                           box)) {
+            info->eWithin = PARTLY_WITHIN;
+            return SQLITE_OK;
+        }
+    }
+    // No edge crosses the box, so it is either wholly inside the polygon or wholly outside.
+    bool inside = pointInPolygon(vertex, count, box[MIN_LON], box[MIN_LAT]);
+    info->eWithin = inside ? FULLY_WITHIN : NOT_WITHIN;
+    return SQLITE_OK;
+}
+
+/**
+ * </within_polygon>
+ */
+
+#endif // SQLITE_ENABLE_RTREE
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_storage_SQLiteRTreeGeometry_nativeRegister
+(JNIEnv* env, jclass clazz, jlong connectionPtr) {
+#ifdef SQLITE_ENABLE_RTREE
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    int err = sqlite3_rtree_query_callback(connection->db, "within_radius", withinRadius,
+                                           NULL, NULL);
+    if (err == SQLITE_OK)
+        err = sqlite3_rtree_query_callback(connection->db, "within_polygon", withinPolygon,
+                                           NULL, NULL);
+    if (err != SQLITE_OK)
+        throw_sqlite3_exception(env, connection->db, "Could not register R*Tree geometry functions");
+#else
+    throw_sqlite3_exception(env, "R*Tree is not available in this build");
+#endif
+}
@@ -18,6 +18,7 @@
 #include <ctype.h>
 
 #include "sqlite_connection.h"
+#include "sqlite_collators.h"
 #include "com_couchbase_lite_storage_SQLiteRevCollator.h"
 
 #ifdef _MSC_VER
@@ -101,14 +102,239 @@ static int collateRevIDs(void *context, int len1, const void * r1, int len2, con
                                             dash2+1, len2-(int)(dash2+1-rev2));
 }
 
+/*
+ * Packed revision IDs.
+ *
+ * revid_encode() packs a textual revision ID ("<gen>-<hex digest>") into a blob whose memcmp
+ * (BINARY) ordering is the same as the REVID collation of the original text:
+ *
+ *   [n] [generation: n bytes, big-endian, no leading zero bytes] [digest: raw bytes]
+ *
+ * The generation is length-prefixed, so a shorter encoding is always a smaller generation.
+ * Lowercase hex sorts the same way as the bytes it encodes, so comparing the raw digest bytes
+ * matches comparing the hex suffixes. The blob is about half the size of the text.
+ *
+ * Only revision IDs that round-trip exactly can be encoded: a generation of 1 to 8 digits with
+ * no leading zeros, and an even-length lowercase hex digest. Anything else encodes to NULL.
+ */
+
+#ifndef SQLITE_DETERMINISTIC
+#define SQLITE_DETERMINISTIC 0 // Older SQLite (e.g. some SQLCipher builds)
+#endif
+
+#define kMaxGenerationDigits 8
+#define kMaxGenerationBytes 4
+
+static int hexDigitValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return 10 + c - 'a';
+    return -1;
+}
+
+// Returns the number of bytes written to out (which must have room for 1 + 4 + len/2 bytes),
+// or -1 if the revision ID can't be encoded.
+static int encodeRevID(const char* rev, int len, unsigned char* out) {
+    const char* dash = (const char*)memchr(rev, '-', len);
+    if (dash == NULL || dash == rev || dash > rev + kMaxGenerationDigits || *rev == '0')
+        return -1;
+    unsigned int gen = 0;
+    for (const char* c = rev; c < dash; ++c) {
+        if (!isdigit(*c))
+            return -1;
+        gen = 10*gen + (*c - '0');
+    }
+
+    const char* digest = dash + 1;
+    int digestLen = len - (int)(digest - rev);
+    if (digestLen % 2)
+        return -1;
+
+    int genBytes = 1;
+    while (genBytes < kMaxGenerationBytes && (gen >> (8 * genBytes)) != 0)
+        ++genBytes;
+    unsigned char* dst = out;
+    *dst++ = (unsigned char)genBytes;
+    for (int i = genBytes - 1; i >= 0; --i)
+        *dst++ = (unsigned char)(gen >> (8 * i));
+
+    for (int i = 0; i < digestLen; i += 2) {
+        int hi = hexDigitValue(digest[i]), lo = hexDigitValue(digest[i + 1]);
+        if (hi < 0 || lo < 0)
+            return -1;
+        *dst++ = (unsigned char)((hi << 4) | lo);
+    }
+    return (int)(dst - out);
+}
+
+// Returns the length of the revision ID written to out (which must have room for 9 + 2*len
+// characters plus a terminating null), or -1 if the blob isn't a packed revision ID.
+static int decodeRevID(const unsigned char* blob, int len, char* out) {
+    if (len < 1)
+        return -1;
+    int genBytes = blob[0];
+    if (genBytes < 1 || genBytes > kMaxGenerationBytes || len < 1 + genBytes || blob[1] == 0)
+        return -1;
+    unsigned int gen = 0;
+    for (int i = 1; i <= genBytes; ++i)
+        gen = (gen << 8) | blob[i];
+    if (gen > 99999999)
+        return -1;
+
+    static const char* const kHexDigits = "0123456789abcdef";
+    char* dst = out + sprintf(out, "%u-", gen);
+    for (int i = 1 + genBytes; i < len; ++i) {
+        *dst++ = kHexDigits[blob[i] >> 4];
+        *dst++ = kHexDigits[blob[i] & 0x0F];
+    }
+    *dst = '\0';
+    return (int)(dst - out);
+}
+
+// SQL function revid_encode(revID): returns the packed blob form, or NULL.
+static void revidEncodeFunc(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+        return; // NULL result
+    const char* rev = (const char*)sqlite3_value_text(argv[0]);
+    int len = sqlite3_value_bytes(argv[0]);
+    unsigned char* out = (unsigned char*)sqlite3_malloc(1 + kMaxGenerationBytes + len / 2);
+    if (!out) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    int outLen = encodeRevID(rev, len, out);
+    if (outLen < 0) {
+        sqlite3_free(out);
+        return; // NULL result
+    }
+    sqlite3_result_blob(context, out, outLen, sqlite3_free);
+}
+
+// SQL function revid_decode(blob): returns the textual revision ID, or NULL.
+static void revidDecodeFunc(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) != SQLITE_BLOB)
+        return; // NULL result
+    const unsigned char* blob = (const unsigned char*)sqlite3_value_blob(argv[0]);
+    int len = sqlite3_value_bytes(argv[0]);
+    char* out = (char*)sqlite3_malloc(kMaxGenerationDigits + 2 + 2 * len);
+    if (!out) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    int outLen = decodeRevID(blob, len, out);
+    if (outLen < 0) {
+        sqlite3_free(out);
+        return; // NULL result
+    }
+    sqlite3_result_text(context, out, outLen, sqlite3_free);
+}
+
+// SQL function revid_generation(revID): returns the generation number, or NULL if the
+// revision ID doesn't start with one.
+static void revidGenerationFunc(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+        return; // NULL result
+    const char* rev = (const char*)sqlite3_value_text(argv[0]);
+    int len = sqlite3_value_bytes(argv[0]);
+    const char* dash = (const char*)memchr(rev, '-', len);
+    if (dash == NULL || dash == rev || dash > rev + 18)
+        return; // NULL result
+    sqlite3_int64 gen = 0;
+    for (const char* c = rev; c < dash; ++c) {
+        if (!isdigit(*c))
+            return; // NULL result
+        gen = 10*gen + (*c - '0');
+    }
+    sqlite3_result_int64(context, gen);
+}
+
+/*
+ * Aggregates revid_max(revID) and winning_rev(revID, deleted).
+ *
+ * revid_max picks the highest revision ID according to the REVID collation. winning_rev picks
+ * the winning revision the way Couchbase Lite does: a live revision beats a deleted one, and
+ * otherwise the highest revision ID (generation, then digest) wins. Called with the leaf
+ * revisions of each document in a GROUP BY, it computes the current revisions in one query.
+ */
+
+typedef struct {
+    char* revID;        // sqlite3_malloc'd copy of the winner so far, or NULL
+    int len;
+    int deleted;
+} WinningRevContext;
+
+static void winningRevStepWith(sqlite3_context* context, sqlite3_value* value, int deleted) {
+    if (sqlite3_value_type(value) == SQLITE_NULL)
+        return;
+    WinningRevContext* win =
+        (WinningRevContext*)sqlite3_aggregate_context(context, sizeof(WinningRevContext));
+    if (!win) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+
+    const char* rev = (const char*)sqlite3_value_text(value);
+    int len = sqlite3_value_bytes(value);
+    if (win->revID) {
+        if (deleted > win->deleted)
+            return;
+        if (deleted == win->deleted && collateRevIDs(NULL, len, rev, win->len, win->revID) <= 0)
+            return;
+    }
+
+    char* copy = (char*)sqlite3_realloc(win->revID, len + 1);
+    if (!copy) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    memcpy(copy, rev, len);
+    copy[len] = '\0';
+    win->revID = copy;
+    win->len = len;
+    win->deleted = deleted;
+}
+
+static void revidMaxStep(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    winningRevStepWith(context, argv[0], 0);
+}
+
+static void winningRevStep(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    winningRevStepWith(context, argv[0], sqlite3_value_int(argv[1]) != 0);
+}
+
+static void winningRevFinal(sqlite3_context* context) {
+    WinningRevContext* win = (WinningRevContext*)sqlite3_aggregate_context(context, 0);
+    if (win && win->revID)
+        sqlite3_result_text(context, win->revID, win->len, sqlite3_free); // takes ownership
+}
+
 static void registerCollator(sqlite3 * db) {
     sqlite3_create_collation(db, "REVID", SQLITE_UTF8, NULL, collateRevIDs);
 }
 
+static void registerFunctions(sqlite3 * db) {
+    sqlite3_create_function(db, "revid_encode", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+                            revidEncodeFunc, NULL, NULL);
+    sqlite3_create_function(db, "revid_decode", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+                            revidDecodeFunc, NULL, NULL);
+    sqlite3_create_function(db, "revid_generation", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+                            revidGenerationFunc, NULL, NULL);
+    sqlite3_create_function(db, "revid_max", 1, SQLITE_UTF8, NULL,
+                            NULL, revidMaxStep, winningRevFinal);
+    sqlite3_create_function(db, "winning_rev", 2, SQLITE_UTF8, NULL,
+                            NULL, winningRevStep, winningRevFinal);
+}
+
+void register_revid_collator(sqlite3* db) {
+    registerCollator(db);
+    registerFunctions(db);
+}
+
 JNIEXPORT void JNICALL Java_com_couchbase_lite_storage_SQLiteRevCollator_nativeRegister
 (JNIEnv* env, jclass clazz, jlong connectionPtr) {
     SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
-    registerCollator(connection->db);
+    register_revid_collator(connection->db);
 }
 
 JNIEXPORT jint JNICALL Java_com_couchbase_lite_storage_SQLiteRevCollator_nativeTestCollate
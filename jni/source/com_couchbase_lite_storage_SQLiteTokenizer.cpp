@@ -0,0 +1,411 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  FTS3/FTS4 tokenizer based on ICU. Usage, once registered as (say) "cbl":
+//
+//    CREATE VIRTUAL TABLE docs USING fts4(body, tokenize=cbl [locale] [stem] [remove_diacritics=0])
+//
+//  Words are found with ICU's word break iterator when the ICU build and data support it, and
+//  otherwise as runs of letters and digits, with each Han and Kana character a word of its own
+//  (so CJK text is searchable by character rather than lumped into one "word" per sentence).
+//  Tokens are case folded and (unless remove_diacritics=0) stripped of diacritics; "stem"
+//  applies the English S-stemmer (plurals to singulars).
+//
+
+#include <string.h>
+#include <vector>
+
+#include "sqlite3.h"
+
+#include "sqlite_connection.h"
+#include "sqlite_common.h"
+#include "fts3_tokenizer.h"
+#include "com_couchbase_lite_storage_SQLiteTokenizer.h"
+
+#ifdef USE_ICU4C_UNICODE_COMPARE
+
+#include <unicode/uchar.h>
+#include <unicode/uloc.h>
+#include <unicode/unorm2.h>
+#include <unicode/uscript.h>
+#include <unicode/ustring.h>
+#include <unicode/utf8.h>
+#include <unicode/utf16.h>
+
+// The vendored ICU libraries are built for collation only, without break iteration; define
+// USE_ICU4C_BREAK_ITERATOR when linking a full ICU to get dictionary-based word breaking.
+#if defined(USE_ICU4C_BREAK_ITERATOR) && !UCONFIG_NO_BREAK_ITERATION
+#define ICU_TOKENIZER_BREAK_ITERATOR 1
+#include <unicode/ubrk.h>
+#endif
+
+/**
+ * <ICUTokenizer>
+ */
+
+struct ICUTokenizerCursor;
+
+struct ICUTokenizer {
+    sqlite3_tokenizer base;
+    char locale[ULOC_FULLNAME_CAPACITY];
+    bool stem;
+    bool removeDiacritics;
+    const UNormalizer2* nfd;
+    ICUTokenizerCursor* spareCursor; // Kept for the next document, to reuse its buffers
+};
+
+struct ICUTokenizerCursor {
+    sqlite3_tokenizer_cursor base;
+#ifdef ICU_TOKENIZER_BREAK_ITERATOR
+    UBreakIterator* breakIterator;   // NULL if ICU has no word break data
+#endif
+    std::vector<UChar> text;         // The document, as UTF-16
+    std::vector<int> offsets;        // UTF-8 byte offset of each UTF-16 unit of text
+    int length;                      // Length of text
+    int start;                       // Where the next word is looked for
+    int position;                    // Number of tokens returned so far
+    std::vector<UChar> folded;       // Scratch buffers for the current token:
+    std::vector<UChar> normalized;
+    std::vector<char> token;
+};
+
+template <typename T>
+static T* reserve(std::vector<T>& buffer, size_t size) {
+    if (buffer.size() < size)
+        buffer.resize(size);
+    return &buffer[0];
+}
+
+static bool isIdeographic(UChar32 c) {
+    UErrorCode status = U_ZERO_ERROR;
+    UScriptCode script = uscript_getScript(c, &status);
+    return script == USCRIPT_HAN || script == USCRIPT_HIRAGANA || script == USCRIPT_KATAKANA;
+}
+
+static bool isWordChar(UChar32 c) {
+    return u_isalnum(c) || u_charType(c) == U_NON_SPACING_MARK;
+}
+
+// Finds the next word as a run of letters, digits and combining marks; each ideographic
+// character is a word by itself. Used when ICU can't do word breaking.
+static bool nextWordFallback(ICUTokenizerCursor* cursor, int* wordStart, int* wordEnd) {
+    const UChar* text = cursor->text.empty() ? NULL : &cursor->text[0];
+    int i = cursor->start;
+    while (i < cursor->length) {
+        int begin = i;
+        UChar32 c;
+        U16_NEXT(text, i, cursor->length, c);
+        if (!isWordChar(c))
+            continue;
+        if (!isIdeographic(c)) {
+            while (i < cursor->length) {
+                int next = i;
+                U16_NEXT(text, next, cursor->length, c);
+                if (!isWordChar(c) || isIdeographic(c))
+                    break;
+                i = next;
+            }
+        }
+        *wordStart = begin;
+        *wordEnd = i;
+        cursor->start = i;
+        return true;
+    }
+    cursor->start = cursor->length;
+    return false;
+}
+
+static bool nextWord(ICUTokenizerCursor* cursor, int* wordStart, int* wordEnd) {
+#ifdef ICU_TOKENIZER_BREAK_ITERATOR
+    if (cursor->breakIterator) {
+        for (;;) {
+            int end = ubrk_following(cursor->breakIterator, cursor->start);
+            if (end == UBRK_DONE)
+                return false;
+            int begin = cursor->start;
+            cursor->start = end;
+            // Skip spaces and punctuation:
+            if (ubrk_getRuleStatus(cursor->breakIterator) >= UBRK_WORD_NONE_LIMIT) {
+                *wordStart = begin;
+                *wordEnd = end;
+                return true;
+            }
+        }
+    }
+#endif
+    return nextWordFallback(cursor, wordStart, wordEnd);
+}
+
+static bool endsWith(const UChar* str, int len, const char* suffix) {
+    int suffixLen = (int)strlen(suffix);
+    if (len < suffixLen)
+        return false;
+    for (int i = 0; i < suffixLen; i++) {
+        if (str[len - suffixLen + i] != (UChar)suffix[i])
+            return false;
+    }
+    return true;
+}
+
+// Harman's S-stemmer: "ies" -> "y", "es" -> "e", "s" -> "", with the usual exceptions.
+static int stemS(UChar* str, int len) {
+    if (len < 3 || str[len - 1] != 's')
+        return len;
+    if (endsWith(str, len, "ies") && !endsWith(str, len, "eies") && !endsWith(str, len, "aies")) {
+        str[len - 3] = 'y';
+        return len - 2;
+    }
+    if (endsWith(str, len, "es") && !endsWith(str, len, "aes") && !endsWith(str, len, "ees")
+            && !endsWith(str, len, "oes"))
+        return len - 1;
+    if (!endsWith(str, len, "us") && !endsWith(str, len, "ss"))
+        return len - 1;
+    return len;
+}
+
+// Case folds, strips and stems the word, leaving it as UTF-8 in cursor->token.
+// Returns the length of the token, 0 if nothing is left of the word, or -1 on error.
+static int normalizeWord(ICUTokenizer* tokenizer, ICUTokenizerCursor* cursor, int wordStart, int wordEnd) {
+    const UChar* word = &cursor->text[wordStart];
+    int wordLen = wordEnd - wordStart;
+
+    // Case folding expands a character to at most 3:
+    UErrorCode status = U_ZERO_ERROR;
+    UChar* folded = reserve(cursor->folded, wordLen * 3);
+    int len = u_strFoldCase(folded, wordLen * 3, word, wordLen, U_FOLD_CASE_DEFAULT, &status);
+    if (U_FAILURE(status))
+        return -1;
+
+    if (tokenizer->removeDiacritics && tokenizer->nfd) {
+        int capacity = len * 4;
+        for (;;) {
+            UChar* normalized = reserve(cursor->normalized, capacity);
+            status = U_ZERO_ERROR;
+            int normalizedLen = unorm2_normalize(tokenizer->nfd, folded, len, normalized, capacity, &status);
+            if (status == U_BUFFER_OVERFLOW_ERROR) {
+                capacity = normalizedLen;
+                continue;
+            }
+            if (U_FAILURE(status))
+                return -1;
+            // Drop the combining marks that decomposition split off:
+            folded = normalized;
+            len = 0;
+            for (int i = 0; i < normalizedLen; ) {
+                int begin = i;
+                UChar32 c;
+                U16_NEXT(normalized, i, normalizedLen, c);
+                if (u_charType(c) != U_NON_SPACING_MARK) {
+                    while (begin < i)
+                        folded[len++] = normalized[begin++];
+                }
+            }
+            break;
+        }
+    }
+
+    if (tokenizer->stem)
+        len = stemS(folded, len);
+    if (len == 0)
+        return 0;
+
+    // A UTF-16 unit converts to at most 3 bytes of UTF-8:
+    int32_t tokenLen = 0;
+    status = U_ZERO_ERROR;
+    u_strToUTF8(reserve(cursor->token, len * 3), len * 3, &tokenLen, folded, len, &status);
+    if (U_FAILURE(status))
+        return -1;
+    return tokenLen;
+}
+
+static int icuTokenizerCreate(int argc, const char* const* argv, sqlite3_tokenizer** ppTokenizer) {
+    ICUTokenizer* tokenizer = new ICUTokenizer();
+    strcpy(tokenizer->locale, "");
+    tokenizer->stem = false;
+    tokenizer->removeDiacritics = true;
+    tokenizer->spareCursor = NULL;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "stem") == 0)
+            tokenizer->stem = true;
+        else if (strcmp(argv[i], "remove_diacritics=0") == 0)
+            tokenizer->removeDiacritics = false;
+        else if (strcmp(argv[i], "remove_diacritics=1") == 0)
+            tokenizer->removeDiacritics = true;
+        else if (strlen(argv[i]) < sizeof(tokenizer->locale))
+            strcpy(tokenizer->locale, argv[i]);
+        else {
+            delete tokenizer;
+            return SQLITE_ERROR;
+        }
+    }
+
+    UErrorCode status = U_ZERO_ERROR;
+    tokenizer->nfd = unorm2_getNFDInstance(&status);
+    if (U_FAILURE(status)) {
+        LOGE(SQLITE_LOG_TAG, "ICU tokenizer can't remove diacritics (status=%d)", status);
+        tokenizer->nfd = NULL;
+    }
+
+    *ppTokenizer = &tokenizer->base;
+    return SQLITE_OK;
+}
+
+static void freeCursor(ICUTokenizerCursor* cursor) {
+#ifdef ICU_TOKENIZER_BREAK_ITERATOR
+    if (cursor->breakIterator)
+        ubrk_close(cursor->breakIterator);
+#endif
+    delete cursor;
+}
+
+static int icuTokenizerDestroy(sqlite3_tokenizer* pTokenizer) {
+    ICUTokenizer* tokenizer = (ICUTokenizer*)pTokenizer;
+    if (tokenizer->spareCursor)
+        freeCursor(tokenizer->spareCursor);
+    delete tokenizer;
+    return SQLITE_OK;
+}
+
+static int icuTokenizerOpen(sqlite3_tokenizer* pTokenizer, const char* input, int nBytes,
+                            sqlite3_tokenizer_cursor** ppCursor) {
+    ICUTokenizer* tokenizer = (ICUTokenizer*)pTokenizer;
+    if (input == NULL)
+        nBytes = 0;
+    else if (nBytes < 0)
+        nBytes = (int)strlen(input);
+
+    ICUTokenizerCursor* cursor = tokenizer->spareCursor;
+    if (cursor) {
+        tokenizer->spareCursor = NULL;
+    } else {
+        cursor = new ICUTokenizerCursor();
+#ifdef ICU_TOKENIZER_BREAK_ITERATOR
+        UErrorCode status = U_ZERO_ERROR;
+        cursor->breakIterator = ubrk_open(UBRK_WORD, tokenizer->locale, NULL, 0, &status);
+        if (U_FAILURE(status))
+            cursor->breakIterator = NULL; // No break iteration data; fall back
+#endif
+    }
+
+    // Convert to UTF-16, remembering where each unit came from so that offsets can be reported
+    // in bytes of the input. Malformed UTF-8 becomes U+FFFD.
+    UChar* text = reserve(cursor->text, nBytes + 1);
+    int* offsets = reserve(cursor->offsets, nBytes + 1);
+    int length = 0;
+    for (int i = 0; i < nBytes; ) {
+        int begin = i;
+        UChar32 c;
+        U8_NEXT(input, i, nBytes, c);
+        if (c < 0)
+            c = 0xFFFD;
+        offsets[length] = begin;
+        if (U_IS_BMP(c)) {
+            text[length++] = (UChar)c;
+        } else {
+            offsets[length + 1] = begin;
+            text[length++] = U16_LEAD(c);
+            text[length++] = U16_TRAIL(c);
+        }
+    }
+    offsets[length] = nBytes;
+    cursor->length = length;
+    cursor->start = 0;
+    cursor->position = 0;
+
+#ifdef ICU_TOKENIZER_BREAK_ITERATOR
+    if (cursor->breakIterator) {
+        UErrorCode status = U_ZERO_ERROR;
+        ubrk_setText(cursor->breakIterator, text, length, &status);
+        if (U_FAILURE(status)) {
+            freeCursor(cursor);
+            return SQLITE_ERROR;
+        }
+    }
+#endif
+
+    *ppCursor = &cursor->base;
+    return SQLITE_OK;
+}
+
+static int icuTokenizerClose(sqlite3_tokenizer_cursor* pCursor) {
+    ICUTokenizerCursor* cursor = (ICUTokenizerCursor*)pCursor;
+    ICUTokenizer* tokenizer = (ICUTokenizer*)pCursor->pTokenizer;
+    if (tokenizer->spareCursor == NULL)
+        tokenizer->spareCursor = cursor;
+    else
+        freeCursor(cursor);
+    return SQLITE_OK;
+}
+
+static int icuTokenizerNext(sqlite3_tokenizer_cursor* pCursor, const char** ppToken, int* pnBytes,
+                            int* piStartOffset, int* piEndOffset, int* piPosition) {
+    ICUTokenizerCursor* cursor = (ICUTokenizerCursor*)pCursor;
+    ICUTokenizer* tokenizer = (ICUTokenizer*)pCursor->pTokenizer;
+    int wordStart, wordEnd;
+    while (nextWord(cursor, &wordStart, &wordEnd)) {
+        int tokenLen = normalizeWord(tokenizer, cursor, wordStart, wordEnd);
+        if (tokenLen < 0)
+            return SQLITE_ERROR;
+        if (tokenLen == 0)
+            continue;
+        *ppToken = &cursor->token[0];
+        *pnBytes = tokenLen;
+        *piStartOffset = cursor->offsets[wordStart];
+        *piEndOffset = cursor->offsets[wordEnd];
+        *piPosition = cursor->position++;
+        return SQLITE_OK;
+    }
+    return SQLITE_DONE;
+}
+
+static const sqlite3_tokenizer_module icuTokenizerModule = {
+    0,
+    icuTokenizerCreate,
+    icuTokenizerDestroy,
+    icuTokenizerOpen,
+    icuTokenizerClose,
+    icuTokenizerNext,
+    NULL
+};
+
+/**
+ * </ICUTokenizer>
+ */
+
+// Registers the tokenizer module under the given name, the way FTS3 expects: by passing a
+// pointer to the module, as a blob, to the fts3_tokenizer() function.
+static int registerTokenizer(sqlite3* db, const char* name) {
+    const sqlite3_tokenizer_module* module = &icuTokenizerModule;
+    sqlite3_stmt* statement;
+    int err = sqlite3_prepare_v2(db, "SELECT fts3_tokenizer(?, ?)", -1, &statement, NULL);
+    if (err != SQLITE_OK)
+        return err;
+    sqlite3_bind_text(statement, 1, name, -1, SQLITE_STATIC);
+    sqlite3_bind_blob(statement, 2, &module, sizeof(module), SQLITE_STATIC);
+    sqlite3_step(statement);
+    return sqlite3_finalize(statement);
+}
+
+#endif // USE_ICU4C_UNICODE_COMPARE
+
+JNIEXPORT void JNICALL Java_com_couchbase_lite_storage_SQLiteTokenizer_nativeRegister
+(JNIEnv* env, jclass clazz, jlong connectionPtr, jstring name) {
+#ifdef USE_ICU4C_UNICODE_COMPARE
+    SQLiteConnection* connection = reinterpret_cast<SQLiteConnection*>(connectionPtr);
+    const char* nameStr = env->GetStringUTFChars(name, NULL);
+    int err = registerTokenizer(connection->db, nameStr);
+    env->ReleaseStringUTFChars(name, nameStr);
+    if (err != SQLITE_OK)
+        throw_sqlite3_exception(env, connection->db, "Could not register tokenizer");
+#else
+    throw_sqlite3_exception(env, "The ICU tokenizer is not available in this build");
+#endif
+}
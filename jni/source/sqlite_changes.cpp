@@ -0,0 +1,235 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  The commit hook runs just before a transaction commits, so in the rare case that the commit
+//  itself then fails (a busy or I/O error) its changes are still published. Likewise, changes
+//  undone by ROLLBACK TO a savepoint are published with the rest of their transaction. Either way
+//  a listener only sees more changes than there were, never fewer.
+//
+
+#include <string.h>
+#include <ctype.h>
+#include <chrono>
+
+#include "sqlite_changes.h"
+
+static std::string lowercase(const std::string& str) {
+    std::string lower(str);
+    for (size_t i = 0; i < lower.size(); i++)
+        lower[i] = (char)tolower((unsigned char)lower[i]);
+    return lower;
+}
+
+ChangeCollector::ChangeCollector() :
+enabled(true), transactionCollapsed(false), lastTable(-1), commits(0), closing(false), waiters(0) {
+}
+
+int ChangeCollector::tableId(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string key = lowercase(name);      // Table names are case-insensitive
+    std::map<std::string, int>::iterator found = tableIds.find(key);
+    if (found != tableIds.end())
+        return found->second;
+    int id = (int)tableNames.size();
+    tableNames.push_back(name);
+    tableIds[key] = id;
+    return id;
+}
+
+std::string ChangeCollector::tableName(int table) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return table >= 0 && table < (int)tableNames.size() ? tableNames[table] : std::string();
+}
+
+void ChangeCollector::addToTransaction(int operation, int table, int64_t rowid) {
+    if (!transactionCollapsed && transaction.size() >= MAX_TRANSACTION_CHANGES) {
+        // Too many rows to list: keep only which tables changed.
+        std::vector<Change> tables;
+        for (size_t i = 0; i < transaction.size(); i++) {
+            bool seen = false;
+            for (size_t j = 0; j < tables.size() && !seen; j++)
+                seen = tables[j].table == transaction[i].table;
+            if (!seen) {
+                Change change = { 0, CHANGE_TABLE, transaction[i].table, -1 };
+                tables.push_back(change);
+            }
+        }
+        transaction.swap(tables);
+        transactionCollapsed = true;
+    }
+    if (transactionCollapsed) {
+        for (size_t i = 0; i < transaction.size(); i++) {
+            if (transaction[i].table == table)
+                return;
+        }
+        operation = CHANGE_TABLE;
+        rowid = -1;
+    }
+    Change change = { 0, operation, table, rowid };
+    transaction.push_back(change);
+}
+
+void ChangeCollector::rowChanged(int sqliteOperation, const char* database, const char* table,
+                                 sqlite3_int64 rowid) {
+    if (lastTable < 0 || lastTableName != table || lastDatabase != database) {
+        lastDatabase = database;
+        lastTableName = table;
+        lastTable = tableId(strcmp(database, "main") == 0 ? lastTableName
+                                                         : lastDatabase + "." + lastTableName);
+    }
+    int operation = sqliteOperation == SQLITE_INSERT ? CHANGE_INSERT
+                  : sqliteOperation == SQLITE_UPDATE ? CHANGE_UPDATE : CHANGE_DELETE;
+    addToTransaction(operation, lastTable, rowid);
+}
+
+void ChangeCollector::publish(std::vector<Change>& changes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t commit = ++commits;
+        for (size_t i = 0; i < changes.size(); i++) {
+            changes[i].commit = commit;
+            pending.push_back(changes[i]);
+        }
+        if (pending.size() > MAX_PENDING_CHANGES) {
+            // Nobody is draining fast enough: keep only which tables changed.
+            std::deque<Change> tables;
+            for (size_t i = 0; i < pending.size(); i++) {
+                bool seen = false;
+                for (size_t j = 0; j < tables.size() && !seen; j++)
+                    seen = tables[j].table == pending[i].table;
+                if (!seen) {
+                    Change change = { commit, CHANGE_TABLE, pending[i].table, -1 };
+                    tables.push_back(change);
+                }
+            }
+            pending.swap(tables);
+        }
+    }
+    published.notify_all();
+}
+
+void ChangeCollector::committed() {
+    if (!transaction.empty())
+        publish(transaction);
+    transaction.clear();
+    transactionCollapsed = false;
+}
+
+void ChangeCollector::rolledBack() {
+    transaction.clear();
+    transactionCollapsed = false;
+}
+
+static const char* skipSpace(const char* sql) {
+    while (isspace((unsigned char)*sql))
+        sql++;
+    return sql;
+}
+
+static const char* skipKeyword(const char* sql, const char* keyword) {
+    sql = skipSpace(sql);
+    size_t length = strlen(keyword);
+    for (size_t i = 0; i < length; i++) {
+        if (toupper((unsigned char)sql[i]) != keyword[i])
+            return NULL;
+    }
+    if (isalnum((unsigned char)sql[length]) || sql[length] == '_')
+        return NULL;
+    return sql + length;
+}
+
+static const char* parseIdentifier(const char* sql, std::string& name) {
+    sql = skipSpace(sql);
+    char close = *sql == '"' ? '"' : *sql == '`' ? '`' : *sql == '[' ? ']' : 0;
+    name.clear();
+    if (close) {
+        for (sql++; *sql; sql++) {
+            if (*sql == close) {
+                if (close != ']' && sql[1] == close)
+                    sql++;      // Doubled quote
+                else
+                    return sql + 1;
+            }
+            name += *sql;
+        }
+        return NULL;
+    }
+    while (isalnum((unsigned char)*sql) || *sql == '_' || (unsigned char)*sql >= 0x80)
+        name += *sql++;
+    return name.empty() ? NULL : sql;
+}
+
+bool parse_delete_table(const char* sql, std::string& table) {
+    if (!sql || !(sql = skipKeyword(sql, "DELETE")) || !(sql = skipKeyword(sql, "FROM")))
+        return false;
+    std::string database;
+    if (!(sql = parseIdentifier(sql, table)))
+        return false;
+    if (*sql == '.') {
+        database = table;
+        if (!parseIdentifier(sql + 1, table))
+            return false;
+    }
+    if (!database.empty() && lowercase(database) != "main")
+        table = database + "." + table;
+    return true;
+}
+
+void ChangeCollector::tableEmptied(sqlite3* db, const std::string& table) {
+    int id = tableId(table);
+    if (sqlite3_get_autocommit(db)) {
+        // Its transaction has already committed, so it gets a batch of its own.
+        std::vector<Change> changes(1);
+        Change change = { 0, CHANGE_TABLE, id, -1 };
+        changes[0] = change;
+        publish(changes);
+    } else {
+        addToTransaction(CHANGE_TABLE, id, -1);
+    }
+}
+
+int ChangeCollector::drain(int64_t* fields, int maxChanges) {
+    std::lock_guard<std::mutex> lock(mutex);
+    int count = 0;
+    while (count < maxChanges && !pending.empty()) {
+        const Change& change = pending.front();
+        int64_t* out = fields + count * FIELD_COUNT;
+        out[FIELD_COMMIT] = (int64_t)change.commit;
+        out[FIELD_OPERATION] = change.operation;
+        out[FIELD_TABLE] = change.table;
+        out[FIELD_ROWID] = change.rowid;
+        pending.pop_front();
+        count++;
+    }
+    return count;
+}
+
+uint64_t ChangeCollector::waitForCommit(uint64_t afterCommit, int timeoutMillis) {
+    std::unique_lock<std::mutex> lock(mutex);
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+    waiters++;
+    while (commits <= afterCommit && !closing) {
+        if (published.wait_until(lock, deadline) == std::cv_status::timeout)
+            break;
+    }
+    if (--waiters == 0 && closing)
+        published.notify_all();
+    return commits;
+}
+
+void ChangeCollector::close() {
+    std::unique_lock<std::mutex> lock(mutex);
+    closing = true;
+    published.notify_all();
+    while (waiters > 0)
+        published.wait(lock);
+}
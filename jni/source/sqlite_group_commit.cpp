@@ -0,0 +1,83 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  Requests run in the order they were queued. A leader takes at most maxBatch of them from the
+//  front of the queue, which may not include its own if the queue was long; it then leads batches
+//  until its own request has run, or hands over to a submitter whose request is still queued.
+//
+
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "sqlite_group_commit.h"
+
+GroupCommit::GroupCommit(int64_t windowMicros, int maxBatch) :
+windowMicros(windowMicros > 0 ? windowMicros : 0), maxBatch(maxBatch > 0 ? maxBatch : 1),
+running(false), submitters(0) {
+    memset(stats, 0, sizeof(stats));
+}
+
+void GroupCommit::submit(Request* request, run_batch_function runBatch, void* context) {
+    std::unique_lock<std::mutex> lock(mutex);
+    submitters++;
+    queue.push_back(request);
+    changed.notify_all();
+
+    while (!request->done) {
+        if (running) {
+            changed.wait(lock);
+            continue;
+        }
+
+        // Lead a batch, giving other writers the window to join it unless it is full already.
+        running = true;
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::microseconds(windowMicros);
+        while ((int)queue.size() < maxBatch &&
+               changed.wait_until(lock, deadline) != std::cv_status::timeout)
+            ;
+        std::vector<Request*> batch;
+        while (!queue.empty() && (int)batch.size() < maxBatch) {
+            batch.push_back(queue.front());
+            queue.pop_front();
+        }
+
+        lock.unlock();
+        bool committed = runBatch(context, &batch[0], (int)batch.size());
+        lock.lock();
+
+        stats[STAT_BATCHES]++;
+        if (!committed)
+            stats[STAT_FAILED_COMMITS]++;
+        stats[STAT_REQUESTS] += batch.size();
+        if ((int64_t)batch.size() > stats[STAT_LARGEST_BATCH])
+            stats[STAT_LARGEST_BATCH] = batch.size();
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (batch[i]->errcode != 0)
+                stats[STAT_FAILED_REQUESTS]++;
+            batch[i]->done = true;
+        }
+        running = false;
+        changed.notify_all();
+    }
+    submitters--;
+}
+
+bool GroupCommit::idle() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return submitters == 0;
+}
+
+void GroupCommit::getStats(int64_t* out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    memcpy(out, stats, sizeof(stats));
+}
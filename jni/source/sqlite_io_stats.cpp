@@ -0,0 +1,284 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  Each file opened through the VFS is a StatsFile followed by the base VFS's own file, which does
+//  the I/O. Several connections (and the sorter threads of each) can use the VFS at once, so the
+//  counters are locked, one lock per kind of file: the main database and its WAL aren't usually
+//  written by the same thread at the same moment, and 64-bit atomics aren't available everywhere.
+//  Memory-mapped reads (xFetch) are passed through without being counted, as they do no I/O.
+//
+
+#include <string.h>
+#include <chrono>
+
+#include "sqlite_io_stats.h"
+
+/**
+ * <StatsFile>
+ */
+
+struct StatsFile {
+    sqlite3_file base;
+    IOStatsVfs* vfs;
+    int fileType;
+    sqlite3_file* real;     // Right after the StatsFile, in the memory SQLite gave xOpen
+};
+
+typedef std::chrono::steady_clock::time_point Start;
+
+static inline Start now() {
+    return std::chrono::steady_clock::now();
+}
+
+static inline void record(StatsFile* file, int fileType, int op, int64_t bytes, Start start) {
+    int64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(now() - start).count();
+    file->vfs->record(fileType, op, bytes, nanos);
+}
+
+static int statsClose(sqlite3_file* f) {
+    StatsFile* file = (StatsFile*)f;
+    return file->real->pMethods->xClose(file->real);
+}
+
+static int statsRead(sqlite3_file* f, void* buffer, int amount, sqlite3_int64 offset) {
+    StatsFile* file = (StatsFile*)f;
+    Start start = now();
+    int rc = file->real->pMethods->xRead(file->real, buffer, amount, offset);
+    record(file, file->fileType, IOStatsVfs::OP_READ, amount, start);
+    return rc;
+}
+
+static int statsWrite(sqlite3_file* f, const void* buffer, int amount, sqlite3_int64 offset) {
+    StatsFile* file = (StatsFile*)f;
+    Start start = now();
+    int rc = file->real->pMethods->xWrite(file->real, buffer, amount, offset);
+    record(file, file->fileType, IOStatsVfs::OP_WRITE, amount, start);
+    return rc;
+}
+
+static int statsTruncate(sqlite3_file* f, sqlite3_int64 size) {
+    StatsFile* file = (StatsFile*)f;
+    Start start = now();
+    int rc = file->real->pMethods->xTruncate(file->real, size);
+    record(file, file->fileType, IOStatsVfs::OP_TRUNCATE, 0, start);
+    return rc;
+}
+
+static int statsSync(sqlite3_file* f, int flags) {
+    StatsFile* file = (StatsFile*)f;
+    Start start = now();
+    int rc = file->real->pMethods->xSync(file->real, flags);
+    record(file, file->fileType, IOStatsVfs::OP_SYNC, 0, start);
+    return rc;
+}
+
+static int statsFileSize(sqlite3_file* f, sqlite3_int64* size) {
+    StatsFile* file = (StatsFile*)f;
+    return file->real->pMethods->xFileSize(file->real, size);
+}
+
+static int statsLock(sqlite3_file* f, int level) {
+    StatsFile* file = (StatsFile*)f;
+    Start start = now();
+    int rc = file->real->pMethods->xLock(file->real, level);
+    record(file, file->fileType, IOStatsVfs::OP_LOCK, 0, start);
+    return rc;
+}
+
+static int statsUnlock(sqlite3_file* f, int level) {
+    StatsFile* file = (StatsFile*)f;
+    Start start = now();
+    int rc = file->real->pMethods->xUnlock(file->real, level);
+    record(file, file->fileType, IOStatsVfs::OP_LOCK, 0, start);
+    return rc;
+}
+
+static int statsCheckReservedLock(sqlite3_file* f, int* result) {
+    StatsFile* file = (StatsFile*)f;
+    Start start = now();
+    int rc = file->real->pMethods->xCheckReservedLock(file->real, result);
+    record(file, file->fileType, IOStatsVfs::OP_LOCK, 0, start);
+    return rc;
+}
+
+static int statsFileControl(sqlite3_file* f, int op, void* arg) {
+    StatsFile* file = (StatsFile*)f;
+    return file->real->pMethods->xFileControl(file->real, op, arg);
+}
+
+static int statsSectorSize(sqlite3_file* f) {
+    StatsFile* file = (StatsFile*)f;
+    return file->real->pMethods->xSectorSize(file->real);
+}
+
+static int statsDeviceCharacteristics(sqlite3_file* f) {
+    StatsFile* file = (StatsFile*)f;
+    return file->real->pMethods->xDeviceCharacteristics(file->real);
+}
+
+static int statsShmMap(sqlite3_file* f, int region, int size, int extend, void volatile** memory) {
+    StatsFile* file = (StatsFile*)f;
+    Start start = now();
+    int rc = file->real->pMethods->xShmMap(file->real, region, size, extend, memory);
+    record(file, IOStatsVfs::FILE_SHM, IOStatsVfs::OP_OPEN, size, start);
+    return rc;
+}
+
+static int statsShmLock(sqlite3_file* f, int offset, int n, int flags) {
+    StatsFile* file = (StatsFile*)f;
+    Start start = now();
+    int rc = file->real->pMethods->xShmLock(file->real, offset, n, flags);
+    record(file, IOStatsVfs::FILE_SHM, IOStatsVfs::OP_LOCK, 0, start);
+    return rc;
+}
+
+static void statsShmBarrier(sqlite3_file* f) {
+    StatsFile* file = (StatsFile*)f;
+    Start start = now();
+    file->real->pMethods->xShmBarrier(file->real);
+    record(file, IOStatsVfs::FILE_SHM, IOStatsVfs::OP_SYNC, 0, start);
+}
+
+static int statsShmUnmap(sqlite3_file* f, int deleteFlag) {
+    StatsFile* file = (StatsFile*)f;
+    return file->real->pMethods->xShmUnmap(file->real, deleteFlag);
+}
+
+static int statsFetch(sqlite3_file* f, sqlite3_int64 offset, int amount, void** pp) {
+    StatsFile* file = (StatsFile*)f;
+    return file->real->pMethods->xFetch(file->real, offset, amount, pp);
+}
+
+static int statsUnfetch(sqlite3_file* f, sqlite3_int64 offset, void* p) {
+    StatsFile* file = (StatsFile*)f;
+    return file->real->pMethods->xUnfetch(file->real, offset, p);
+}
+
+// One table per version of sqlite3_io_methods, so that a file offers SQLite no more methods than
+// the base VFS's file has.
+static const sqlite3_io_methods kStatsFileMethods[3] = {
+    {
+        1,
+        statsClose, statsRead, statsWrite, statsTruncate, statsSync, statsFileSize,
+        statsLock, statsUnlock, statsCheckReservedLock, statsFileControl, statsSectorSize,
+        statsDeviceCharacteristics,
+    },
+    {
+        2,
+        statsClose, statsRead, statsWrite, statsTruncate, statsSync, statsFileSize,
+        statsLock, statsUnlock, statsCheckReservedLock, statsFileControl, statsSectorSize,
+        statsDeviceCharacteristics,
+        statsShmMap, statsShmLock, statsShmBarrier, statsShmUnmap,
+    },
+    {
+        3,
+        statsClose, statsRead, statsWrite, statsTruncate, statsSync, statsFileSize,
+        statsLock, statsUnlock, statsCheckReservedLock, statsFileControl, statsSectorSize,
+        statsDeviceCharacteristics,
+        statsShmMap, statsShmLock, statsShmBarrier, statsShmUnmap,
+        statsFetch, statsUnfetch,
+    },
+};
+
+/**
+ * </StatsFile>
+ */
+
+/**
+ * <IOStatsVfs>
+ */
+
+static int fileTypeOf(int flags) {
+    if (flags & SQLITE_OPEN_MAIN_DB)
+        return IOStatsVfs::FILE_MAIN_DB;
+    if (flags & (SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_MASTER_JOURNAL))
+        return IOStatsVfs::FILE_JOURNAL;
+    if (flags & SQLITE_OPEN_WAL)
+        return IOStatsVfs::FILE_WAL;
+    if (flags & (SQLITE_OPEN_TEMP_DB | SQLITE_OPEN_TEMP_JOURNAL | SQLITE_OPEN_SUBJOURNAL |
+                 SQLITE_OPEN_TRANSIENT_DB))
+        return IOStatsVfs::FILE_TEMP;
+    return IOStatsVfs::FILE_OTHER;
+}
+
+static int statsVfsOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* f, int flags, int* outFlags) {
+    IOStatsVfs* statsVfs = (IOStatsVfs*)vfs_shim_owner(vfs);
+    sqlite3_vfs* base = statsVfs->shim.base;
+    StatsFile* file = (StatsFile*)f;
+    file->base.pMethods = NULL;
+    file->vfs = statsVfs;
+    file->fileType = fileTypeOf(flags);
+    file->real = (sqlite3_file*)(file + 1);
+    memset(file->real, 0, base->szOsFile);
+
+    Start start = now();
+    int rc = base->xOpen(base, name, file->real, flags, outFlags);
+    record(file, file->fileType, IOStatsVfs::OP_OPEN, 0, start);
+
+    // SQLite closes a file whose xOpen failed if it has methods, so it gets ours only if the real
+    // file has methods to close it with.
+    if (file->real->pMethods) {
+        int version = file->real->pMethods->iVersion;
+        file->base.pMethods = &kStatsFileMethods[(version < 3 ? version : 3) - 1];
+    }
+    return rc;
+}
+
+IOStatsVfs::IOStatsVfs(sqlite3_vfs* base, const char* name) : name(name) {
+    memset(stats, 0, sizeof(stats));
+    init_vfs_shim(&shim, base, this->name.c_str(), (int)sizeof(StatsFile) + base->szOsFile,
+                  statsVfsOpen, this);
+}
+
+IOStatsVfs* IOStatsVfs::create(const char* name, const char* baseName) {
+    sqlite3_vfs* base = sqlite3_vfs_find(baseName);
+    if (!base)
+        return NULL;
+    IOStatsVfs* vfs = new IOStatsVfs(base, name);
+    if (!register_vfs_shim(&vfs->shim)) {
+        delete vfs;
+        return NULL;
+    }
+    return vfs;
+}
+
+IOStatsVfs::~IOStatsVfs() {
+    unregister_vfs_shim(&shim);
+}
+
+void IOStatsVfs::record(int fileType, int op, int64_t bytes, int64_t nanos) {
+    int bucket = 0;
+    for (int64_t micros = nanos / 1000; micros > 0 && bucket < HISTOGRAM_BUCKETS - 1; micros >>= 1)
+        bucket++;
+
+    int64_t* fields = &stats[((fileType * OP_COUNT) + op) * FIELD_COUNT];
+    std::lock_guard<std::mutex> lock(mutexes[fileType]);
+    fields[FIELD_CALLS]++;
+    fields[FIELD_BYTES] += bytes;
+    fields[FIELD_TOTAL_NANOS] += nanos;
+    if (nanos > fields[FIELD_MAX_NANOS])
+        fields[FIELD_MAX_NANOS] = nanos;
+    fields[FIELD_HISTOGRAM + bucket]++;
+}
+
+void IOStatsVfs::getStats(int64_t* out, bool reset) {
+    const int perType = OP_COUNT * FIELD_COUNT;
+    for (int type = 0; type < FILE_TYPE_COUNT; type++) {
+        std::lock_guard<std::mutex> lock(mutexes[type]);
+        memcpy(&out[type * perType], &stats[type * perType], perType * sizeof(int64_t));
+        if (reset)
+            memset(&stats[type * perType], 0, perType * sizeof(int64_t));
+    }
+}
+
+/**
+ * </IOStatsVfs>
+ */
@@ -0,0 +1,741 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  The text is parsed in one pass, strictly (RFC 7159), writing the canonical form as it goes.
+//  Most of a document is string text, which is scanned 16 bytes at a time where SSE2 or NEON is
+//  available, and copied as is unless it has escapes or needs normalizing. Sorting an object
+//  rewrites its members in place once they have all been written, unless they're in order already.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CBL_JSON_NEON
+#endif
+
+#ifdef USE_ICU4C_UNICODE_COMPARE
+#include <unicode/unorm2.h>
+#include <unicode/ustring.h>
+#endif
+
+#include "sqlite_json_canonical.h"
+
+// Deeper nesting is rejected rather than risking the stack of the calling thread.
+#define kMaxJSONDepth 512
+
+// Numbers whose decimal point is at most this far from their first digit are written without an
+// exponent, as in ECMAScript.
+#define kMaxPlainNumberMagnitude 21
+#define kMinPlainNumberMagnitude -6
+
+/**
+ * <Scanner>
+ */
+
+static inline bool isPlainText(unsigned char c) {
+    return c >= 0x20 && c < 0x80 && c != '"' && c != '\\';
+}
+
+// Returns the first byte at or after p that ends a run of plain string text (a quote, a backslash,
+// a control character or a non-ASCII byte), or end.
+static const char* scanPlainText(const char* p, const char* end) {
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(0x20);
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)p);
+        // As signed bytes, non-ASCII bytes are negative, so they're less than a space too:
+        __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, quote),
+                                                    _mm_cmpeq_epi8(bytes, backslash)),
+                                       _mm_cmplt_epi8(bytes, space));
+        int mask = _mm_movemask_epi8(special);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#elif defined(CBL_JSON_NEON)
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    const uint8x16_t nonASCII = vdupq_n_u8(0x80);
+    while (end - p >= 16) {
+        uint8x16_t bytes = vld1q_u8((const uint8_t*)p);
+        uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(bytes, quote), vceqq_u8(bytes, backslash)),
+                                      vorrq_u8(vcltq_u8(bytes, space), vcgeq_u8(bytes, nonASCII)));
+        uint64x2_t halves = vreinterpretq_u64_u8(special);
+        if (vgetq_lane_u64(halves, 0) | vgetq_lane_u64(halves, 1))
+            break; // NEON has no movemask; the loop below finds the byte within these 16
+        p += 16;
+    }
+#endif
+    while (p < end && isPlainText((unsigned char)*p))
+        ++p;
+    return p;
+}
+
+// Skips the UTF-8 sequence of one character at p (RFC 3629: no overlong forms, surrogates or
+// code points past U+10FFFF). Returns false if it isn't one.
+static bool skipUTF8(const char** in, const char* end) {
+    const unsigned char* p = (const unsigned char*)*in;
+    unsigned char min = 0x80, max = 0xBF;
+    int trailing;
+    if (p[0] < 0xC2) {
+        return false;
+    } else if (p[0] < 0xE0) {
+        trailing = 1;
+    } else if (p[0] < 0xF0) {
+        trailing = 2;
+        if (p[0] == 0xE0)
+            min = 0xA0;
+        else if (p[0] == 0xED)
+            max = 0x9F;
+    } else if (p[0] < 0xF5) {
+        trailing = 3;
+        if (p[0] == 0xF0)
+            min = 0x90;
+        else if (p[0] == 0xF4)
+            max = 0x8F;
+    } else {
+        return false;
+    }
+    if ((const char*)p + trailing >= end)
+        return false;
+    if (p[1] < min || p[1] > max)
+        return false;
+    for (int i = 2; i <= trailing; ++i) {
+        if (p[i] < 0x80 || p[i] > 0xBF)
+            return false;
+    }
+    *in += trailing + 1;
+    return true;
+}
+
+static void appendUTF8(std::string* out, uint32_t c) {
+    if (c < 0x80) {
+        out->push_back((char)c);
+    } else if (c < 0x800) {
+        out->push_back((char)(0xC0 | (c >> 6)));
+        out->push_back((char)(0x80 | (c & 0x3F)));
+    } else if (c < 0x10000) {
+        out->push_back((char)(0xE0 | (c >> 12)));
+        out->push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+        out->push_back((char)(0x80 | (c & 0x3F)));
+    } else {
+        out->push_back((char)(0xF0 | (c >> 18)));
+        out->push_back((char)(0x80 | ((c >> 12) & 0x3F)));
+        out->push_back((char)(0x80 | ((c >> 6) & 0x3F)));
+        out->push_back((char)(0x80 | (c & 0x3F)));
+    }
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Reads the 4 hex digits of a \u escape at p; returns -1 if they aren't.
+static int readHex4(const char* p, const char* end) {
+    if (end - p < 4)
+        return -1;
+    int value = 0;
+    for (int i = 0; i < 4; ++i) {
+        int digit = hexValue(p[i]);
+        if (digit < 0)
+            return -1;
+        value = (value << 4) | digit;
+    }
+    return value;
+}
+
+// Reads one byte of the unescaped text of a string written by writeString, which has only the
+// escapes it writes.
+static unsigned char readCanonicalByte(const char** in) {
+    char c = *(*in)++;
+    if (c != '\\')
+        return (unsigned char)c;
+    c = *(*in)++;
+    switch (c) {
+        case 'b':   return '\b';
+        case 'n':   return '\n';
+        case 'r':   return '\r';
+        case 't':   return '\t';
+        case 'u': {
+            unsigned char value = (unsigned char)((hexValue((*in)[2]) << 4) | hexValue((*in)[3]));
+            *in += 4;
+            return value;
+        }
+        default:    return (unsigned char)c;
+    }
+}
+
+/**
+ * </Scanner>
+ */
+
+/**
+ * <Canonicalizer>
+ */
+
+struct Canonicalizer {
+    // A member of an object being sorted, as written to out: from the opening quote of its key
+    // to the end of its value.
+    struct Member {
+        size_t start;
+        size_t keyEnd;      // After the closing quote of the key
+        size_t end;
+    };
+
+    const char* const begin;
+    const char* const end;
+    const char* pos;
+    const int options;
+    std::string* const out;
+    const char* error;
+    const char* errorPos;
+
+    std::string text;                   // Unescaped text of the string being parsed
+    std::vector<Member> members;        // Of the objects being parsed, innermost last
+    std::string reordered;
+#ifdef USE_ICU4C_UNICODE_COMPARE
+    std::vector<UChar> utf16;
+    std::vector<UChar> normalized;
+#endif
+
+    Canonicalizer(const char* json, size_t length, int options, std::string* out) :
+    begin(json), end(json + length), pos(json), options(options), out(out), error(NULL),
+    errorPos(NULL) { }
+
+    bool fail(const char* message, const char* at) {
+        error = message;
+        errorPos = at;
+        return false;
+    }
+
+    void skipWhitespace() {
+        while (pos < end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t'))
+            ++pos;
+    }
+
+    bool parseValue(int depth);
+    bool parseObject(int depth);
+    bool parseArray(int depth);
+    bool parseString();
+    bool parseEscape();
+    bool parseNumber();
+    bool parseLiteral(const char* literal, size_t length);
+    bool normalize(const char* at);
+    void writeString(const char* str, size_t length);
+    int compareKeys(const Member& m1, const Member& m2) const;
+    void sortMembers(size_t first, size_t bodyStart);
+};
+
+bool Canonicalizer::parseValue(int depth) {
+    skipWhitespace();
+    if (pos == end)
+        return fail("Unexpected end of JSON", pos);
+    switch (*pos) {
+        case '{':   return parseObject(depth);
+        case '[':   return parseArray(depth);
+        case '"':   return parseString();
+        case 't':   return parseLiteral("true", 4);
+        case 'f':   return parseLiteral("false", 5);
+        case 'n':   return parseLiteral("null", 4);
+        default:
+            if (*pos == '-' || (*pos >= '0' && *pos <= '9'))
+                return parseNumber();
+            return fail("Unexpected character", pos);
+    }
+}
+
+bool Canonicalizer::parseObject(int depth) {
+    if (depth >= kMaxJSONDepth)
+        return fail("JSON is nested too deeply", pos);
+    ++pos;
+    out->push_back('{');
+    size_t bodyStart = out->size();
+    size_t first = members.size();
+    skipWhitespace();
+    if (pos < end && *pos == '}') {
+        ++pos;
+        out->push_back('}');
+        return true;
+    }
+    while (true) {
+        skipWhitespace();
+        if (pos == end || *pos != '"')
+            return fail("Expected a key", pos);
+        Member member;
+        member.start = out->size();
+        if (!parseString())
+            return false;
+        member.keyEnd = out->size();
+        skipWhitespace();
+        if (pos == end || *pos != ':')
+            return fail("Expected ':'", pos);
+        ++pos;
+        out->push_back(':');
+        if (!parseValue(depth + 1))
+            return false;
+        member.end = out->size();
+        if (options & JSON_CANONICAL_SORT_KEYS)
+            members.push_back(member);
+        skipWhitespace();
+        if (pos < end && *pos == ',') {
+            ++pos;
+            out->push_back(',');
+        } else if (pos < end && *pos == '}') {
+            ++pos;
+            break;
+        } else {
+            return fail("Expected ',' or '}'", pos);
+        }
+    }
+    if (options & JSON_CANONICAL_SORT_KEYS) {
+        sortMembers(first, bodyStart);
+        members.resize(first);
+    }
+    out->push_back('}');
+    return true;
+}
+
+bool Canonicalizer::parseArray(int depth) {
+    if (depth >= kMaxJSONDepth)
+        return fail("JSON is nested too deeply", pos);
+    ++pos;
+    out->push_back('[');
+    skipWhitespace();
+    if (pos < end && *pos == ']') {
+        ++pos;
+        out->push_back(']');
+        return true;
+    }
+    while (true) {
+        if (!parseValue(depth + 1))
+            return false;
+        skipWhitespace();
+        if (pos < end && *pos == ',') {
+            ++pos;
+            out->push_back(',');
+        } else if (pos < end && *pos == ']') {
+            ++pos;
+            break;
+        } else {
+            return fail("Expected ',' or ']'", pos);
+        }
+    }
+    out->push_back(']');
+    return true;
+}
+
+bool Canonicalizer::parseString() {
+    const char* quote = pos++;
+    const char* start = pos;
+    bool nonASCII = false;
+
+    // Text without escapes is written as it is, unless it needs normalizing:
+    while (true) {
+        pos = scanPlainText(pos, end);
+        if (pos == end)
+            return fail("Unterminated string", quote);
+        unsigned char c = (unsigned char)*pos;
+        if (c == '"' || c == '\\')
+            break;
+        if (c < 0x20)
+            return fail("Control character in string", pos);
+        if (!skipUTF8(&pos, end))
+            return fail("Invalid UTF-8", pos);
+        nonASCII = true;
+    }
+    bool normalizing = nonASCII && (options & JSON_CANONICAL_NFC);
+    if (*pos == '"' && !normalizing) {
+        out->push_back('"');
+        out->append(start, pos - start);
+        out->push_back('"');
+        ++pos;
+        return true;
+    }
+
+    // Otherwise the text is unescaped first, then written with the canonical escapes:
+    text.assign(start, pos - start);
+    while (true) {
+        if (pos == end)
+            return fail("Unterminated string", quote);
+        unsigned char c = (unsigned char)*pos;
+        if (c == '"') {
+            ++pos;
+            break;
+        } else if (c == '\\') {
+            if (!parseEscape())
+                return false;
+        } else if (c < 0x20) {
+            return fail("Control character in string", pos);
+        } else if (c >= 0x80) {
+            const char* sequence = pos;
+            if (!skipUTF8(&pos, end))
+                return fail("Invalid UTF-8", pos);
+            text.append(sequence, pos - sequence);
+        } else {
+            const char* run = pos;
+            pos = scanPlainText(pos, end);
+            text.append(run, pos - run);
+        }
+    }
+    for (size_t i = 0; !nonASCII && i < text.size(); ++i)
+        nonASCII = (unsigned char)text[i] >= 0x80;
+    if (nonASCII && (options & JSON_CANONICAL_NFC) && !normalize(quote))
+        return false;
+    writeString(text.data(), text.size());
+    return true;
+}
+
+// Appends the character of the escape at pos to text.
+bool Canonicalizer::parseEscape() {
+    const char* escape = pos;
+    if (end - pos < 2)
+        return fail("Unterminated string", escape);
+    char c = pos[1];
+    pos += 2;
+    switch (c) {
+        case '"':   text.push_back('"'); return true;
+        case '\\':  text.push_back('\\'); return true;
+        case '/':   text.push_back('/'); return true;
+        case 'b':   text.push_back('\b'); return true;
+        case 'f':   text.push_back('\f'); return true;
+        case 'n':   text.push_back('\n'); return true;
+        case 'r':   text.push_back('\r'); return true;
+        case 't':   text.push_back('\t'); return true;
+        case 'u':   break;
+        default:    return fail("Invalid escape", escape);
+    }
+    int unit = readHex4(pos, end);
+    if (unit < 0)
+        return fail("Invalid \\u escape", escape);
+    pos += 4;
+    uint32_t character = (uint32_t)unit;
+    if (unit >= 0xDC00 && unit <= 0xDFFF)
+        return fail("Unpaired surrogate", escape);
+    if (unit >= 0xD800 && unit <= 0xDBFF) {
+        int low = (end - pos >= 6 && pos[0] == '\\' && pos[1] == 'u') ? readHex4(pos + 2, end) : -1;
+        if (low < 0xDC00 || low > 0xDFFF)
+            return fail("Unpaired surrogate", escape);
+        pos += 6;
+        character = 0x10000 + (((uint32_t)unit - 0xD800) << 10) + ((uint32_t)low - 0xDC00);
+    }
+    appendUTF8(&text, character);
+    return true;
+}
+
+// Writes the string with only the escapes collateJSON understands: \" \\ \b \n \r \t, and \u00XX
+// for the other control characters. Everything else, including non-ASCII text, is written as is.
+void Canonicalizer::writeString(const char* str, size_t length) {
+    static const char kHexDigits[] = "0123456789abcdef";
+    const char* strEnd = str + length;
+    out->push_back('"');
+    while (str < strEnd) {
+        const char* run = str;
+        str = scanPlainText(str, strEnd);
+        out->append(run, str - run);
+        if (str == strEnd)
+            break;
+        unsigned char c = (unsigned char)*str++;
+        switch (c) {
+            case '"':   out->append("\\\""); break;
+            case '\\':  out->append("\\\\"); break;
+            case '\b':  out->append("\\b"); break;
+            case '\n':  out->append("\\n"); break;
+            case '\r':  out->append("\\r"); break;
+            case '\t':  out->append("\\t"); break;
+            default:
+                if (c >= 0x80) {
+                    out->push_back((char)c);
+                } else {
+                    const char escape[] = {'\\', 'u', '0', '0', kHexDigits[c >> 4], kHexDigits[c & 0xF]};
+                    out->append(escape, sizeof(escape));
+                }
+                break;
+        }
+    }
+    out->push_back('"');
+}
+
+// Normalizes text to NFC; at is the string it came from, for errors.
+bool Canonicalizer::normalize(const char* at) {
+#ifdef USE_ICU4C_UNICODE_COMPARE
+    UErrorCode status = U_ZERO_ERROR;
+    const UNormalizer2* nfc = unorm2_getNFCInstance(&status);
+    if (U_FAILURE(status))
+        return fail("Unicode normalization data is not available", at);
+
+    // Text has no more UTF-16 units than UTF-8 bytes.
+    utf16.resize(text.size());
+    int32_t length16 = 0;
+    u_strFromUTF8(&utf16[0], (int32_t)utf16.size(), &length16, text.data(), (int32_t)text.size(),
+                  &status);
+    if (U_FAILURE(status))
+        return fail("Could not normalize string", at);
+    UBool isNormalized = unorm2_isNormalized(nfc, &utf16[0], length16, &status);
+    if (U_FAILURE(status))
+        return fail("Could not normalize string", at);
+    if (isNormalized)
+        return true;
+
+    normalized.resize(length16 + 16);
+    int32_t normalizedLength = unorm2_normalize(nfc, &utf16[0], length16, &normalized[0],
+                                                (int32_t)normalized.size(), &status);
+    if (status == U_BUFFER_OVERFLOW_ERROR) {
+        status = U_ZERO_ERROR;
+        normalized.resize(normalizedLength);
+        normalizedLength = unorm2_normalize(nfc, &utf16[0], length16, &normalized[0],
+                                            (int32_t)normalized.size(), &status);
+    }
+    if (U_FAILURE(status))
+        return fail("Could not normalize string", at);
+
+    // Each UTF-16 unit takes at most 3 bytes of UTF-8.
+    text.resize((size_t)normalizedLength * 3);
+    int32_t length8 = 0;
+    u_strToUTF8(&text[0], (int32_t)text.size(), &length8, &normalized[0], normalizedLength, &status);
+    if (U_FAILURE(status))
+        return fail("Could not normalize string", at);
+    text.resize(length8);
+    return true;
+#else
+    return fail("Unicode normalization needs ICU", at);
+#endif
+}
+
+bool Canonicalizer::parseNumber() {
+    const char* start = pos;
+    bool negative = (*pos == '-');
+    if (negative)
+        ++pos;
+
+    const char* intDigits = pos;
+    if (pos == end || *pos < '0' || *pos > '9')
+        return fail("Invalid number", start);
+    if (*pos == '0') {
+        ++pos;
+        if (pos < end && *pos >= '0' && *pos <= '9')
+            return fail("Invalid number", start);
+    } else {
+        while (pos < end && *pos >= '0' && *pos <= '9')
+            ++pos;
+    }
+    int64_t intLen = pos - intDigits;
+
+    const char* fracDigits = pos;
+    int64_t fracLen = 0;
+    if (pos < end && *pos == '.') {
+        fracDigits = ++pos;
+        while (pos < end && *pos >= '0' && *pos <= '9')
+            ++pos;
+        fracLen = pos - fracDigits;
+        if (fracLen == 0)
+            return fail("Invalid number", start);
+    }
+
+    bool hasExponent = false;
+    int64_t exponent = 0;
+    if (pos < end && (*pos == 'e' || *pos == 'E')) {
+        hasExponent = true;
+        ++pos;
+        bool negativeExponent = false;
+        if (pos < end && (*pos == '+' || *pos == '-'))
+            negativeExponent = (*pos++ == '-');
+        const char* expDigits = pos;
+        while (pos < end && *pos == '0')
+            ++pos;
+        const char* significant = pos;
+        while (pos < end && *pos >= '0' && *pos <= '9') {
+            if (pos - significant >= 9)
+                return fail("Number is out of range", start);
+            exponent = 10 * exponent + (*pos++ - '0');
+        }
+        if (pos == expDigits)
+            return fail("Invalid number", start);
+        if (negativeExponent)
+            exponent = -exponent;
+    }
+
+    // An integer that is short enough is canonical already (JSON doesn't allow leading zeros):
+    if (fracLen == 0 && !hasExponent && intLen <= kMaxPlainNumberMagnitude
+            && !(negative && *intDigits == '0')) {
+        out->append(start, pos - start);
+        return true;
+    }
+
+    // Trim leading and trailing zeros to find the significant digits, as scanNumber does:
+    int64_t total = intLen + fracLen;
+    int64_t first = 0, last = total;
+#define DIGIT_AT(i) ((i) < intLen ? intDigits[i] : fracDigits[(i) - intLen])
+    while (first < total && DIGIT_AT(first) == '0')
+        ++first;
+    while (last > first && DIGIT_AT(last - 1) == '0')
+        --last;
+    if (first == last) {
+        out->push_back('0');
+        return true;
+    }
+    int64_t count = last - first;
+    int64_t magnitude = intLen - first + exponent;  // Value is 0.<digits> x 10^magnitude
+
+    if (negative)
+        out->push_back('-');
+    if (magnitude >= count && magnitude <= kMaxPlainNumberMagnitude) {
+        for (int64_t i = first; i < last; ++i)
+            out->push_back(DIGIT_AT(i));
+        out->append((size_t)(magnitude - count), '0');
+    } else if (magnitude > 0 && magnitude <= kMaxPlainNumberMagnitude) {
+        for (int64_t i = first; i < last; ++i) {
+            if (i == first + magnitude)
+                out->push_back('.');
+            out->push_back(DIGIT_AT(i));
+        }
+    } else if (magnitude > kMinPlainNumberMagnitude && magnitude <= 0) {
+        out->append("0.");
+        out->append((size_t)-magnitude, '0');
+        for (int64_t i = first; i < last; ++i)
+            out->push_back(DIGIT_AT(i));
+    } else {
+        out->push_back(DIGIT_AT(first));
+        if (count > 1)
+            out->push_back('.');
+        for (int64_t i = first + 1; i < last; ++i)
+            out->push_back(DIGIT_AT(i));
+        int64_t e = magnitude - 1;
+        out->append(e < 0 ? "e-" : "e+");
+        char digits[24];
+        int n = 0;
+        for (uint64_t u = (uint64_t)(e < 0 ? -e : e); n == 0 || u > 0; u /= 10)
+            digits[n++] = (char)('0' + u % 10);
+        while (n > 0)
+            out->push_back(digits[--n]);
+    }
+#undef DIGIT_AT
+    return true;
+}
+
+bool Canonicalizer::parseLiteral(const char* literal, size_t length) {
+    if ((size_t)(end - pos) < length || memcmp(pos, literal, length) != 0)
+        return fail("Unexpected character", pos);
+    out->append(pos, length);
+    pos += length;
+    return true;
+}
+
+// Compares the unescaped keys bytewise, which orders them by code point.
+int Canonicalizer::compareKeys(const Member& m1, const Member& m2) const {
+    const char* data = out->data();
+    const char* k1 = data + m1.start + 1, *end1 = data + m1.keyEnd - 1;
+    const char* k2 = data + m2.start + 1, *end2 = data + m2.keyEnd - 1;
+    while (k1 < end1 && k2 < end2) {
+        unsigned char c1 = readCanonicalByte(&k1);
+        unsigned char c2 = readCanonicalByte(&k2);
+        if (c1 != c2)
+            return c1 < c2 ? -1 : 1;
+    }
+    return (k1 < end1) - (k2 < end2);
+}
+
+// Rewrites the members of the object from first on, whose text starts at bodyStart, in key order.
+// Members with the same key keep their order.
+void Canonicalizer::sortMembers(size_t first, size_t bodyStart) {
+    std::vector<Member>::iterator begin = members.begin() + first;
+    bool sorted = true;
+    for (std::vector<Member>::iterator m = begin + 1; sorted && m < members.end(); ++m)
+        sorted = compareKeys(*(m - 1), *m) <= 0;
+    if (sorted)
+        return;
+
+    std::stable_sort(begin, members.end(), [this](const Member& m1, const Member& m2) {
+        return compareKeys(m1, m2) < 0;
+    });
+    reordered.assign(*out, bodyStart, std::string::npos);
+    out->resize(bodyStart);
+    for (std::vector<Member>::iterator m = begin; m < members.end(); ++m) {
+        if (m != begin)
+            out->push_back(',');
+        out->append(reordered, m->start - bodyStart, m->end - m->start);
+    }
+}
+
+/**
+ * </Canonicalizer>
+ */
+
+const char* canonicalize_json(const char* json, size_t length, int options, std::string* out,
+                              size_t* errorOffset) {
+    Canonicalizer canonicalizer(json, length, options, out);
+    out->reserve(out->size() + length);
+    if (canonicalizer.parseValue(0)) {
+        canonicalizer.skipWhitespace();
+        if (canonicalizer.pos != canonicalizer.end)
+            canonicalizer.fail("Unexpected text after JSON", canonicalizer.pos);
+    }
+    if (canonicalizer.error)
+        *errorOffset = canonicalizer.errorPos - json;
+    return canonicalizer.error;
+}
+
+/**
+ * <SQL functions>
+ */
+
+// json_canonical(json [, options]) sorts keys unless options says otherwise; json_minify(json)
+// only strips whitespace and normalizes numbers and escapes. NULL gives NULL.
+static void canonicalFunc(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+        return;
+    int options = argc > 1 ? sqlite3_value_int(argv[1]) : (int)(intptr_t)sqlite3_user_data(context);
+    const char* json = (const char*)sqlite3_value_text(argv[0]);
+    int length = sqlite3_value_bytes(argv[0]);
+    if (!json) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+
+    std::string canonical;
+    size_t errorOffset = 0;
+    const char* error = canonicalize_json(json, length, options, &canonical, &errorOffset);
+    if (error) {
+        char* message = sqlite3_mprintf("%s at offset %lld", error, (sqlite3_int64)errorOffset);
+        sqlite3_result_error(context, message, -1);
+        sqlite3_free(message);
+        return;
+    }
+    sqlite3_result_text(context, canonical.data(), (int)canonical.size(), SQLITE_TRANSIENT);
+}
+
+void register_json_canonical_functions(sqlite3* db) {
+    void* sortKeys = (void*)(intptr_t)JSON_CANONICAL_SORT_KEYS;
+    sqlite3_create_function(db, "json_canonical", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, sortKeys,
+                            canonicalFunc, NULL, NULL);
+    sqlite3_create_function(db, "json_canonical", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, sortKeys,
+                            canonicalFunc, NULL, NULL);
+    sqlite3_create_function(db, "json_minify", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL,
+                            canonicalFunc, NULL, NULL);
+}
+
+/**
+ * </SQL functions>
+ */
@@ -0,0 +1,113 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  SQLite 3.8 only has a soft heap limit, which it enforces by recycling page cache memory and
+//  which it may exceed. The hard limit here is enforced between statements instead: once SQLite's
+//  heap is over it, memory is released from every connection, and if that isn't enough, new
+//  statements fail with SQLITE_NOMEM until usage drops. Statements already running are not
+//  interrupted. Releasing locks every connection in turn, so while usage stays over the limit it
+//  is done at most once per interval rather than before every statement.
+//
+
+#include <limits.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+
+#include "sqlite_memory.h"
+#include "sqlite_log.h"
+
+static std::mutex sConnectionsMutex;
+static std::set<SQLiteConnection*> sConnections;
+
+// In KiB, so that it fits in an atomic int on every platform; 0 for no limit.
+static std::atomic<int> sHardHeapLimitKiB(0);
+
+#define kHardLimitReleaseIntervalMillis 250
+
+static std::mutex sHardLimitReleaseMutex;
+static bool sHardLimitReleased;                     // Guarded by sHardLimitReleaseMutex
+static std::chrono::steady_clock::time_point sHardLimitReleaseTime;
+
+void register_connection(SQLiteConnection* connection) {
+    std::lock_guard<std::mutex> lock(sConnectionsMutex);
+    sConnections.insert(connection);
+}
+
+void unregister_connection(SQLiteConnection* connection) {
+    std::lock_guard<std::mutex> lock(sConnectionsMutex);
+    sConnections.erase(connection);
+}
+
+sqlite3_int64 release_connection_memory(SQLiteConnection* connection) {
+    int before = 0, after = 0, highwater;
+    sqlite3_db_status(connection->db, SQLITE_DBSTATUS_CACHE_USED, &before, &highwater, 0);
+    sqlite3_db_release_memory(connection->db);
+    sqlite3_db_status(connection->db, SQLITE_DBSTATUS_CACHE_USED, &after, &highwater, 0);
+    return before > after ? before - after : 0;
+}
+
+sqlite3_int64 release_all_memory() {
+    sqlite3_int64 before = sqlite3_memory_used();
+    {
+        // Waits for any statement running on each connection to return a row first.
+        std::lock_guard<std::mutex> lock(sConnectionsMutex);
+        for (std::set<SQLiteConnection*>::iterator i = sConnections.begin();
+             i != sConnections.end(); ++i) {
+            sqlite3_db_release_memory((*i)->db);
+        }
+    }
+    // Only frees anything when SQLite is built with SQLITE_ENABLE_MEMORY_MANAGEMENT.
+    sqlite3_release_memory(INT_MAX);
+    sqlite3_int64 after = sqlite3_memory_used();
+    LOGV(SQLITE_LOG_TAG, "Released %lld bytes of SQLite memory", (long long)(before - after));
+    return before > after ? before - after : 0;
+}
+
+sqlite3_int64 set_heap_limits(sqlite3_int64 softLimit, sqlite3_int64 hardLimit) {
+    if (softLimit >= 0)
+        sqlite3_soft_heap_limit64(softLimit);
+    if (hardLimit >= 0) {
+        sqlite3_int64 kib = (hardLimit + 1023) / 1024;
+        sHardHeapLimitKiB.store(kib > INT_MAX ? INT_MAX : (int)kib, std::memory_order_relaxed);
+    }
+
+    sqlite3_int64 soft = sqlite3_soft_heap_limit64(-1);
+    sqlite3_int64 hard = sHardHeapLimitKiB.load(std::memory_order_relaxed) * 1024LL;
+    sqlite3_int64 used = sqlite3_memory_used();
+    if ((soft > 0 && used > soft) || (hard > 0 && used > hard))
+        return release_all_memory();
+    return 0;
+}
+
+bool hard_heap_limit_exceeded() {
+    int limitKiB = sHardHeapLimitKiB.load(std::memory_order_relaxed);
+    if (limitKiB <= 0)
+        return false;
+    sqlite3_int64 limit = limitKiB * 1024LL;
+    if (sqlite3_memory_used() <= limit)
+        return false;
+    {
+        // Another thread may be releasing already, or have just done so.
+        std::unique_lock<std::mutex> lock(sHardLimitReleaseMutex, std::try_to_lock);
+        if (!lock.owns_lock())
+            return true;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (sHardLimitReleased && now - sHardLimitReleaseTime
+                < std::chrono::milliseconds(kHardLimitReleaseIntervalMillis))
+            return true;
+        sHardLimitReleased = true;
+        sHardLimitReleaseTime = now;
+    }
+    release_all_memory();
+    return sqlite3_memory_used() > limit;
+}
@@ -0,0 +1,580 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  A MemoryFile is the shared content of a file, and a MemoryHandle one connection's use of it,
+//  like a file descriptor. The locks a handle holds are tracked the way the unix VFS tracks the
+//  byte-range locks of a file, so that SQLite's own locking protocol (and, through the shared
+//  memory, its WAL protocol) works between connections as it does on disk. A WAL reader reads
+//  earlier frames while the writer appends to the WAL, so every access to a file's content is under
+//  the file's mutex. Locks are taken in the order filesMutex, then a file's mutex, then
+//  memoryMutex. File content isn't allocated by SQLite's allocator, so that it doesn't count
+//  towards the heap limits, which are about caches.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+#include "sqlite_memory_vfs.h"
+
+// Retries when saving or loading while other connections hold the database locked.
+static const int COPY_BUSY_TIMEOUT_MS = 2500;
+
+struct MemoryHandle;
+
+struct MemoryFile {
+    std::string name;               // Empty for temporary files, which aren't in the VFS's map
+    int refs;                       // Handles open on the file; guarded by the VFS's filesMutex
+    bool deleted;                   // Deleted while still open, and freed on the last close
+
+    std::mutex mutex;               // Guards everything below
+    std::vector<char*> chunks;
+    sqlite3_int64 size;
+
+    int sharedLocks;
+    MemoryHandle* reserved;
+    MemoryHandle* pending;
+    MemoryHandle* exclusive;
+
+    std::vector<char*> shmRegions;
+    int shmRegionSize;
+    int shmShared[SQLITE_SHM_NLOCK];
+    MemoryHandle* shmExclusive[SQLITE_SHM_NLOCK];
+
+    explicit MemoryFile(const std::string& name) :
+    name(name), refs(0), deleted(false), size(0), sharedLocks(0), reserved(NULL), pending(NULL),
+    exclusive(NULL), shmRegionSize(0) {
+        memset(shmShared, 0, sizeof(shmShared));
+        memset(shmExclusive, 0, sizeof(shmExclusive));
+    }
+};
+
+struct MemoryHandle {
+    sqlite3_file base;
+    MemoryVfs* vfs;
+    MemoryFile* file;
+    int lockLevel;
+    int shmSharedMask;
+    int shmExclusiveMask;
+    bool deleteOnClose;
+};
+
+// Returns the bytes the file held, which the caller releases from the VFS.
+static int64_t freeFile(MemoryFile* file) {
+    int64_t bytes = (int64_t)file->chunks.size() * MemoryVfs::CHUNK_SIZE +
+                    (int64_t)file->shmRegions.size() * file->shmRegionSize;
+    for (size_t i = 0; i < file->chunks.size(); i++)
+        free(file->chunks[i]);
+    for (size_t i = 0; i < file->shmRegions.size(); i++)
+        free(file->shmRegions[i]);
+    delete file;
+    return bytes;
+}
+
+/**
+ * <MemoryHandle>
+ */
+
+// Grows the file's chunks to hold size bytes; returns false if the VFS's cap doesn't allow it.
+// Called with the file's mutex held.
+static bool growChunks(MemoryHandle* handle, sqlite3_int64 size) {
+    MemoryFile* file = handle->file;
+    size_t needed = (size_t)((size + MemoryVfs::CHUNK_SIZE - 1) / MemoryVfs::CHUNK_SIZE);
+    while (file->chunks.size() < needed) {
+        if (!handle->vfs->reserve(MemoryVfs::CHUNK_SIZE))
+            return false;
+        char* chunk = (char*)calloc(1, MemoryVfs::CHUNK_SIZE);
+        if (!chunk) {
+            handle->vfs->release(MemoryVfs::CHUNK_SIZE);
+            return false;
+        }
+        file->chunks.push_back(chunk);
+    }
+    return true;
+}
+
+static int memoryUnlock(sqlite3_file* f, int level);
+static int memoryShmUnmap(sqlite3_file* f, int deleteFlag);
+
+static int memoryClose(sqlite3_file* f) {
+    MemoryHandle* handle = (MemoryHandle*)f;
+    memoryUnlock(f, SQLITE_LOCK_NONE);
+    memoryShmUnmap(f, 0);
+
+    MemoryVfs* vfs = handle->vfs;
+    MemoryFile* file = handle->file;
+    int64_t freed = 0;
+    {
+        std::lock_guard<std::mutex> lock(vfs->filesMutex);
+        if (handle->deleteOnClose && !file->deleted) {
+            vfs->files.erase(file->name);
+            file->deleted = true;
+        }
+        if (--file->refs == 0 && (file->deleted || file->name.empty()))
+            freed = freeFile(file);
+    }
+    vfs->release(freed);
+    return SQLITE_OK;
+}
+
+static int memoryRead(sqlite3_file* f, void* buffer, int amount, sqlite3_int64 offset) {
+    MemoryHandle* handle = (MemoryHandle*)f;
+    MemoryFile* file = handle->file;
+    std::lock_guard<std::mutex> lock(file->mutex);
+
+    int available = 0;
+    if (offset < file->size)
+        available = (int)(file->size - offset < amount ? file->size - offset : amount);
+    char* out = (char*)buffer;
+    for (int done = 0; done < available; ) {
+        sqlite3_int64 at = offset + done;
+        int inChunk = (int)(at % MemoryVfs::CHUNK_SIZE);
+        int n = MemoryVfs::CHUNK_SIZE - inChunk;
+        if (n > available - done)
+            n = available - done;
+        memcpy(out + done, file->chunks[(size_t)(at / MemoryVfs::CHUNK_SIZE)] + inChunk, n);
+        done += n;
+    }
+    if (available < amount) {
+        memset(out + available, 0, amount - available);
+        return SQLITE_IOERR_SHORT_READ;
+    }
+    return SQLITE_OK;
+}
+
+static int memoryWrite(sqlite3_file* f, const void* buffer, int amount, sqlite3_int64 offset) {
+    MemoryHandle* handle = (MemoryHandle*)f;
+    MemoryFile* file = handle->file;
+    std::lock_guard<std::mutex> lock(file->mutex);
+
+    if (!growChunks(handle, offset + amount))
+        return SQLITE_FULL;
+    const char* in = (const char*)buffer;
+    for (int done = 0; done < amount; ) {
+        sqlite3_int64 at = offset + done;
+        int inChunk = (int)(at % MemoryVfs::CHUNK_SIZE);
+        int n = MemoryVfs::CHUNK_SIZE - inChunk;
+        if (n > amount - done)
+            n = amount - done;
+        memcpy(file->chunks[(size_t)(at / MemoryVfs::CHUNK_SIZE)] + inChunk, in + done, n);
+        done += n;
+    }
+    if (offset + amount > file->size)
+        file->size = offset + amount;
+    return SQLITE_OK;
+}
+
+static int memoryTruncate(sqlite3_file* f, sqlite3_int64 size) {
+    MemoryHandle* handle = (MemoryHandle*)f;
+    MemoryFile* file = handle->file;
+    std::lock_guard<std::mutex> lock(file->mutex);
+
+    if (size > file->size) {
+        if (!growChunks(handle, size))
+            return SQLITE_FULL;
+        file->size = size;
+        return SQLITE_OK;
+    }
+    size_t keep = (size_t)((size + MemoryVfs::CHUNK_SIZE - 1) / MemoryVfs::CHUNK_SIZE);
+    int64_t freed = 0;
+    while (file->chunks.size() > keep) {
+        free(file->chunks.back());
+        file->chunks.pop_back();
+        freed += MemoryVfs::CHUNK_SIZE;
+    }
+    handle->vfs->release(freed);
+    // Zero the rest of the last chunk, so that growing the file again reads zeroes there.
+    int inChunk = (int)(size % MemoryVfs::CHUNK_SIZE);
+    if (inChunk > 0)
+        memset(file->chunks.back() + inChunk, 0, MemoryVfs::CHUNK_SIZE - inChunk);
+    file->size = size;
+    return SQLITE_OK;
+}
+
+static int memorySync(sqlite3_file* f, int flags) {
+    return SQLITE_OK;
+}
+
+static int memoryFileSize(sqlite3_file* f, sqlite3_int64* size) {
+    MemoryFile* file = ((MemoryHandle*)f)->file;
+    std::lock_guard<std::mutex> lock(file->mutex);
+    *size = file->size;
+    return SQLITE_OK;
+}
+
+static int memoryLock(sqlite3_file* f, int level) {
+    MemoryHandle* handle = (MemoryHandle*)f;
+    MemoryFile* file = handle->file;
+    std::lock_guard<std::mutex> lock(file->mutex);
+
+    if (handle->lockLevel >= level)
+        return SQLITE_OK;
+    switch (level) {
+        case SQLITE_LOCK_SHARED:
+            if (file->pending || file->exclusive)
+                return SQLITE_BUSY;
+            file->sharedLocks++;
+            break;
+        case SQLITE_LOCK_RESERVED:
+            if (file->reserved)
+                return SQLITE_BUSY;
+            file->reserved = handle;
+            break;
+        case SQLITE_LOCK_EXCLUSIVE:
+            // Like the unix VFS, keep the pending lock while waiting for the readers to leave, so
+            // that no new ones come in.
+            if (file->pending && file->pending != handle)
+                return SQLITE_BUSY;
+            file->pending = handle;
+            if (file->sharedLocks > 1) {
+                handle->lockLevel = SQLITE_LOCK_PENDING;
+                return SQLITE_BUSY;
+            }
+            file->exclusive = handle;
+            break;
+        default:
+            return SQLITE_MISUSE;
+    }
+    handle->lockLevel = level;
+    return SQLITE_OK;
+}
+
+static int memoryUnlock(sqlite3_file* f, int level) {
+    MemoryHandle* handle = (MemoryHandle*)f;
+    MemoryFile* file = handle->file;
+    std::lock_guard<std::mutex> lock(file->mutex);
+
+    if (handle->lockLevel <= level)
+        return SQLITE_OK;
+    if (file->reserved == handle)
+        file->reserved = NULL;
+    if (file->pending == handle)
+        file->pending = NULL;
+    if (file->exclusive == handle)
+        file->exclusive = NULL;
+    if (level == SQLITE_LOCK_NONE)
+        file->sharedLocks--;
+    handle->lockLevel = level;
+    return SQLITE_OK;
+}
+
+static int memoryCheckReservedLock(sqlite3_file* f, int* result) {
+    MemoryFile* file = ((MemoryHandle*)f)->file;
+    std::lock_guard<std::mutex> lock(file->mutex);
+    *result = file->reserved || file->pending || file->exclusive;
+    return SQLITE_OK;
+}
+
+static int memoryFileControl(sqlite3_file* f, int op, void* arg) {
+    return SQLITE_NOTFOUND;
+}
+
+static int memorySectorSize(sqlite3_file* f) {
+    return 0;
+}
+
+static int memoryDeviceCharacteristics(sqlite3_file* f) {
+    return SQLITE_IOCAP_ATOMIC | SQLITE_IOCAP_SAFE_APPEND | SQLITE_IOCAP_SEQUENTIAL |
+           SQLITE_IOCAP_POWERSAFE_OVERWRITE;
+}
+
+static int memoryShmMap(sqlite3_file* f, int region, int size, int extend, void volatile** memory) {
+    MemoryHandle* handle = (MemoryHandle*)f;
+    MemoryFile* file = handle->file;
+    std::lock_guard<std::mutex> lock(file->mutex);
+
+    if (file->shmRegions.empty())
+        file->shmRegionSize = size;
+    else if (size != file->shmRegionSize)
+        return SQLITE_IOERR_SHMSIZE;
+    while ((int)file->shmRegions.size() <= region) {
+        if (!extend) {
+            *memory = NULL;
+            return SQLITE_OK;
+        }
+        if (!handle->vfs->reserve(size))
+            return SQLITE_NOMEM;
+        char* shm = (char*)calloc(1, size);
+        if (!shm) {
+            handle->vfs->release(size);
+            return SQLITE_NOMEM;
+        }
+        file->shmRegions.push_back(shm);
+    }
+    *memory = file->shmRegions[region];
+    return SQLITE_OK;
+}
+
+static int memoryShmLock(sqlite3_file* f, int offset, int n, int flags) {
+    MemoryHandle* handle = (MemoryHandle*)f;
+    MemoryFile* file = handle->file;
+    std::lock_guard<std::mutex> lock(file->mutex);
+
+    int mask = (1 << (offset + n)) - (1 << offset);
+    if (flags & SQLITE_SHM_UNLOCK) {
+        for (int i = offset; i < offset + n; i++) {
+            if (handle->shmExclusiveMask & (1 << i))
+                file->shmExclusive[i] = NULL;
+            if (handle->shmSharedMask & (1 << i))
+                file->shmShared[i]--;
+        }
+        handle->shmExclusiveMask &= ~mask;
+        handle->shmSharedMask &= ~mask;
+    } else if (flags & SQLITE_SHM_SHARED) {
+        // SQLite takes shared locks one at a time.
+        if (handle->shmSharedMask & mask)
+            return SQLITE_OK;
+        if (file->shmExclusive[offset] && file->shmExclusive[offset] != handle)
+            return SQLITE_BUSY;
+        file->shmShared[offset]++;
+        handle->shmSharedMask |= mask;
+    } else {
+        for (int i = offset; i < offset + n; i++) {
+            int others = file->shmShared[i] - ((handle->shmSharedMask >> i) & 1);
+            if ((file->shmExclusive[i] && file->shmExclusive[i] != handle) || others > 0)
+                return SQLITE_BUSY;
+        }
+        for (int i = offset; i < offset + n; i++)
+            file->shmExclusive[i] = handle;
+        handle->shmExclusiveMask |= mask;
+    }
+    return SQLITE_OK;
+}
+
+static void memoryShmBarrier(sqlite3_file* f) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+// The shared memory stays with the file when the last connection unmaps it, as it would in the
+// -shm file on disk; SQLite only asks for it to be deleted when it no longer needs it.
+static int memoryShmUnmap(sqlite3_file* f, int deleteFlag) {
+    MemoryHandle* handle = (MemoryHandle*)f;
+    if (handle->shmSharedMask || handle->shmExclusiveMask)
+        memoryShmLock(f, 0, SQLITE_SHM_NLOCK, SQLITE_SHM_UNLOCK | SQLITE_SHM_EXCLUSIVE);
+    if (!deleteFlag)
+        return SQLITE_OK;
+
+    MemoryFile* file = handle->file;
+    int64_t freed = 0;
+    {
+        std::lock_guard<std::mutex> lock(file->mutex);
+        for (int i = 0; i < SQLITE_SHM_NLOCK; i++) {
+            if (file->shmShared[i] || file->shmExclusive[i])
+                return SQLITE_OK;
+        }
+        for (size_t i = 0; i < file->shmRegions.size(); i++)
+            free(file->shmRegions[i]);
+        freed = (int64_t)file->shmRegions.size() * file->shmRegionSize;
+        file->shmRegions.clear();
+    }
+    handle->vfs->release(freed);
+    return SQLITE_OK;
+}
+
+static const sqlite3_io_methods kMemoryFileMethods = {
+    2,
+    memoryClose,
+    memoryRead,
+    memoryWrite,
+    memoryTruncate,
+    memorySync,
+    memoryFileSize,
+    memoryLock,
+    memoryUnlock,
+    memoryCheckReservedLock,
+    memoryFileControl,
+    memorySectorSize,
+    memoryDeviceCharacteristics,
+    memoryShmMap,
+    memoryShmLock,
+    memoryShmBarrier,
+    memoryShmUnmap,
+};
+
+/**
+ * </MemoryHandle>
+ */
+
+/**
+ * <MemoryVfs>
+ */
+
+static int memoryVfsOpen(sqlite3_vfs* v, const char* name, sqlite3_file* f, int flags, int* outFlags) {
+    MemoryVfs* vfs = (MemoryVfs*)vfs_shim_owner(v);
+    MemoryHandle* handle = (MemoryHandle*)f;
+    memset(handle, 0, sizeof(MemoryHandle));
+
+    MemoryFile* file;
+    {
+        std::lock_guard<std::mutex> lock(vfs->filesMutex);
+        if (!name) {
+            file = new MemoryFile(std::string());
+        } else {
+            std::map<std::string, MemoryFile*>::iterator i = vfs->files.find(name);
+            if (i != vfs->files.end()) {
+                if ((flags & SQLITE_OPEN_EXCLUSIVE) && (flags & SQLITE_OPEN_CREATE))
+                    return SQLITE_CANTOPEN;
+                file = i->second;
+            } else {
+                if (!(flags & SQLITE_OPEN_CREATE))
+                    return SQLITE_CANTOPEN;
+                file = new MemoryFile(name);
+                vfs->files[name] = file;
+            }
+        }
+        file->refs++;
+    }
+
+    handle->vfs = vfs;
+    handle->file = file;
+    handle->deleteOnClose = name && (flags & SQLITE_OPEN_DELETEONCLOSE);
+    handle->base.pMethods = &kMemoryFileMethods;
+    if (outFlags)
+        *outFlags = flags;
+    return SQLITE_OK;
+}
+
+static int memoryVfsDelete(sqlite3_vfs* v, const char* name, int syncDir) {
+    MemoryVfs* vfs = (MemoryVfs*)vfs_shim_owner(v);
+    int64_t freed = 0;
+    {
+        std::lock_guard<std::mutex> lock(vfs->filesMutex);
+        std::map<std::string, MemoryFile*>::iterator i = vfs->files.find(name);
+        if (i == vfs->files.end())
+            return SQLITE_IOERR_DELETE_NOENT;
+        MemoryFile* file = i->second;
+        vfs->files.erase(i);
+        file->deleted = true;
+        if (file->refs == 0)
+            freed = freeFile(file);
+    }
+    vfs->release(freed);
+    return SQLITE_OK;
+}
+
+static int memoryVfsAccess(sqlite3_vfs* v, const char* name, int flags, int* result) {
+    MemoryVfs* vfs = (MemoryVfs*)vfs_shim_owner(v);
+    std::lock_guard<std::mutex> lock(vfs->filesMutex);
+    *result = vfs->files.find(name) != vfs->files.end();
+    return SQLITE_OK;
+}
+
+// Names are only keys, so they are their own full pathnames.
+static int memoryVfsFullPathname(sqlite3_vfs* v, const char* name, int size, char* out) {
+    if ((int)strlen(name) >= size)
+        return SQLITE_CANTOPEN;
+    strcpy(out, name);
+    return SQLITE_OK;
+}
+
+MemoryVfs::MemoryVfs(sqlite3_vfs* base, const char* name, int64_t maxBytes) :
+name(name), maxBytes(maxBytes), memoryUsed(0), memoryHighwater(0) {
+    init_vfs_shim(&shim, base, this->name.c_str(), (int)sizeof(MemoryHandle), memoryVfsOpen, this);
+    shim.vfs.xDelete = memoryVfsDelete;
+    shim.vfs.xAccess = memoryVfsAccess;
+    shim.vfs.xFullPathname = memoryVfsFullPathname;
+}
+
+MemoryVfs* MemoryVfs::create(const char* name, int64_t maxBytes) {
+    sqlite3_vfs* base = sqlite3_vfs_find(NULL);
+    if (!base)
+        return NULL;
+    MemoryVfs* vfs = new MemoryVfs(base, name, maxBytes > 0 ? maxBytes : 0);
+    if (!register_vfs_shim(&vfs->shim)) {
+        delete vfs;
+        return NULL;
+    }
+    return vfs;
+}
+
+MemoryVfs::~MemoryVfs() {
+    unregister_vfs_shim(&shim);
+    for (std::map<std::string, MemoryFile*>::iterator i = files.begin(); i != files.end(); ++i)
+        freeFile(i->second);
+}
+
+bool MemoryVfs::reserve(int64_t bytes) {
+    std::lock_guard<std::mutex> lock(memoryMutex);
+    if (maxBytes > 0 && memoryUsed + bytes > maxBytes)
+        return false;
+    memoryUsed += bytes;
+    if (memoryUsed > memoryHighwater)
+        memoryHighwater = memoryUsed;
+    return true;
+}
+
+void MemoryVfs::release(int64_t bytes) {
+    if (bytes == 0)
+        return;
+    std::lock_guard<std::mutex> lock(memoryMutex);
+    memoryUsed -= bytes;
+}
+
+void MemoryVfs::getStats(int64_t* stats) {
+    {
+        std::lock_guard<std::mutex> lock(filesMutex);
+        stats[STAT_FILES] = (int64_t)files.size();
+    }
+    std::lock_guard<std::mutex> lock(memoryMutex);
+    stats[STAT_MEMORY_USED] = memoryUsed;
+    stats[STAT_MEMORY_HIGHWATER] = memoryHighwater;
+    stats[STAT_MAX_BYTES] = maxBytes;
+}
+
+bool MemoryVfs::remove(const char* dbName) {
+    static const char* const suffixes[] = { "", "-journal", "-wal" };
+    bool found = false;
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        std::string path = std::string(dbName) + suffixes[i];
+        if (memoryVfsDelete(&shim.vfs, path.c_str(), 0) == SQLITE_OK && i == 0)
+            found = true;
+    }
+    return found;
+}
+
+// Copies all of the main database of source into that of destination.
+static int copyDatabase(const char* sourcePath, const char* sourceVfs,
+                        const char* destinationPath, const char* destinationVfs) {
+    sqlite3* source = NULL;
+    sqlite3* destination = NULL;
+    int err = sqlite3_open_v2(sourcePath, &source, SQLITE_OPEN_READONLY, sourceVfs);
+    if (err == SQLITE_OK)
+        err = sqlite3_open_v2(destinationPath, &destination,
+                              SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, destinationVfs);
+    if (err == SQLITE_OK) {
+        sqlite3_busy_timeout(source, COPY_BUSY_TIMEOUT_MS);
+        sqlite3_busy_timeout(destination, COPY_BUSY_TIMEOUT_MS);
+        sqlite3_backup* backup = sqlite3_backup_init(destination, "main", source, "main");
+        if (backup) {
+            err = sqlite3_backup_step(backup, -1);
+            int finishErr = sqlite3_backup_finish(backup);
+            err = err == SQLITE_DONE ? finishErr : err;
+        } else {
+            err = sqlite3_errcode(destination);
+        }
+    }
+    sqlite3_close(destination);
+    sqlite3_close(source);
+    return err;
+}
+
+int MemoryVfs::save(const char* dbName, const char* path) {
+    return copyDatabase(dbName, name.c_str(), path, NULL);
+}
+
+int MemoryVfs::load(const char* path, const char* dbName) {
+    return copyDatabase(path, NULL, dbName, name.c_str());
+}
+
+/**
+ * </MemoryVfs>
+ */
@@ -0,0 +1,477 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  Rows are serialized big-endian, as java.nio.ByteBuffer reads them by default:
+//
+//    int32 columnCount, int32 rowCount, then each row's values in column order, each a type byte
+//    followed by its data: 0 (null), 1 (int64), 2 (float64), 3 (int32 length, then UTF-8 text) or
+//    4 (int32 length, then blob).
+//
+//  The tables a query reads come from the authorizer, which reports each column it reads, and
+//  from the query's program, since a query like "SELECT count(*) FROM docs" reads no column: each
+//  OpenRead opcode names the root page of a table or index. Queries calling a function whose
+//  result can change between calls (random(), date('now'), ...) and PRAGMAs are never cached, nor
+//  are queries of WITHOUT ROWID tables, whose changes SQLite doesn't report to the update hook.
+//  Virtual tables are only known to the authorizer, and their changes are reported to the update
+//  hook as changes to their shadow tables, so a change to "docs_fts_content" also invalidates
+//  queries of "docs_fts". Results are only stored outside transactions, so that no entry ever
+//  holds uncommitted rows.
+//
+
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+
+#include "sqlite_result_cache.h"
+
+enum {
+    VALUE_NULL          = 0,
+    VALUE_INTEGER       = 1,
+    VALUE_FLOAT         = 2,
+    VALUE_TEXT          = 3,
+    VALUE_BLOB          = 4,
+};
+
+// Rough bookkeeping cost of an entry, on top of its key and rows.
+static const size_t ENTRY_OVERHEAD = 96;
+
+static std::string lowercase(const char* str) {
+    std::string lower(str);
+    for (size_t i = 0; i < lower.size(); i++)
+        lower[i] = (char)tolower((unsigned char)lower[i]);
+    return lower;
+}
+
+static int authorizerCallback(void* data, int action, const char* arg1, const char* arg2,
+                              const char* database, const char* trigger) {
+    return static_cast<ResultCache*>(data)->authorize(action, arg1, arg2);
+}
+
+static bool isVolatileFunction(const char* name) {
+    static const char* const names[] = {
+        "random", "randomblob", "changes", "total_changes", "last_insert_rowid",
+        "date", "time", "datetime", "julianday", "strftime",
+        "current_date", "current_time", "current_timestamp"
+    };
+    std::string lower = lowercase(name);
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (lower == names[i])
+            return true;
+    }
+    return false;
+}
+
+static void appendInt32(std::string& out, uint32_t n) {
+    char bytes[4] = { (char)(n >> 24), (char)(n >> 16), (char)(n >> 8), (char)n };
+    out.append(bytes, 4);
+}
+
+static void appendInt64(std::string& out, uint64_t n) {
+    appendInt32(out, (uint32_t)(n >> 32));
+    appendInt32(out, (uint32_t)n);
+}
+
+int serialize_rows(sqlite3_stmt* statement, std::string& rows) {
+    int columns = sqlite3_column_count(statement);
+    rows.clear();
+    appendInt32(rows, columns);
+    appendInt32(rows, 0);
+    uint32_t count = 0;
+    int err;
+    while ((err = sqlite3_step(statement)) == SQLITE_ROW) {
+        for (int i = 0; i < columns; i++) {
+            switch (sqlite3_column_type(statement, i)) {
+                case SQLITE_INTEGER:
+                    rows += (char)VALUE_INTEGER;
+                    appendInt64(rows, (uint64_t)sqlite3_column_int64(statement, i));
+                    break;
+                case SQLITE_FLOAT: {
+                    double value = sqlite3_column_double(statement, i);
+                    uint64_t bits;
+                    memcpy(&bits, &value, sizeof(bits));
+                    rows += (char)VALUE_FLOAT;
+                    appendInt64(rows, bits);
+                    break;
+                }
+                case SQLITE_TEXT: {
+                    const char* text = (const char*)sqlite3_column_text(statement, i);
+                    int length = sqlite3_column_bytes(statement, i);
+                    rows += (char)VALUE_TEXT;
+                    appendInt32(rows, length);
+                    rows.append(text, length);
+                    break;
+                }
+                case SQLITE_BLOB: {
+                    const char* blob = (const char*)sqlite3_column_blob(statement, i);
+                    int length = sqlite3_column_bytes(statement, i);
+                    rows += (char)VALUE_BLOB;
+                    appendInt32(rows, length);
+                    if (length > 0)
+                        rows.append(blob, length);
+                    break;
+                }
+                default:
+                    rows += (char)VALUE_NULL;
+                    break;
+            }
+        }
+        count++;
+    }
+    std::string countBytes;
+    appendInt32(countBytes, count);
+    rows.replace(4, 4, countBytes);
+    return err;
+}
+
+// Names the tables whose root pages a statement's program opens for reading. Returns false if
+// they can't all be named, or sets virtualTables if it opens any virtual table.
+static bool explainTables(sqlite3* db, sqlite3_stmt* statement, std::vector<std::string>& tables,
+                          bool& virtualTables) {
+    char* sql = sqlite3_mprintf("EXPLAIN %s", sqlite3_sql(statement));
+    if (!sql)
+        return false;
+    sqlite3_stmt* explain;
+    int err = sqlite3_prepare_v2(db, sql, -1, &explain, NULL);
+    sqlite3_free(sql);
+    if (err != SQLITE_OK)
+        return false;
+    std::vector<std::pair<int, int> > roots;   // Database index, root page
+    bool ok = true;
+    while ((err = sqlite3_step(explain)) == SQLITE_ROW) {
+        const char* opcode = (const char*)sqlite3_column_text(explain, 1);
+        if (!opcode)
+            continue;
+        if (strcmp(opcode, "OpenRead") == 0) {
+            int database = sqlite3_column_int(explain, 4);
+            if (database > 1)
+                ok = false;     // An attached database
+            roots.push_back(std::make_pair(database, sqlite3_column_int(explain, 3)));
+        } else if (strcmp(opcode, "VOpen") == 0) {
+            virtualTables = true;
+        }
+    }
+    sqlite3_finalize(explain);
+    if (err != SQLITE_DONE || !ok)
+        return false;
+
+    for (size_t i = 0; i < roots.size() && ok; i++) {
+        if (roots[i].second == 1) {
+            tables.push_back("sqlite_master");
+            continue;
+        }
+        sqlite3_stmt* lookup;
+        const char* query = roots[i].first == 0
+            ? "SELECT tbl_name FROM main.sqlite_master WHERE rootpage=?"
+            : "SELECT tbl_name FROM sqlite_temp_master WHERE rootpage=?";
+        if (sqlite3_prepare_v2(db, query, -1, &lookup, NULL) != SQLITE_OK)
+            return false;
+        sqlite3_bind_int(lookup, 1, roots[i].second);
+        if (sqlite3_step(lookup) == SQLITE_ROW)
+            tables.push_back((const char*)sqlite3_column_text(lookup, 0));
+        else
+            ok = false;
+        sqlite3_finalize(lookup);
+    }
+    return ok;
+}
+
+// Whether every table has a rowid. The update hook isn't called for changes to WITHOUT ROWID
+// tables, which is how such a table tells: selecting its rowid fails to prepare.
+static bool haveRowids(sqlite3* db, const std::vector<std::string>& tables) {
+    for (size_t i = 0; i < tables.size(); i++) {
+        char* sql = sqlite3_mprintf("SELECT rowid, oid, _rowid_ FROM \"%w\"", tables[i].c_str());
+        if (!sql)
+            return false;
+        sqlite3_stmt* probe;
+        int err = sqlite3_prepare_v2(db, sql, -1, &probe, NULL);
+        sqlite3_free(sql);
+        sqlite3_finalize(probe);
+        if (err != SQLITE_OK)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * <ResultCache>
+ */
+
+ResultCache::ResultCache(size_t budget) :
+budget(budget), bytes(0), preparing(false), dataVersionStatement(NULL), dataVersion(-1) {
+    memset(stats, 0, sizeof(stats));
+}
+
+ResultCache::~ResultCache() {
+}
+
+void ResultCache::attach(sqlite3* db) {
+    sqlite3_set_authorizer(db, &authorizerCallback, this);
+}
+
+void ResultCache::finalize(sqlite3* db) {
+    sqlite3_set_authorizer(db, NULL, NULL);
+    sqlite3_finalize(dataVersionStatement);
+    dataVersionStatement = NULL;
+}
+
+int ResultCache::tableId(const std::string& name) {
+    std::map<std::string, int>::iterator found = tableIds.find(name);
+    if (found != tableIds.end())
+        return found->second;
+    int id = (int)tableNames.size();
+    tableNames.push_back(name);
+    tableVersions.push_back(0);
+    tableIds[name] = id;
+    lastChanged.clear();    // It may be a prefix of the last table changed
+    return id;
+}
+
+void ResultCache::beginPrepare() {
+    std::lock_guard<std::mutex> lock(mutex);
+    preparing = true;
+    prepared.cacheable = true;
+    prepared.changesSchema = false;
+    authorizedTables.clear();
+}
+
+int ResultCache::authorize(int action, const char* arg1, const char* arg2) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!preparing)
+        return SQLITE_OK;
+    switch (action) {
+        case SQLITE_READ:
+            authorizedTables.push_back(arg1);
+            break;
+        case SQLITE_FUNCTION:
+            if (arg2 && isVolatileFunction(arg2))
+                prepared.cacheable = false;
+            break;
+        case SQLITE_PRAGMA:
+            prepared.cacheable = false;
+            break;
+        case SQLITE_CREATE_INDEX:       case SQLITE_CREATE_TABLE:
+        case SQLITE_CREATE_TEMP_INDEX:  case SQLITE_CREATE_TEMP_TABLE:
+        case SQLITE_CREATE_TEMP_TRIGGER:case SQLITE_CREATE_TEMP_VIEW:
+        case SQLITE_CREATE_TRIGGER:     case SQLITE_CREATE_VIEW:
+        case SQLITE_DROP_INDEX:         case SQLITE_DROP_TABLE:
+        case SQLITE_DROP_TEMP_INDEX:    case SQLITE_DROP_TEMP_TABLE:
+        case SQLITE_DROP_TEMP_TRIGGER:  case SQLITE_DROP_TEMP_VIEW:
+        case SQLITE_DROP_TRIGGER:       case SQLITE_DROP_VIEW:
+        case SQLITE_ALTER_TABLE:        case SQLITE_REINDEX:
+        case SQLITE_CREATE_VTABLE:      case SQLITE_DROP_VTABLE:
+        case SQLITE_ATTACH:             case SQLITE_DETACH:
+            prepared.changesSchema = true;
+            break;
+        default:
+            break;
+    }
+    return SQLITE_OK;
+}
+
+void ResultCache::endPrepare(sqlite3* db, sqlite3_stmt* statement) {
+    StatementInfo info;
+    std::vector<std::string> tables;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        preparing = false;  // Before running EXPLAIN, which the authorizer would see too
+        info = prepared;
+        tables.swap(authorizedTables);
+    }
+    if (!statement)
+        return;     // Nothing but whitespace or a comment
+    if (info.cacheable)
+        info.cacheable = sqlite3_stmt_readonly(statement) && sqlite3_column_count(statement) > 0;
+    if (info.cacheable) {
+        bool virtualTables = false;
+        size_t authorized = tables.size();
+        info.cacheable = explainTables(db, statement, tables, virtualTables) &&
+                         (!virtualTables || authorized > 0) && haveRowids(db, tables);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (info.cacheable) {
+        for (size_t i = 0; i < tables.size(); i++) {
+            int id = tableId(lowercase(tables[i].c_str()));
+            if (std::find(info.tables.begin(), info.tables.end(), id) == info.tables.end())
+                info.tables.push_back(id);
+        }
+    }
+    if (info.cacheable || info.changesSchema)
+        statements[statement] = info;
+    else
+        statements.erase(statement);
+}
+
+void ResultCache::statementFinalized(sqlite3_stmt* statement) {
+    std::lock_guard<std::mutex> lock(mutex);
+    statements.erase(statement);
+}
+
+void ResultCache::noteBind(sqlite3_stmt* statement, int index, char type, const void* data, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_map<sqlite3_stmt*, StatementInfo>::iterator found = statements.find(statement);
+    if (found == statements.end() || !found->second.cacheable || index < 1)
+        return;
+    std::vector<std::string>& binds = found->second.binds;
+    if ((size_t)index > binds.size())
+        binds.resize(index);
+    std::string& bind = binds[index - 1];
+    bind.assign(1, type);
+    bind.append((const char*)data, size);
+}
+
+void ResultCache::clearBinds(sqlite3_stmt* statement) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_map<sqlite3_stmt*, StatementInfo>::iterator found = statements.find(statement);
+    if (found != statements.end())
+        found->second.binds.clear();
+}
+
+void ResultCache::statementExecuted(sqlite3_stmt* statement) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_map<sqlite3_stmt*, StatementInfo>::iterator found = statements.find(statement);
+    if (found != statements.end() && found->second.changesSchema)
+        clear();
+}
+
+void ResultCache::tableChanged(const char* table) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (lastChanged.empty() || lastChanged != table) {
+        lastChanged = table;
+        lastChangedIds.clear();
+        std::string name = lowercase(table);
+        // The table itself, and any virtual table whose shadow table it could be.
+        for (size_t end = name.find('_'); ; end = name.find('_', end + 1)) {
+            std::map<std::string, int>::iterator found = tableIds.find(name.substr(0, end));
+            if (found != tableIds.end())
+                lastChangedIds.push_back(found->second);
+            if (end == std::string::npos)
+                break;
+        }
+    }
+    for (size_t i = 0; i < lastChangedIds.size(); i++)
+        tableVersions[lastChangedIds[i]]++;
+}
+
+void ResultCache::clear() {
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+void ResultCache::evict(std::list<Entry>::iterator entry) {
+    bytes -= entry->key.size() + entry->rows.size() + ENTRY_OVERHEAD;
+    index.erase(entry->key);
+    entries.erase(entry);
+}
+
+bool ResultCache::cacheKey(sqlite3_stmt* statement, std::string& key, std::vector<int>& tables) {
+    std::unordered_map<sqlite3_stmt*, StatementInfo>::iterator found = statements.find(statement);
+    if (found == statements.end() || !found->second.cacheable)
+        return false;
+    const StatementInfo& info = found->second;
+    key = sqlite3_sql(statement);
+    key += '\0';
+    for (size_t i = 0; i < info.binds.size(); i++) {
+        const std::string& bind = info.binds[i].empty() ? std::string(1, 'N') : info.binds[i];
+        char length[4] = { (char)(bind.size() >> 24), (char)(bind.size() >> 16),
+                           (char)(bind.size() >> 8), (char)bind.size() };
+        key.append(length, 4);
+        key += bind;
+    }
+    tables = info.tables;
+    return true;
+}
+
+void ResultCache::store(const std::string& key, const std::string& rows,
+                        const std::vector<std::pair<int, uint32_t> >& versions) {
+    size_t size = key.size() + rows.size() + ENTRY_OVERHEAD;
+    if (size > budget / 4)
+        return;     // Would push out too much else
+    std::unordered_map<std::string, std::list<Entry>::iterator>::iterator found = index.find(key);
+    if (found != index.end())
+        evict(found->second);
+    Entry entry;
+    entry.key = key;
+    entry.rows = rows;
+    entry.tableVersions = versions;
+    entries.push_front(entry);
+    index[key] = entries.begin();
+    bytes += size;
+    while (bytes > budget) {
+        evict(--entries.end());
+        stats[STAT_EVICTIONS]++;
+    }
+}
+
+int ResultCache::execute(sqlite3* db, sqlite3_stmt* statement, std::string& rows) {
+    // Another connection may have committed since the last query.
+    sqlite3_int64 version = -1;
+    if (!dataVersionStatement)
+        sqlite3_prepare_v2(db, "PRAGMA data_version", -1, &dataVersionStatement, NULL);
+    if (dataVersionStatement) {
+        if (sqlite3_step(dataVersionStatement) == SQLITE_ROW)
+            version = sqlite3_column_int64(dataVersionStatement, 0);
+        sqlite3_reset(dataVersionStatement);
+    }
+
+    std::string key;
+    std::vector<int> tables;
+    std::vector<std::pair<int, uint32_t> > versions;
+    bool cacheable;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (version < 0 || version != dataVersion) {
+            clear();
+            dataVersion = version;
+        }
+        cacheable = version >= 0 && cacheKey(statement, key, tables);
+        if (!cacheable) {
+            stats[STAT_UNCACHEABLE]++;
+        } else {
+            for (size_t i = 0; i < tables.size(); i++)
+                versions.push_back(std::make_pair(tables[i], tableVersions[tables[i]]));
+            std::unordered_map<std::string, std::list<Entry>::iterator>::iterator found = index.find(key);
+            if (found != index.end()) {
+                std::list<Entry>::iterator entry = found->second;
+                if (entry->tableVersions == versions) {
+                    stats[STAT_HITS]++;
+                    entries.splice(entries.begin(), entries, entry);
+                    rows = entry->rows;
+                    return SQLITE_DONE;
+                }
+                evict(entry);
+                stats[STAT_INVALIDATIONS]++;
+            }
+            stats[STAT_MISSES]++;
+        }
+    }
+
+    int err = serialize_rows(statement, rows);
+    if (err == SQLITE_DONE && cacheable && sqlite3_get_autocommit(db)) {
+        // Stored with the table versions from before it ran, so that a change made meanwhile
+        // leaves it stale.
+        std::lock_guard<std::mutex> lock(mutex);
+        store(key, rows, versions);
+    }
+    return err;
+}
+
+void ResultCache::getStats(uint64_t* out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    memcpy(out, stats, sizeof(stats));
+    out[STAT_ENTRIES] = entries.size();
+    out[STAT_BYTES] = bytes;
+}
+
+/**
+ * </ResultCache>
+ */
@@ -0,0 +1,273 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  drain() returns JSON of the form
+//
+//    {"dropped": 0,
+//     "queries": [{"sql": "SELECT ...", "fingerprint": -4418...,  "binds": "I,T12,N",
+//                  "elapsedNanos": 25000000, "fullscanSteps": 9999, "sorts": 1,
+//                  "autoindexes": 0, "vmSteps": 120000, "plan": 0}, ...],
+//     "plans": {"0": "0|0|0|SCAN TABLE docs\n0|0|0|USE TEMP B-TREE FOR ORDER BY"}}
+//
+//  where "binds" lists the type of each parameter (Null, Integer, Float, Text or Blob) with the
+//  length of text and blobs, and "plans" has the text of each plan referenced by the queries
+//  ("plan" is -1 if it could not be captured). The JSON is pure ASCII, so it can be passed to
+//  NewStringUTF whatever the SQL contains.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <set>
+
+#include "sqlite_slow_query_log.h"
+#include "sqlite_trace.h"
+
+static const char* const kExplainPrefix = "EXPLAIN QUERY PLAN ";
+
+// (Android's gnustl has no std::to_string.)
+static std::string toString(long long n) {
+    char str[24];
+    snprintf(str, sizeof(str), "%lld", n);
+    return str;
+}
+
+SlowQueryLog::SlowQueryLog(int thresholdMillis) :
+thresholdMillis(thresholdMillis), dropped(0) {
+    memset(shapes, 0, sizeof(shapes));
+}
+
+static size_t shapeSlot(sqlite3_stmt* statement) {
+    return ((uintptr_t)statement >> 4) % SlowQueryLog::MAX_BIND_SHAPES;
+}
+
+void SlowQueryLog::noteBind(sqlite3_stmt* statement, int index, char type, int size) {
+    if (index < 1 || index > MAX_SHAPE_PARAMS)
+        index = 0;      // Only noted as a binding of the statement
+    sqlite3_mutex* mutex = sqlite3_db_mutex(sqlite3_db_handle(statement));
+    sqlite3_mutex_enter(mutex);
+    BindShape& shape = shapes[shapeSlot(statement)];
+    if (shape.statement != statement) {
+        memset(&shape, 0, sizeof(shape));
+        shape.statement = statement;
+    }
+    if (index > 0) {
+        shape.types[index - 1] = type;
+        shape.sizes[index - 1] = size;
+        if (index > shape.count)
+            shape.count = index;
+    }
+    sqlite3_mutex_leave(mutex);
+}
+
+void SlowQueryLog::clearBinds(sqlite3_stmt* statement) {
+    sqlite3_mutex* mutex = sqlite3_db_mutex(sqlite3_db_handle(statement));
+    sqlite3_mutex_enter(mutex);
+    BindShape& shape = shapes[shapeSlot(statement)];
+    if (shape.statement == statement)
+        shape.statement = NULL;
+    sqlite3_mutex_leave(mutex);
+}
+
+void SlowQueryLog::statementReset(sqlite3_stmt* statement) {
+    clearBinds(statement);
+    // The counters add up over every run of a statement, so start them over for the next one.
+    sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+    sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_SORT, 1);
+    sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+    sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_VM_STEP, 1);
+}
+
+static std::string describeBinds(const SlowQueryLog::BindShape& shape, sqlite3_stmt* statement) {
+    std::string binds;
+    int count = sqlite3_bind_parameter_count(statement);
+    bool known = shape.statement == statement;
+    for (int i = 0; i < count && i < SlowQueryLog::MAX_SHAPE_PARAMS; i++) {
+        if (i > 0)
+            binds += ',';
+        char type = known && shape.types[i] ? shape.types[i] : (known ? 'N' : '?');
+        binds += type;
+        if (type == 'T' || type == 'B')
+            binds += toString(shape.sizes[i]);
+    }
+    if (count > SlowQueryLog::MAX_SHAPE_PARAMS)
+        binds += ",...";
+    return binds;
+}
+
+void SlowQueryLog::statementFinished(sqlite3* db, const char* sql, int64_t elapsedNanos) {
+    int threshold = thresholdMillis;
+    if (threshold < 0 || elapsedNanos < threshold * 1000000LL || !sql)
+        return;
+    if (strncmp(sql, kExplainPrefix, strlen(kExplainPrefix)) == 0)
+        return;     // Our own plan capture
+
+    Entry entry;
+    entry.sql = sql;
+    entry.fingerprint = StatementTrace::fingerprint(sql, entry.sql.size());
+    entry.elapsedNanos = elapsedNanos;
+    entry.fullscanSteps = entry.sorts = entry.autoindexes = entry.vmSteps = -1;
+
+    // The profile callback only passes the SQL, but it is the statement's own copy, so the
+    // statement can be found among the connection's by comparing pointers.
+    for (sqlite3_stmt* statement = sqlite3_next_stmt(db, NULL); statement;
+         statement = sqlite3_next_stmt(db, statement)) {
+        if (sqlite3_sql(statement) == sql) {
+            entry.fullscanSteps = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+            entry.sorts = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_SORT, 1);
+            entry.autoindexes = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_AUTOINDEX, 1);
+            entry.vmSteps = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_VM_STEP, 1);
+            entry.binds = describeBinds(shapes[shapeSlot(statement)], statement);
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    entries.push_back(entry);
+    if (entries.size() > MAX_ENTRIES) {
+        entries.pop_front();
+        dropped++;
+    }
+}
+
+static bool capturePlan(sqlite3* db, const std::string& sql, std::string& plan) {
+    char* explain = sqlite3_mprintf("%s%s", kExplainPrefix, sql.c_str());
+    if (!explain)
+        return false;
+    sqlite3_stmt* statement;
+    int err = sqlite3_prepare_v2(db, explain, -1, &statement, NULL);
+    sqlite3_free(explain);
+    if (err != SQLITE_OK)
+        return false;
+    plan.clear();
+    while ((err = sqlite3_step(statement)) == SQLITE_ROW) {
+        char line[32];
+        snprintf(line, sizeof(line), "%d|%d|%d|", sqlite3_column_int(statement, 0),
+                 sqlite3_column_int(statement, 1), sqlite3_column_int(statement, 2));
+        const char* detail = (const char*)sqlite3_column_text(statement, 3);
+        if (!plan.empty())
+            plan += '\n';
+        plan += line;
+        plan += detail ? detail : "";
+    }
+    sqlite3_finalize(statement);
+    return err == SQLITE_DONE;
+}
+
+static void appendJSONString(std::string& json, const std::string& str) {
+    json += '"';
+    for (size_t i = 0; i < str.size(); ) {
+        unsigned char c = (unsigned char)str[i];
+        uint32_t code = c;
+        int length = 1;
+        if (c >= 0xF0 && i + 3 < str.size()) {
+            code = ((c & 0x07) << 18) | ((str[i + 1] & 0x3F) << 12) | ((str[i + 2] & 0x3F) << 6) |
+                   (str[i + 3] & 0x3F);
+            length = 4;
+        } else if (c >= 0xE0 && i + 2 < str.size()) {
+            code = ((c & 0x0F) << 12) | ((str[i + 1] & 0x3F) << 6) | (str[i + 2] & 0x3F);
+            length = 3;
+        } else if (c >= 0xC0 && i + 1 < str.size()) {
+            code = ((c & 0x1F) << 6) | (str[i + 1] & 0x3F);
+            length = 2;
+        } else if (c >= 0x80) {
+            code = 0xFFFD;
+        }
+        i += length;
+
+        char escape[16];
+        if (code == '"' || code == '\\') {
+            json += '\\';
+            json += (char)code;
+        } else if (code == '\n') {
+            json += "\\n";
+        } else if (code >= 0x20 && code < 0x80) {
+            json += (char)code;
+        } else if (code >= 0x10000) {
+            code -= 0x10000;
+            snprintf(escape, sizeof(escape), "\\u%04x\\u%04x",
+                     0xD800 + (code >> 10), 0xDC00 + (code & 0x3FF));
+            json += escape;
+        } else {
+            snprintf(escape, sizeof(escape), "\\u%04x", code);
+            json += escape;
+        }
+    }
+    json += '"';
+}
+
+std::string SlowQueryLog::drain(sqlite3* db) {
+    std::deque<Entry> batch;
+    uint64_t batchDropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch.swap(entries);
+        batchDropped = dropped;
+        dropped = 0;
+    }
+    if (batch.empty() && batchDropped == 0)
+        return std::string();
+
+    std::string json = "{\"dropped\":" + toString(batchDropped) + ",\"queries\":[";
+    std::set<int> referenced;
+    for (size_t i = 0; i < batch.size(); i++) {
+        const Entry& entry = batch[i];
+
+        // Capture the plan the first time each statement is seen. The mutex isn't held while
+        // doing so, since the profile callback takes it while SQLite holds the database's.
+        int planId = -1;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::map<uint64_t, int>::iterator found = planOfFingerprint.find(entry.fingerprint);
+            if (found != planOfFingerprint.end())
+                planId = found->second;
+        }
+        std::string plan;
+        if (planId < 0 && capturePlan(db, entry.sql, plan)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::map<std::string, int>::iterator found = planIds.find(plan);
+            if (found != planIds.end()) {
+                planId = found->second;
+            } else {
+                planId = (int)plans.size();
+                plans.push_back(plan);
+                planIds[plan] = planId;
+            }
+            planOfFingerprint[entry.fingerprint] = planId;
+        }
+        if (planId >= 0)
+            referenced.insert(planId);
+
+        if (i > 0)
+            json += ',';
+        json += "{\"sql\":";
+        appendJSONString(json, entry.sql);
+        json += ",\"fingerprint\":" + toString((int64_t)entry.fingerprint);
+        json += ",\"binds\":";
+        appendJSONString(json, entry.binds);
+        json += ",\"elapsedNanos\":" + toString(entry.elapsedNanos);
+        json += ",\"fullscanSteps\":" + toString(entry.fullscanSteps);
+        json += ",\"sorts\":" + toString(entry.sorts);
+        json += ",\"autoindexes\":" + toString(entry.autoindexes);
+        json += ",\"vmSteps\":" + toString(entry.vmSteps);
+        json += ",\"plan\":" + toString(planId) + "}";
+    }
+    json += "],\"plans\":{";
+    std::lock_guard<std::mutex> lock(mutex);
+    for (std::set<int>::iterator i = referenced.begin(); i != referenced.end(); ++i) {
+        if (i != referenced.begin())
+            json += ',';
+        json += "\"" + toString(*i) + "\":";
+        appendJSONString(json, plans[*i]);
+    }
+    json += "}}";
+    return json;
+}
@@ -0,0 +1,354 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  SQLite only uses a file from one thread at a time, so a TempFile needs no locking of its own;
+//  only the counters of its TempStore, which all of a connection's temp files share, are locked.
+//  Files that aren't temporary are opened by the default VFS into the same sqlite3_file, so after
+//  xOpen SQLite calls the default VFS's methods directly and the temp store costs them nothing.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sqlite_temp_store.h"
+
+static std::mutex sDirectoryMutex;
+static std::string sDirectory;
+
+void set_temp_store_directory(const char* directory) {
+    std::lock_guard<std::mutex> lock(sDirectoryMutex);
+    sDirectory = directory ? directory : "";
+}
+
+/**
+ * <TempFile>
+ */
+
+// A temporary file, held in chunks of memory until it is spilled to a real file.
+struct TempFile {
+    sqlite3_file base;
+    TempStore* store;
+    int flags;
+    char** chunks;
+    int chunkCount;
+    sqlite3_int64 size;
+    sqlite3_file* real;     // Opened by the default VFS once spilled, else NULL
+    char* path;             // Of the real file, which must outlive it
+};
+
+static void freeChunks(TempFile* file, int keep) {
+    if (file->chunkCount <= keep)
+        return;
+    for (int i = keep; i < file->chunkCount; i++)
+        sqlite3_free(file->chunks[i]);
+    file->store->release((int64_t)(file->chunkCount - keep) * TempStore::CHUNK_SIZE);
+    file->chunkCount = keep;
+    if (keep == 0) {
+        sqlite3_free(file->chunks);
+        file->chunks = NULL;
+    }
+}
+
+// Makes room for the file to grow to size bytes. Returns false if that would take the store over
+// its budget (or memory is short), in which case the file should be spilled.
+static bool growChunks(TempFile* file, sqlite3_int64 size) {
+    int needed = (int)((size + TempStore::CHUNK_SIZE - 1) / TempStore::CHUNK_SIZE);
+    if (needed <= file->chunkCount)
+        return true;
+    if (!file->store->reserve((int64_t)(needed - file->chunkCount) * TempStore::CHUNK_SIZE))
+        return false;
+    char** chunks = (char**)sqlite3_realloc(file->chunks, needed * (int)sizeof(char*));
+    if (!chunks) {
+        file->store->release((int64_t)(needed - file->chunkCount) * TempStore::CHUNK_SIZE);
+        return false;
+    }
+    file->chunks = chunks;
+    int count = file->chunkCount;
+    for (; count < needed; count++) {
+        chunks[count] = (char*)sqlite3_malloc(TempStore::CHUNK_SIZE);
+        if (!chunks[count])
+            break;
+        memset(chunks[count], 0, TempStore::CHUNK_SIZE);
+    }
+    if (count < needed)
+        file->store->release((int64_t)(needed - count) * TempStore::CHUNK_SIZE);
+    file->chunkCount = count;
+    return count == needed;
+}
+
+// Moves the file's contents to a new real file and frees its memory.
+static int spill(TempFile* file) {
+    TempStore* store = file->store;
+    sqlite3_file* real = (sqlite3_file*)sqlite3_malloc(store->base->szOsFile);
+    if (!real)
+        return SQLITE_NOMEM;
+    memset(real, 0, store->base->szOsFile);
+    char* path = NULL;
+    if (!store->directory.empty()) {
+        unsigned int random[2];
+        sqlite3_randomness(sizeof(random), random);
+        path = sqlite3_mprintf("%s/cbl-temp-%08x%08x", store->directory.c_str(), random[0], random[1]);
+        if (!path) {
+            sqlite3_free(real);
+            return SQLITE_NOMEM;
+        }
+    }
+    int flags = file->flags | SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_EXCLUSIVE
+              | SQLITE_OPEN_DELETEONCLOSE;
+    int err = store->base->xOpen(store->base, path, real, flags, NULL);
+    for (sqlite3_int64 offset = 0; err == SQLITE_OK && offset < file->size; offset += TempStore::CHUNK_SIZE) {
+        sqlite3_int64 amount = file->size - offset;
+        if (amount > TempStore::CHUNK_SIZE)
+            amount = TempStore::CHUNK_SIZE;
+        int index = (int)(offset / TempStore::CHUNK_SIZE);
+        if (index < file->chunkCount)
+            err = real->pMethods->xWrite(real, file->chunks[index], (int)amount, offset);
+    }
+    if (err == SQLITE_OK && file->size > (sqlite3_int64)file->chunkCount * TempStore::CHUNK_SIZE)
+        err = real->pMethods->xTruncate(real, file->size);
+    if (err != SQLITE_OK) {
+        if (real->pMethods)
+            real->pMethods->xClose(real);
+        sqlite3_free(real);
+        sqlite3_free(path);
+        return err;
+    }
+    store->spilled(1, file->size);
+    freeChunks(file, 0);
+    file->real = real;
+    file->path = path;
+    return SQLITE_OK;
+}
+
+static int tempClose(sqlite3_file* f) {
+    TempFile* file = (TempFile*)f;
+    int err = SQLITE_OK;
+    if (file->real) {
+        err = file->real->pMethods->xClose(file->real);
+        sqlite3_free(file->real);
+        sqlite3_free(file->path);
+        file->real = NULL;
+    }
+    freeChunks(file, 0);
+    return err;
+}
+
+static int tempRead(sqlite3_file* f, void* buffer, int amount, sqlite3_int64 offset) {
+    TempFile* file = (TempFile*)f;
+    if (file->real)
+        return file->real->pMethods->xRead(file->real, buffer, amount, offset);
+    char* out = (char*)buffer;
+    int available = offset < file->size ? (int)(amount < file->size - offset ? amount : file->size - offset) : 0;
+    for (int done = 0; done < available; ) {
+        sqlite3_int64 position = offset + done;
+        int index = (int)(position / TempStore::CHUNK_SIZE);
+        int start = (int)(position % TempStore::CHUNK_SIZE);
+        int length = TempStore::CHUNK_SIZE - start;
+        if (length > available - done)
+            length = available - done;
+        if (index < file->chunkCount)
+            memcpy(out + done, file->chunks[index] + start, length);
+        else
+            memset(out + done, 0, length);
+        done += length;
+    }
+    if (available < amount) {
+        memset(out + available, 0, amount - available);
+        return SQLITE_IOERR_SHORT_READ;
+    }
+    return SQLITE_OK;
+}
+
+static int tempWrite(sqlite3_file* f, const void* buffer, int amount, sqlite3_int64 offset) {
+    TempFile* file = (TempFile*)f;
+    if (!file->real && !growChunks(file, offset + amount)) {
+        int err = spill(file);
+        if (err != SQLITE_OK)
+            return err == SQLITE_NOMEM || err == SQLITE_FULL ? err : SQLITE_IOERR_WRITE;
+    }
+    if (file->real) {
+        file->store->spilled(0, amount);
+        return file->real->pMethods->xWrite(file->real, buffer, amount, offset);
+    }
+    const char* in = (const char*)buffer;
+    for (int done = 0; done < amount; ) {
+        sqlite3_int64 position = offset + done;
+        int index = (int)(position / TempStore::CHUNK_SIZE);
+        int start = (int)(position % TempStore::CHUNK_SIZE);
+        int length = TempStore::CHUNK_SIZE - start;
+        if (length > amount - done)
+            length = amount - done;
+        memcpy(file->chunks[index] + start, in + done, length);
+        done += length;
+    }
+    if (offset + amount > file->size)
+        file->size = offset + amount;
+    return SQLITE_OK;
+}
+
+static int tempTruncate(sqlite3_file* f, sqlite3_int64 size) {
+    TempFile* file = (TempFile*)f;
+    if (file->real)
+        return file->real->pMethods->xTruncate(file->real, size);
+    if (size < file->size) {
+        // Zero the tail of the last chunk kept, in case the file grows again.
+        int keep = (int)((size + TempStore::CHUNK_SIZE - 1) / TempStore::CHUNK_SIZE);
+        if (keep > 0 && keep <= file->chunkCount && size % TempStore::CHUNK_SIZE)
+            memset(file->chunks[keep - 1] + size % TempStore::CHUNK_SIZE, 0,
+                   TempStore::CHUNK_SIZE - size % TempStore::CHUNK_SIZE);
+        freeChunks(file, keep);
+    }
+    file->size = size;      // Growing needs no memory: unwritten chunks read as zeroes
+    return SQLITE_OK;
+}
+
+static int tempSync(sqlite3_file* f, int flags) {
+    TempFile* file = (TempFile*)f;
+    return file->real ? file->real->pMethods->xSync(file->real, flags) : SQLITE_OK;
+}
+
+static int tempFileSize(sqlite3_file* f, sqlite3_int64* size) {
+    TempFile* file = (TempFile*)f;
+    if (file->real)
+        return file->real->pMethods->xFileSize(file->real, size);
+    *size = file->size;
+    return SQLITE_OK;
+}
+
+// Temporary files belong to a single connection, so there is nothing to lock.
+static int tempLock(sqlite3_file* f, int lock) {
+    return SQLITE_OK;
+}
+
+static int tempCheckReservedLock(sqlite3_file* f, int* reserved) {
+    *reserved = 0;
+    return SQLITE_OK;
+}
+
+static int tempFileControl(sqlite3_file* f, int op, void* arg) {
+    TempFile* file = (TempFile*)f;
+    return file->real ? file->real->pMethods->xFileControl(file->real, op, arg) : SQLITE_NOTFOUND;
+}
+
+static int tempSectorSize(sqlite3_file* f) {
+    return 4096;
+}
+
+static int tempDeviceCharacteristics(sqlite3_file* f) {
+    return SQLITE_IOCAP_POWERSAFE_OVERWRITE;
+}
+
+static const sqlite3_io_methods kTempFileMethods = {
+    1,
+    tempClose,
+    tempRead,
+    tempWrite,
+    tempTruncate,
+    tempSync,
+    tempFileSize,
+    tempLock,
+    tempLock,
+    tempCheckReservedLock,
+    tempFileControl,
+    tempSectorSize,
+    tempDeviceCharacteristics,
+};
+
+/**
+ * </TempFile>
+ */
+
+/**
+ * <TempStore VFS>
+ */
+
+static int vfsOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* f, int flags, int* outFlags) {
+    TempStore* store = (TempStore*)vfs_shim_owner(vfs);
+    if (name || !(flags & SQLITE_OPEN_DELETEONCLOSE))
+        return store->base->xOpen(store->base, name, f, flags, outFlags);
+
+    TempFile* file = (TempFile*)f;
+    memset(file, 0, sizeof(TempFile));
+    file->store = store;
+    file->flags = flags & ~(SQLITE_OPEN_READONLY | SQLITE_OPEN_CREATE | SQLITE_OPEN_EXCLUSIVE |
+                            SQLITE_OPEN_DELETEONCLOSE | SQLITE_OPEN_READWRITE);
+    file->base.pMethods = &kTempFileMethods;
+    {
+        std::lock_guard<std::mutex> lock(store->mutex);
+        store->filesOpened++;
+    }
+    if (outFlags)
+        *outFlags = flags;
+    return SQLITE_OK;
+}
+
+/**
+ * </TempStore VFS>
+ */
+
+TempStore::TempStore(sqlite3_vfs* base, int64_t budget, const std::string& directory) :
+base(base), budget(budget), directory(directory), filesOpened(0), filesSpilled(0),
+bytesSpilled(0), memoryUsed(0), memoryHighwater(0) {
+    snprintf(name, sizeof(name), "cbl-temp-%p", (void*)this);
+    init_vfs_shim(&shim, base, name, (int)sizeof(TempFile), vfsOpen, this);
+}
+
+TempStore* TempStore::create(int64_t budget) {
+    sqlite3_vfs* base = sqlite3_vfs_find(NULL);
+    if (!base)
+        return NULL;
+    std::string directory;
+    {
+        std::lock_guard<std::mutex> lock(sDirectoryMutex);
+        directory = sDirectory;
+    }
+    TempStore* store = new TempStore(base, budget > 0 ? budget : 0, directory);
+    if (sqlite3_vfs_register(&store->shim.vfs, 0) != SQLITE_OK) {
+        delete store;
+        return NULL;
+    }
+    return store;
+}
+
+TempStore::~TempStore() {
+    sqlite3_vfs_unregister(&shim.vfs);
+}
+
+bool TempStore::reserve(int64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (memoryUsed + bytes > budget)
+        return false;
+    memoryUsed += bytes;
+    if (memoryUsed > memoryHighwater)
+        memoryHighwater = memoryUsed;
+    return true;
+}
+
+void TempStore::release(int64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    memoryUsed -= bytes;
+}
+
+void TempStore::spilled(int64_t files, int64_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    filesSpilled += files;
+    bytesSpilled += bytes;
+}
+
+void TempStore::getStats(int64_t* stats) {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats[STAT_FILES_OPENED] = filesOpened;
+    stats[STAT_FILES_SPILLED] = filesSpilled;
+    stats[STAT_BYTES_SPILLED] = bytesSpilled;
+    stats[STAT_MEMORY_USED] = memoryUsed;
+    stats[STAT_MEMORY_HIGHWATER] = memoryHighwater;
+    stats[STAT_BUDGET] = budget;
+}
@@ -0,0 +1,280 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  Each record of the ring is a seqlock: a writer claims the next index with an atomic increment,
+//  zeroes the record's sequence, fills it in and publishes it by storing index + 1. A reader
+//  copies a record and keeps it only if the sequence was index + 1 both before and after, so it
+//  never blocks a writer and never returns a torn record. (Only a writer stalled for a whole lap
+//  of the ring could collide with the next one to claim its record.)
+//
+
+#include <string.h>
+#include <ctype.h>
+#include <chrono>
+
+#include "sqlite_trace.h"
+
+/**
+ * <StatementTrace>
+ */
+
+StatementTrace::StatementTrace(uint32_t capacity, StatementTrace* previous) :
+records(new Record[capacity]), mask(capacity - 1), head(0), enabled(true),
+tail(0), dropped(0), previous(previous) {
+    for (uint32_t i = 0; i < capacity; i++)
+        records[i].sequence.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < MAX_CURSORS; i++)
+        cursors[i].statement.store(NULL, std::memory_order_relaxed);
+}
+
+StatementTrace::~StatementTrace() {
+    delete[] records;
+    delete previous;
+}
+
+int64_t StatementTrace::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void StatementTrace::record(sqlite3_stmt* statement, int64_t start, int64_t rows, int resultCode) {
+    int64_t end = now();
+    const char* sql = sqlite3_sql(statement);
+    uint64_t hash = fingerprint(sql, sql ? strlen(sql) : 0);
+
+    uint32_t index = head.fetch_add(1, std::memory_order_relaxed);
+    Record& record = records[index & mask];
+    record.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record.start = start;
+    record.end = end;
+    record.fingerprint = hash;
+    record.rows = rows;
+    record.resultCode = resultCode;
+    record.sequence.store(index + 1, std::memory_order_release);
+}
+
+void StatementTrace::cursorStep(sqlite3_stmt* statement, bool first, int64_t start, int resultCode) {
+    Cursor* cursor = NULL;
+    if (first) {
+        for (int i = 0; i < MAX_CURSORS && !cursor; i++) {
+            sqlite3_stmt* expected = NULL;
+            if (cursors[i].statement.compare_exchange_strong(expected, statement)) {
+                cursor = &cursors[i];
+                cursor->start = start;
+                cursor->rows = 0;
+            }
+        }
+    } else {
+        for (int i = 0; i < MAX_CURSORS && !cursor; i++) {
+            if (cursors[i].statement.load(std::memory_order_relaxed) == statement)
+                cursor = &cursors[i];
+        }
+    }
+    if (!cursor)
+        return;     // Too many cursors in progress, or started before tracing was enabled
+    if (resultCode == SQLITE_ROW) {
+        cursor->rows++;
+    } else {
+        record(statement, cursor->start, cursor->rows, resultCode);
+        cursor->statement.store(NULL, std::memory_order_release);
+    }
+}
+
+void StatementTrace::cursorReset(sqlite3_stmt* statement) {
+    for (int i = 0; i < MAX_CURSORS; i++) {
+        if (cursors[i].statement.load(std::memory_order_relaxed) == statement) {
+            record(statement, cursors[i].start, cursors[i].rows, SQLITE_ROW);
+            cursors[i].statement.store(NULL, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+int StatementTrace::drain(int64_t* fields, int maxRecords) {
+    std::lock_guard<std::mutex> lock(drainMutex);
+    uint32_t capacity = mask + 1;
+    uint32_t end = head.load(std::memory_order_acquire);
+    if (end - tail > capacity) {
+        dropped += end - tail - capacity;
+        tail = end - capacity;
+    }
+    int count = 0;
+    while (tail != end && count < maxRecords) {
+        Record& record = records[tail & mask];
+        uint32_t sequence = record.sequence.load(std::memory_order_acquire);
+        if (sequence != tail + 1) {
+            if ((int32_t)(sequence - (tail + 1)) > 0) {
+                dropped++;  // Already overwritten by a later statement
+                tail++;
+                continue;
+            }
+            break;          // Still being written
+        }
+        int64_t* out = fields + count * FIELD_COUNT;
+        out[FIELD_START_NANOS] = record.start;
+        out[FIELD_END_NANOS] = record.end;
+        out[FIELD_FINGERPRINT] = (int64_t)record.fingerprint;
+        out[FIELD_ROWS] = record.rows;
+        out[FIELD_RESULT_CODE] = record.resultCode;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (record.sequence.load(std::memory_order_relaxed) == sequence)
+            count++;
+        else
+            dropped++;      // Overwritten while being copied
+        tail++;
+    }
+    return count;
+}
+
+static bool isIdentifierChar(unsigned char c) {
+    return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+uint64_t StatementTrace::fingerprint(const char* sql, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    unsigned char last = 0;
+    bool space = false;
+    size_t i = 0;
+    while (i < length && sql[i]) {
+        unsigned char c = (unsigned char)sql[i];
+        if (isspace(c)) {
+            space = true;
+            i++;
+            continue;
+        }
+        if (c == '\'') {
+            // String literal, with '' as an escaped quote
+            for (i++; i < length && sql[i]; i++) {
+                if (sql[i] == '\'') {
+                    if (i + 1 < length && sql[i + 1] == '\'')
+                        i++;
+                    else
+                        break;
+                }
+            }
+            i++;
+            c = '?';
+        } else if ((isdigit(c) || (c == '.' && i + 1 < length && isdigit((unsigned char)sql[i + 1])))
+                   && !isIdentifierChar(last)) {
+            // Numeric literal, including hex and exponents
+            while (i < length && (isalnum((unsigned char)sql[i]) || sql[i] == '.' ||
+                   ((sql[i] == '+' || sql[i] == '-') && (sql[i - 1] == 'e' || sql[i - 1] == 'E'))))
+                i++;
+            c = '?';
+        } else if (c == '?' || c == ':' || c == '@' || c == '$') {
+            // Bound parameter, numbered or named
+            for (i++; i < length && isIdentifierChar((unsigned char)sql[i]); i++)
+                ;
+            c = '?';
+        } else {
+            c = (unsigned char)tolower(c);
+            i++;
+        }
+        if (space && isIdentifierChar(last) && isIdentifierChar(c)) {
+            hash = (hash ^ ' ') * 1099511628211ULL;
+        }
+        hash = (hash ^ c) * 1099511628211ULL;
+        last = c;
+        space = false;
+    }
+    return hash;
+}
+
+/**
+ * </StatementTrace>
+ */
+
+// Traces are found by database handle, since query cursors only know their statement.
+// Slots are claimed under sTracesMutex but read without locking.
+static const int MAX_TRACED_CONNECTIONS = 64;
+
+struct TraceSlot {
+    std::atomic<sqlite3*> db;
+    std::atomic<StatementTrace*> trace;
+};
+
+static TraceSlot sTraces[MAX_TRACED_CONNECTIONS];
+static std::atomic<int> sTraceSlotsUsed(0);
+static std::mutex sTracesMutex;
+
+StatementTrace* find_statement_trace(sqlite3* db, bool enabledOnly) {
+    int used = sTraceSlotsUsed.load(std::memory_order_acquire);
+    for (int i = 0; i < used; i++) {
+        if (sTraces[i].db.load(std::memory_order_acquire) == db) {
+            StatementTrace* trace = sTraces[i].trace.load(std::memory_order_acquire);
+            if (trace && enabledOnly && !trace->enabled.load(std::memory_order_relaxed))
+                return NULL;
+            return trace;
+        }
+    }
+    return NULL;
+}
+
+bool enable_statement_trace(sqlite3* db, int capacity) {
+    std::lock_guard<std::mutex> lock(sTracesMutex);
+    int used = sTraceSlotsUsed.load(std::memory_order_relaxed);
+    TraceSlot* slot = NULL;
+    TraceSlot* freeSlot = NULL;
+    for (int i = 0; i < used && !slot; i++) {
+        sqlite3* slotDb = sTraces[i].db.load(std::memory_order_relaxed);
+        if (slotDb == db)
+            slot = &sTraces[i];
+        else if (slotDb == NULL && !freeSlot)
+            freeSlot = &sTraces[i];
+    }
+    StatementTrace* trace = slot ? slot->trace.load(std::memory_order_relaxed) : NULL;
+
+    if (capacity <= 0) {
+        if (trace)
+            trace->enabled.store(false, std::memory_order_relaxed);
+        return true;
+    }
+
+    uint32_t size = 16;
+    while (size < (uint32_t)capacity && size < (1u << 20))
+        size <<= 1;
+    if (trace && trace->mask + 1 == size) {
+        // Resume the existing trace, forgetting cursors that were in progress when it stopped.
+        for (int i = 0; i < StatementTrace::MAX_CURSORS; i++)
+            trace->cursors[i].statement.store(NULL, std::memory_order_relaxed);
+        trace->enabled.store(true, std::memory_order_release);
+        return true;
+    }
+
+    if (!slot) {
+        slot = freeSlot;
+        if (!slot) {
+            if (used == MAX_TRACED_CONNECTIONS)
+                return false;
+            slot = &sTraces[used];
+        }
+    }
+    // The replaced trace may still be in use by another thread, so it is freed with its
+    // replacement when the connection closes.
+    slot->trace.store(new StatementTrace(size, trace), std::memory_order_release);
+    slot->db.store(db, std::memory_order_release);
+    if (slot == &sTraces[used])
+        sTraceSlotsUsed.store(used + 1, std::memory_order_release);
+    return true;
+}
+
+void release_statement_trace(sqlite3* db) {
+    std::lock_guard<std::mutex> lock(sTracesMutex);
+    int used = sTraceSlotsUsed.load(std::memory_order_relaxed);
+    for (int i = 0; i < used; i++) {
+        if (sTraces[i].db.load(std::memory_order_relaxed) == db) {
+            sTraces[i].db.store(NULL, std::memory_order_release);
+            delete sTraces[i].trace.exchange(NULL, std::memory_order_acq_rel);
+            return;
+        }
+    }
+}
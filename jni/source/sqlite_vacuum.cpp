@@ -0,0 +1,175 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  The scheduler shares the connection with the thread using it, which is safe because
+//  connections are opened with SQLITE_OPEN_FULLMUTEX. Each batch holds the connection's mutex
+//  from the idle check to the end of the vacuum, so the connection's thread can't begin a
+//  transaction or start a statement in between. Batches don't wait for locks held by other
+//  connections, as that wait would hold the mutex too.
+//
+
+#include <stdio.h>
+#include <chrono>
+
+#include "sqlite_vacuum.h"
+#include "sqlite_log.h"
+
+// Pause between batches, so that the connection's thread gets in if it wants the connection.
+static const int PAUSE_MILLIS = 10;
+
+int read_int_pragma(sqlite3* db, const char* name, sqlite3_int64* value) {
+    char sql[64];
+    snprintf(sql, sizeof(sql), "PRAGMA %s", name);
+    sqlite3_stmt* statement;
+    int err = sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+    if (err != SQLITE_OK)
+        return err;
+    err = sqlite3_step(statement);
+    if (err == SQLITE_ROW) {
+        *value = sqlite3_column_int64(statement, 0);
+        err = SQLITE_OK;
+    } else if (err == SQLITE_DONE) {
+        err = SQLITE_ERROR;
+    }
+    sqlite3_finalize(statement);
+    return err;
+}
+
+// Clears the busy timeout of a connection while it lives, so that what the background thread runs
+// fails with SQLITE_BUSY at once when another connection has the database locked, instead of
+// waiting out the timeout with the connection's mutex held and its own thread stalled. The
+// connection's mutex must be held throughout.
+struct NoBusyWait {
+    sqlite3* const db;
+    sqlite3_int64 timeout;
+
+    NoBusyWait(sqlite3* db) : db(db), timeout(0) {
+        if (read_int_pragma(db, "busy_timeout", &timeout) == SQLITE_OK && timeout > 0)
+            sqlite3_busy_timeout(db, 0);
+    }
+
+    ~NoBusyWait() {
+        if (timeout > 0)
+            sqlite3_busy_timeout(db, (int)timeout);
+    }
+};
+
+static int readFreePages(sqlite3* db, sqlite3_int64* pages) {
+    sqlite3_mutex* mutex = sqlite3_db_mutex(db);
+    sqlite3_mutex_enter(mutex);
+    int err;
+    {
+        NoBusyWait noBusyWait(db);
+        err = read_int_pragma(db, "freelist_count", pages);
+    }
+    sqlite3_mutex_leave(mutex);
+    return err;
+}
+
+static bool isIdle(sqlite3* db) {
+    if (!sqlite3_get_autocommit(db))
+        return false;
+    for (sqlite3_stmt* statement = sqlite3_next_stmt(db, NULL); statement;
+         statement = sqlite3_next_stmt(db, statement)) {
+        if (sqlite3_stmt_busy(statement))
+            return false;
+    }
+    return true;
+}
+
+int incremental_vacuum_step(sqlite3* db, int pages, int* freed) {
+    *freed = 0;
+    if (pages <= 0)
+        return SQLITE_OK;   // incremental_vacuum(0) would free every page at once
+
+    sqlite3_mutex* mutex = sqlite3_db_mutex(db);
+    sqlite3_mutex_enter(mutex);
+    int err = SQLITE_BUSY;
+    if (isIdle(db)) {
+        NoBusyWait noBusyWait(db);
+        sqlite3_int64 before = 0, after = 0;
+        err = read_int_pragma(db, "freelist_count", &before);
+        if (err == SQLITE_OK && before > 0) {
+            char sql[64];
+            snprintf(sql, sizeof(sql), "PRAGMA incremental_vacuum(%d)", pages);
+            err = sqlite3_exec(db, sql, NULL, NULL, NULL);
+            if (err == SQLITE_OK)
+                err = read_int_pragma(db, "freelist_count", &after);
+            if (err == SQLITE_OK && before > after)
+                *freed = (int)(before - after);
+        }
+    }
+    sqlite3_mutex_leave(mutex);
+    return err;
+}
+
+/**
+ * <VacuumScheduler>
+ */
+
+VacuumScheduler::VacuumScheduler(SQLiteConnection* connection, int pagesPerStep, int idleMillis,
+                                 int minFreePages) :
+connection(connection), pagesPerStep(pagesPerStep), idleMillis(idleMillis),
+minFreePages(minFreePages), stopping(false), pagesVacuumed(0), steps(0),
+thread(&VacuumScheduler::run, this) {
+}
+
+VacuumScheduler::~VacuumScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    thread.join();
+}
+
+void VacuumScheduler::run() {
+    sqlite3* db = connection->db;
+    std::unique_lock<std::mutex> lock(mutex);
+    unsigned lastActivity = connection->activity;
+    while (!stopping) {
+        wakeup.wait_for(lock, std::chrono::milliseconds(idleMillis));
+        if (stopping)
+            break;
+        unsigned activity = connection->activity;
+        if (activity != lastActivity) {
+            lastActivity = activity;    // Not idle for a whole period yet
+            continue;
+        }
+
+        lock.unlock();
+        sqlite3_int64 freePages = 0;
+        int err = readFreePages(db, &freePages);
+        bool more = err == SQLITE_OK && freePages > 0 && freePages >= minFreePages;
+        while (more) {
+            int freed;
+            err = incremental_vacuum_step(db, pagesPerStep, &freed);
+            if (err != SQLITE_OK) {
+                // SQLITE_BUSY is another connection writing, or this one in use: try again later.
+                if (err != SQLITE_BUSY && err != SQLITE_LOCKED)
+                    LOGE(SQLITE_LOG_TAG, "Incremental vacuum of %p failed: %d", db, err);
+                break;
+            }
+            lock.lock();
+            pagesVacuumed += freed;
+            steps++;
+            if (freed >= pagesPerStep && connection->activity == activity && !stopping)
+                wakeup.wait_for(lock, std::chrono::milliseconds(PAUSE_MILLIS));
+            more = freed >= pagesPerStep && connection->activity == activity && !stopping;
+            lock.unlock();
+        }
+        lock.lock();
+    }
+}
+
+/**
+ * </VacuumScheduler>
+ */
@@ -0,0 +1,127 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+
+#include <string.h>
+#include <mutex>
+
+#include "sqlite_vfs_shim.h"
+
+static std::mutex sRegistryMutex;   // Guards finding a free name and registering it
+
+static sqlite3_vfs* baseOf(sqlite3_vfs* vfs) {
+    return reinterpret_cast<VfsShim*>(vfs)->base;
+}
+
+static int vfsDelete(sqlite3_vfs* vfs, const char* name, int syncDir) {
+    return baseOf(vfs)->xDelete(baseOf(vfs), name, syncDir);
+}
+
+static int vfsAccess(sqlite3_vfs* vfs, const char* name, int flags, int* result) {
+    return baseOf(vfs)->xAccess(baseOf(vfs), name, flags, result);
+}
+
+static int vfsFullPathname(sqlite3_vfs* vfs, const char* name, int size, char* out) {
+    return baseOf(vfs)->xFullPathname(baseOf(vfs), name, size, out);
+}
+
+static void* vfsDlOpen(sqlite3_vfs* vfs, const char* path) {
+    return baseOf(vfs)->xDlOpen(baseOf(vfs), path);
+}
+
+static void vfsDlError(sqlite3_vfs* vfs, int size, char* message) {
+    baseOf(vfs)->xDlError(baseOf(vfs), size, message);
+}
+
+static void (*vfsDlSym(sqlite3_vfs* vfs, void* handle, const char* symbol))(void) {
+    return baseOf(vfs)->xDlSym(baseOf(vfs), handle, symbol);
+}
+
+static void vfsDlClose(sqlite3_vfs* vfs, void* handle) {
+    baseOf(vfs)->xDlClose(baseOf(vfs), handle);
+}
+
+static int vfsRandomness(sqlite3_vfs* vfs, int size, char* out) {
+    return baseOf(vfs)->xRandomness(baseOf(vfs), size, out);
+}
+
+static int vfsSleep(sqlite3_vfs* vfs, int micros) {
+    return baseOf(vfs)->xSleep(baseOf(vfs), micros);
+}
+
+static int vfsCurrentTime(sqlite3_vfs* vfs, double* now) {
+    return baseOf(vfs)->xCurrentTime(baseOf(vfs), now);
+}
+
+static int vfsGetLastError(sqlite3_vfs* vfs, int size, char* message) {
+    return baseOf(vfs)->xGetLastError(baseOf(vfs), size, message);
+}
+
+static int vfsCurrentTimeInt64(sqlite3_vfs* vfs, sqlite3_int64* now) {
+    return baseOf(vfs)->xCurrentTimeInt64(baseOf(vfs), now);
+}
+
+static int vfsSetSystemCall(sqlite3_vfs* vfs, const char* name, sqlite3_syscall_ptr call) {
+    return baseOf(vfs)->xSetSystemCall(baseOf(vfs), name, call);
+}
+
+static sqlite3_syscall_ptr vfsGetSystemCall(sqlite3_vfs* vfs, const char* name) {
+    return baseOf(vfs)->xGetSystemCall(baseOf(vfs), name);
+}
+
+static const char* vfsNextSystemCall(sqlite3_vfs* vfs, const char* name) {
+    return baseOf(vfs)->xNextSystemCall(baseOf(vfs), name);
+}
+
+void init_vfs_shim(VfsShim* shim, sqlite3_vfs* base, const char* name, int szOsFile,
+                   vfs_open_function xOpen, void* owner) {
+    sqlite3_vfs* vfs = &shim->vfs;
+    memset(vfs, 0, sizeof(sqlite3_vfs));
+    shim->base = base;
+    shim->owner = owner;
+
+    // Only offer the methods of the versions the base VFS has.
+    vfs->iVersion = base->iVersion < 3 ? base->iVersion : 3;
+    vfs->szOsFile = szOsFile > base->szOsFile ? szOsFile : base->szOsFile;
+    vfs->mxPathname = base->mxPathname;
+    vfs->zName = name;
+    vfs->xOpen = xOpen;
+    vfs->xDelete = vfsDelete;
+    vfs->xAccess = vfsAccess;
+    vfs->xFullPathname = vfsFullPathname;
+    vfs->xDlOpen = base->xDlOpen ? vfsDlOpen : NULL;
+    vfs->xDlError = base->xDlError ? vfsDlError : NULL;
+    vfs->xDlSym = base->xDlSym ? vfsDlSym : NULL;
+    vfs->xDlClose = base->xDlClose ? vfsDlClose : NULL;
+    vfs->xRandomness = vfsRandomness;
+    vfs->xSleep = vfsSleep;
+    vfs->xCurrentTime = vfsCurrentTime;
+    vfs->xGetLastError = base->xGetLastError ? vfsGetLastError : NULL;
+    if (vfs->iVersion >= 2 && base->xCurrentTimeInt64)
+        vfs->xCurrentTimeInt64 = vfsCurrentTimeInt64;
+    if (vfs->iVersion >= 3) {
+        vfs->xSetSystemCall = base->xSetSystemCall ? vfsSetSystemCall : NULL;
+        vfs->xGetSystemCall = base->xGetSystemCall ? vfsGetSystemCall : NULL;
+        vfs->xNextSystemCall = base->xNextSystemCall ? vfsNextSystemCall : NULL;
+    }
+}
+
+bool register_vfs_shim(VfsShim* shim) {
+    std::lock_guard<std::mutex> lock(sRegistryMutex);
+    if (sqlite3_vfs_find(shim->vfs.zName))
+        return false;
+    return sqlite3_vfs_register(&shim->vfs, 0) == SQLITE_OK;
+}
+
+void unregister_vfs_shim(VfsShim* shim) {
+    std::lock_guard<std::mutex> lock(sRegistryMutex);
+    sqlite3_vfs_unregister(&shim->vfs);
+}
@@ -0,0 +1,56 @@
+//
+//  Copyright (c) 2015 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+//
+//  Empty ICU data package, linked instead of libicudata when the library is built with
+//  -P icuStubData. ICU then has no data until SQLiteJsonCollator.nativeSetICUData() maps a
+//  package (see vendor/icu4c-android/build-collation-data.sh); until it does, the JSON
+//  collator falls back to binary comparison of strings.
+//
+//  Same layout as stubdata.c in the ICU sources.
+//
+
+#include <unicode/utypes.h>
+#include <unicode/udata.h>
+
+struct ICUDataHeader {
+    uint16_t headerSize;
+    uint8_t magic1, magic2;
+    UDataInfo info;
+    char padding[8];
+    uint32_t count, reserved;
+    struct {
+        const char* nameOffset;
+        const char* dataOffset;
+    } toc[1];
+    int fakeNameAndData[4];
+};
+
+extern "C" U_EXPORT const ICUDataHeader U_ICUDATA_ENTRY_POINT = {
+    32,                                 // headerSize
+    0xda,                               // magic1
+    0x27,                               // magic2
+    {
+        sizeof(UDataInfo),              // size
+        0,                              // reserved
+        U_IS_BIG_ENDIAN,
+        U_CHARSET_FAMILY,
+        sizeof(UChar),
+        0,                              // reserved
+        { 0x54, 0x6f, 0x43, 0x50 },     // dataFormat "ToCP"
+        { 1, 0, 0, 0 },                 // formatVersion
+        { 0, 0, 0, 0 }                  // dataVersion
+    },
+    { 0, 0, 0, 0, 0, 0, 0, 0 },         // padding
+    0,                                  // count
+    0,                                  // reserved
+    { { 0, 0 } },                       // toc
+    { 0, 0, 0, 0 }
+};
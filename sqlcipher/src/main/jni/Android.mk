@@ -33,7 +33,21 @@ LOCAL_SRC_FILES := ../../../../jni/source/com_couchbase_lite_internal_database_s
                    ../../../../jni/source/com_couchbase_lite_internal_database_sqlite_SQLiteQueryCursor.cpp \
                    ../../../../jni/source/com_couchbase_lite_storage_SQLiteJsonCollator.cpp \
                    ../../../../jni/source/com_couchbase_lite_storage_SQLiteRevCollator.cpp \
-                   ../../../../jni/source/sqlite_common.cpp
+                   ../../../../jni/source/com_couchbase_lite_storage_SQLiteTokenizer.cpp \
+                   ../../../../jni/source/com_couchbase_lite_storage_SQLiteRTreeGeometry.cpp \
+                   ../../../../jni/source/sqlite_changes.cpp \
+                   ../../../../jni/source/sqlite_common.cpp \
+                   ../../../../jni/source/sqlite_group_commit.cpp \
+                   ../../../../jni/source/sqlite_io_stats.cpp \
+                   ../../../../jni/source/sqlite_json_canonical.cpp \
+                   ../../../../jni/source/sqlite_memory.cpp \
+                   ../../../../jni/source/sqlite_memory_vfs.cpp \
+                   ../../../../jni/source/sqlite_result_cache.cpp \
+                   ../../../../jni/source/sqlite_slow_query_log.cpp \
+                   ../../../../jni/source/sqlite_temp_store.cpp \
+                   ../../../../jni/source/sqlite_trace.cpp \
+                   ../../../../jni/source/sqlite_vacuum.cpp \
+                   ../../../../jni/source/sqlite_vfs_shim.cpp
 LOCAL_CPPFLAGS := -DANDROID_LOG
 LOCAL_CPPFLAGS += -DUSE_ICU4C_UNICODE_COMPARE
 LOCAL_CPPFLAGS += -DUCONFIG_ONLY_COLLATION=1
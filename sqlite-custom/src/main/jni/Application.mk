@@ -1,3 +1,4 @@
 # armeabi armeabi-v7a arm64-v8a x86 x86_64 mips mips64
 APP_ABI := all
-APP_STL := gnustl_static
\ No newline at end of file
+APP_STL := gnustl_static
+APP_CPPFLAGS := -std=c++11
\ No newline at end of file